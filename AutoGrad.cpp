@@ -18,61 +18,69 @@ Use at least C++17 or higher versions
 #include <cmath>
 #include <cstring>
 #include <cstdint>
+#include <algorithm>
+#include <climits>
+#include <memory>
 /*
 Used STL containers
 std::vector
-std::map
+std::unordered_map
+std::deque
 std::string
 std::set
 
 Usage:
-------------------------std::map------------------------
+------------------------FlatHashMap------------------------
 
-1. VarMap (std::map<std::string, int>)
-- Purpose: Maps variable names to unique integer IDs for efficient 
-		   lookup and management.
-- Usage: When a new variable is encountered, it is inserted into VarMap with
-		 a generated ID. Subsequent lookups use this map to quickly find the 
-		 ID associated with a variable name.
+Not an STL container: an open-addressing hash map keyed by ExprHash
+(see TOOL FUNCTIONS) with inline storage for small sizes.
 
-2. Factors (std::map<ExprHash, ExprNode**>)
+1. Factors (FlatHashMap<ExprNode**>)
 - Purpose: Tracks factors during polynomial simplification to identify common terms.
 - Usage: During the simplification process, factors of terms are stored in
 		 this map to facilitate combining like terms and extracting common factors.
 
-3. Common (std::map<ExprHash, CommonFactor>)
-- Purpose: Identifies common factors between different terms during simplification.
-- Usage: When comparing terms to find common factors, this map stores 
-		 the relationships between common elements found in different 
-		 parts of the expression.
+2. AtomIndex (FlatHashMap<int>)
+- Purpose: Numbers the atoms of a SparsePolynomial by their hash, a hit
+		   is confirmed with Equal.
+- Usage: The monomials of the terms of a sum refer to their factors by
+		 these numbers, so like terms compare as runs of integers.
 
-4. Tg (std::map<ExprHash, ExprNode**>)
+3. Tg (FlatHashMap<ExprNode**>)
 - Purpose: Temporarily holds hash values of expressions during various 
            simplification steps.
 - Usage: In multiple simplification functions, this map is used to 
          track hashes of nodes that have been processed to avoid redundant 
 		 operations and ensure each node is simplified efficiently.
 
-std::map is chosen for these scenarios due to its efficient key-value 
-storage and retrieval capabilities. It allows for quick lookups, 
-insertions, and deletions, which are essential for managing variables, 
-tracking expression components during simplification, and optimizing the 
-overall performance of the expression processing pipeline.
+4. PartialMemo (FlatHashMap<MemoizedPartial>)
+- Purpose: Memoizes the derivatives of subtrees by structure and variable.
+- Usage: ExprNode::Partial fills it in post-order, so repeated subtrees
+		 are differentiated once and share their derivative node. Each
+		 entry keeps its subtree, so a hash collision is not taken for a hit.
 
-------------------------std::set------------------------
+5. SettledMonomial, SettledPolynomial (FlatHashMap<bool>)
+- Purpose: Record the shapes of the subtrees that Simplify_MonomialImpl and
+		   Simplify_Polynomial left unchanged.
+- Usage: RewriteUnlessSettled skips a pass on a subtree whose shape is in
+		 its table, so the rounds of Simplify only revisit what changed.
+
+These tables are rebuilt for every term, and the keys are already hashes,
+so a flat table that keeps the first slots inside the object avoids the
+heap node per insert of a tree map and does not allocate for small sizes.
 
-1. DupStrings (std::set<char*>)
-- Purpose: Manages duplicate strings to ensure each unique string is
-		   stored only once.
-- Usage: When creating string duplicates, it checks if the string already
-		 exists in the set to avoid redundancy.
+------------------------std::set------------------------
 
-2. Extracted (std::set<ExprHash>)
+1. Extracted (std::set<ExprHash>)
 - Purpose: Keeps track of extracted hash values during the simplification
 		   process to prevent reprocessing.
 - Usage: During various simplification steps, it stores hashes of
 		 processed nodes to ensure each node is simplified only once.
 
+2. Occurred (std::set<ExprHash>)
+- Purpose: Records the hashes of the tree seen by the Simplify loop.
+- Usage: The loop stops once the tree hashes to a value seen before.
+
 std::set is chosen for these purposes due to its
 properties of unique element storage and efficient lookup. It helps
 in managing resources efficiently and avoiding unnecessary computations
@@ -86,38 +94,51 @@ during the expression tree processing.
 		 expression, such as numbers, variables, operators, and functions, 
 		 which are then used to build the expression tree.
 
-2. Nodes (std::vector<ExprNode*>)
-- Purpose: Manages a pool of expression nodes to optimize memory usage 
-		   and reuse nodes when possible.
-- Usage: Nodes are created and stored in this vector during the construction
-		 of the expression tree, allowing for efficient node management and traversal.
-
-3. UnusedNode (std::vector<ExprNode*>)
-- Purpose: Keeps track of nodes that are no longer in use and can be 
+2. NodeArena::Slabs (std::vector<ExprNode*>)
+- Purpose: Owns the memory of all expression nodes as contiguous slabs
+		   of fixed size.
+- Usage: Nodes are handed out from the slab under the arena cursor during
+		 the construction of the expression tree. At the end of a round the
+		 cursor is rewound and the slabs are reused by the next round.
+		 CompactNodes copies the live trees into the spare slabs in
+		 post-order and swaps the old slabs to the back as spares.
+
+3. LiveRoots (std::vector<ExprNode**>)
+- Purpose: Registers the roots of all live expressions.
+- Usage: Expr adds its root on construction and removes it on
+		 destruction. Compaction relocates exactly the trees reachable
+		 from these roots and reclaims every other slot.
+
+4. UnusedNode (std::vector<ExprNode*>)
+- Purpose: Keeps track of slab slots that are no longer in use and can be 
            reused to avoid memory reallocation.
 - Usage: When nodes are released or removed from the tree, they are 
 		 added to this vector to be reused later, enhancing performance.
 
-4. Brackets (std::vector<BracketPtr>)
+5. Brackets (std::vector<BracketPtr>)
 - Purpose: Tracks the positions of brackets during the parsing process 
            to handle nested expressions correctly.
 - Usage: As the parser encounters brackets, it records their positions 
 		 in this vector to manage the scope and priority of operations 
 		 within brackets.
 
-5. TraverseSeries (std::vector<ExprNode*>)
-- Purpose: Temporarily stores nodes during tree traversal operations.
-- Usage: Various simplification and manipulation functions use this 
-		 vector to collect nodes of specific types or properties 
-		 for further processing.
-
-6. ExprV (std::vector<ExprNode*>)
+6. ScratchArena<T>::Chunks (std::vector<Chunk>)
+- Purpose: Backs the temporary lists (ScratchList) of flattened operands,
+		   coefficients and factor tables used by the simplifier.
+- Usage: TraverseType and TraverseTypeLocal collect the operands of a + or *
+		 chain into a ScratchList. Lists nest like scopes on this chunked
+		 stack and give their space back when they go out of scope, so
+		 traversals may nest and steady-state use does not allocate.
+		 Stage III of polynomial simplification sorts such a list of
+		 (hash, index) pairs, so like terms are merged in one linear pass.
+
+7. ExprV (std::vector<ExprNode*>)
 - Purpose: Used during the creation of subtrees to hold 
 		   intermediate expression nodes.
 - Usage: When constructing complex expressions, this vector helps 
 		 manage the nodes that form parts of the larger expression tree.
 
-7. OprV (std::vector<ExprNode*>)
+8. OprV (std::vector<ExprNode*>)
 - Purpose: Stores operator nodes during the parsing and tree construction process.
 - Usage: Helps in managing the order and precedence of operators 
 		 when building the expression tree from the token sequence.
@@ -127,12 +148,54 @@ management and efficient element access. It provides a flexible way to
 store and manipulate sequences of elements, making it suitable for managing 
 tokens, nodes, and other components during the expression processing pipeline.
 
+------------------------std::deque------------------------
+
+1. ParseLinks (std::deque<ParseNode>)
+- Purpose: Holds the doubly linked token sequence used while parsing.
+- Usage: Every token and every collapsed subtree gets a link here, so the
+		 expression nodes themselves carry no parse-only pointers. It is
+		 cleared once the expression tree is built.
+
+2. WalkStack pools (std::deque<std::vector<T>>)
+- Purpose: Provide the explicit stacks used to walk trees without recursion.
+- Usage: Every walk (Duplicate, ReleaseTree, Hash, Partial, PrintTree, the
+		 Simplify passes, ...) borrows one stack for its lifetime. Walks may
+		 nest, so the pool holds one stack per nesting level, and the stacks
+		 keep their capacity for later walks.
+
+std::deque is chosen because growing it never moves the existing elements,
+so the Prev/Next pointers between links and the borrowed stacks stay valid.
+
+------------------------std::unordered_map------------------------
+
+1. ConsTable.Table (std::unordered_map<ConsKey, ExprNode*>)
+- Purpose: Maps a (token, left operand, right operand) triple to the node
+		   already built for it while a derivative is constructed.
+- Usage: Node creation looks the triple up first, so identical subtrees of
+		 the derivative are shared instead of copied.
+
+2. BigLiterals.Index (std::unordered_map<std::string, int>)
+- Purpose: Maps the decimal text of an integer too large for an int to
+		   its ID in BigLiterals.
+- Usage: Equal large values get one ID, so their Token::Big nodes hash
+		 and compare like small integers.
+
+3. EGraph::Memo (std::unordered_map<ENode, int>)
+- Purpose: Maps an e-node, a token over the canonical classes of its
+		   operands, to the e-node already in the e-graph.
+- Usage: Adding a term looks its e-nodes up first, and rebuilding after
+		 a merge finds e-nodes that became equal through it.
+
+std::unordered_map is chosen because the keys have no useful order and
+every node creation performs a lookup.
+
 ------------------------std::string------------------------
 
-1. Vars (std::vector<std::string>)
+1. Symbols.Text (std::string)
 - Purpose: Stores the names of variables encountered in the expression.
-- Usage: When a new variable is found during tokenization, its name 
-		 is stored here for reference and management.
+- Usage: When a new variable is found during tokenization, its name is
+		 appended here once, and SymbolTable maps it to a variable ID
+		 through an open-addressing index keyed by HashStr.
 
 2. Expression (std::string)
 - Purpose: Holds the input mathematical expression as a string.
@@ -141,20 +204,15 @@ tokens, nodes, and other components during the expression processing pipeline.
 
 3. Token::GetText() method
 - Purpose: Returns the textual representation of a token.
-- Usage: Depending on the token type, it constructs and returns a 
-		 string that represents the token's value.
+- Usage: Depending on the token type, it returns the function name, a
+		 static one-character operator string, the interned variable name
+		 or an integer formatted into a static buffer. It never allocates.
 
-4. HashStr functions
+4. HashStr function
 - Purpose: Computes a hash value for a given string.
-- Usage: These functions take a string (like variable or function names) 
-		 and compute a hash to be used in various hash-based operations.
-
-5. DuplicateStr and related functions
-- Purpose: Creates duplicate strings with proper memory management.
-- Usage: Ensures that strings used in the expression tree are properly 
-		 allocated and managed to avoid memory leaks.
+- Usage: Variable names are hashed once when they are interned.
 
-6. Function names in the Funcs array
+5. Function names in the Funcs array
 - Purpose: Stores the names of mathematical functions.
 - Usage: These strings are used to identify and match functions during 
 		 the parsing and evaluation of the expression tree.
@@ -166,9 +224,11 @@ This makes it possible to correctly parse and interpret the mathematical
 expressions provided by the user.
 */
 #include <string>
+#include <array>
 #include <set>
-#include <map>
 #include <vector>
+#include <deque>
+#include <unordered_map>
 
 //-----------------------------------------------------------------
 //-----------------------------------------------------------------
@@ -185,6 +245,12 @@ const bool EnableDebugSimplifyI = false;
 //Switch data simplify debug output on/off
 const bool EnableDebugSimplifyII = false;
 
+//Switch node memory statistics output on/off
+const bool EnableDebugMemory = false;
+
+//Switch hash cache statistics output on/off
+const bool EnableDebugHash = false;
+
 
 
 //-----------------------------------------------------------------
@@ -213,2746 +279,6025 @@ ExprHash TransformHash(ExprHash H)
 	gcd(C, M)=1
 	A mod 8 = 1
 	this multiplier A = 6364136223846793005 because STL selects it
+	The xor-shift afterwards keeps it a bijection but makes it non-linear,
+	otherwise sums over operands collide whenever the IDs sum up equally
+	(the hash of x+w equals the one of y+z for IDs 0,1,2,3)
 	*/
-	return H * 6364136223846793005 + 7;
+	H = H * 6364136223846793005 + 7;
+	return H ^ (H >> 29);
 }
 
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
-//---------FUNDAMENTAL TYPE DEFINITION & GLOBAL VARIABLES----------
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
-
-/*
-- Purpose: Manages duplicate strings to ensure each unique string is
-		   stored only once.
-- Usage: When creating string duplicates, it checks if the string already
-		 exists in the set to avoid redundancy.
-*/
-std::set<char*> DupStrings;
-
 /**
- * @brief Duplicates a string and manages it within a set to prevent duplicates.
+ * @brief An open-addressing hash map keyed by ExprHash.
  *
- * @param V The string to be duplicated.
- * @param Len The length of the string to be duplicated.
- * @return char* A pointer to the duplicated string stored in the set.
- */
-char* DuplicateStr(const char* V, size_t Len)
-{
-	auto Iter = DupStrings.insert(new char[Len + 1] {}).first;
-	strncpy(*Iter, V, Len);
-	return *Iter;
-}
-/**
- * @brief Creates a new string of a specified length and manages it within a set.
+ * The first InlineSlots slots live inside the object, so a map holding a few
+ * factors never touches the heap. Clear() only starts a new generation and keeps
+ * the storage, so a map can be reused across calls without reallocating.
+ * Iteration order is the slot order, not the key order.
  *
- * @param Len The desired length of the new string.
- * @return char* A pointer to the newly created string stored in the set.
+ * @tparam T The mapped type.
+ * @tparam InlineSlots Number of inline slots, a power of 2.
  */
-char* MakeStr(size_t Len)
+template<typename T, size_t InlineSlots = 16>
+class FlatHashMap
 {
-	auto Iter = DupStrings.insert(new char[Len + 1] {}).first;
-	return *Iter;
-}
-int StrToIntEx(const char* Begin, const char* End);
-
-/*
-- Purpose: Records the amount of used variables
-- Usage: When a new variable is found during tokenization, VarMaxID increases by 1.
-*/
-int VarMaxID{ 0 };
-/*
-- Purpose: Stores the names of variables encountered in the expression.
-- Usage: When a new variable is found during tokenization, its name 
-		 is stored here for reference and management.
-*/
-std::vector<std::string> Vars;
-/*
-- Purpose: Maps variable names to unique integer IDs for efficient
-		   lookup and management.
-- Usage: When a new variable is encountered, it is inserted into VarMap with
-		 a generated ID. Subsequent lookups use this map to quickly find the
-		 ID associated with a variable name.
-*/
-std::map<std::string, int> VarMap;
-int GetVarID(const char* Name);
-
-/**
- * @brief A placeholder struct used to explicitly mark function IDs.
- *
- * This struct serves as a tag to distinguish function IDs from other integer values
- * when constructing tokens, ensuring type safety and clarity in the code.
- */
-struct AsFuncID final {};
+	static_assert((InlineSlots & (InlineSlots - 1)) == 0, "InlineSlots must be a power of 2");
+public:
+	///< A key-value pair stored in a slot.
+	struct Entry
+	{
+		ExprHash Key;
+		T Value;
+	};
+private:
+	Entry InlineEntry[InlineSlots]{};
+	unsigned InlineStamp[InlineSlots]{};
+	std::vector<Entry> HeapEntry;
+	std::vector<unsigned> HeapStamp;
+	Entry* Slots{ InlineEntry };
+	unsigned* Stamps{ InlineStamp };
+	size_t Mask{ InlineSlots - 1 };
+	size_t Count{ 0 };
+	///< A slot is occupied if its stamp equals the current generation.
+	unsigned Gen{ 1 };
+
+	size_t Home(ExprHash K) const { return (size_t)(TransformHash(K) >> 32) & Mask; }
+
+	void Rebind()
+	{
+		if (HeapEntry.empty()) { Slots = InlineEntry; Stamps = InlineStamp; }
+		else { Slots = HeapEntry.data(); Stamps = HeapStamp.data(); }
+	}
 
-/**
- * @brief Represents a token in the mathematical expression, such as a number, variable, function, or operator.
- */
-struct Token
-{
-	//Enumerates the possible types of tokens.
-	enum Type
+	void Grow()
 	{
-		Int,
-		Variable,
-		Function,
-		Operator
+		std::vector<Entry> OldEntry(Slots, Slots + Mask + 1);
+		std::vector<unsigned> OldStamp(Stamps, Stamps + Mask + 1);
+		auto OldGen = Gen;
+		HeapEntry.assign((Mask + 1) * 2, Entry{});
+		HeapStamp.assign((Mask + 1) * 2, 0);
+		Mask = Mask * 2 + 1;
+		Gen = 1; Count = 0;
+		Rebind();
+		for (size_t I = 0; I < OldEntry.size(); I++)
+			if (OldStamp[I] == OldGen)(*this)[OldEntry[I].Key] = OldEntry[I].Value;
+	}
+public:
+	class Iterator
+	{
+		const FlatHashMap* M;
+		size_t I;
+		void Skip() { while (I <= M->Mask && M->Stamps[I] != M->Gen)I++; }
+	public:
+		Iterator(const FlatHashMap* m, size_t i) :M(m), I(i) { Skip(); }
+		Entry& operator*() const { return M->Slots[I]; }
+		Iterator& operator++() { I++; Skip(); return *this; }
+		bool operator!=(const Iterator& R) const { return I != R.I; }
 	};
 
-	//Members
-	///< The type of the token.
-	Type Ty{ Int };
-	///< The identifier or value of the token.
-	int ID{ 0 };
+	FlatHashMap() = default;
+	FlatHashMap(const FlatHashMap& R) { *this = R; }
+	FlatHashMap& operator=(const FlatHashMap& R)
+	{
+		if (this == &R)return *this;
+		std::copy(R.InlineEntry, R.InlineEntry + InlineSlots, InlineEntry);
+		std::copy(R.InlineStamp, R.InlineStamp + InlineSlots, InlineStamp);
+		HeapEntry = R.HeapEntry; HeapStamp = R.HeapStamp;
+		Mask = R.Mask; Count = R.Count; Gen = R.Gen;
+		Rebind();
+		return *this;
+	}
 
-	//Member Functions
-	Token() = default;
-	Token(int V);
-	Token(char Opr);
-	Token(int FuncID, AsFuncID);
-	Token(char* Var);
-	const char* GetText() const;
-	bool IsLBK() const { return Ty == Operator && ID == '('; }//equals to '('
-	bool IsRBK() const { return Ty == Operator && ID == ')'; }//equals to '('
-	bool IsCOM() const { return Ty == Operator && ID == ','; }//equals to ','
-	bool IsPOW() const;
-	bool IsIgnoredSymbol() const { return Ty == Operator && (ID == '(' || ID == ')' || ID == ','); }
-	bool IsSUB() const { return Ty == Operator && ID == '-'; }//equals to ','
 	/**
-	 * @brief Compares this token with another for equality.
+	 * @brief Finds the value stored under a key.
 	 *
-	 * @param R The token to compare with.
-	 * @return true If the tokens are equal.
-	 * @return false Otherwise.
+	 * @return T* Pointer to the value, or nullptr if the key is absent.
 	 */
-	bool operator==(const Token& R) const { return Ty == R.Ty && ID == R.ID; }
+	T* Find(ExprHash K)
+	{
+		for (size_t I = Home(K);; I = (I + 1) & Mask)
+		{
+			if (Stamps[I] != Gen)return nullptr;
+			if (Slots[I].Key == K)return &Slots[I].Value;
+		}
+	}
+
 	/**
-	 * Note : sizeof(Token)==sizeof(ExprHash) so this is safe
-	 * @brief Computes a hash value for the token.
-	 * 
-	 * @return ExprHash The hash value of the token.
+	 * @brief Returns the value stored under a key, inserting T() if absent.
 	 */
-	ExprHash Hash() const { return TransformHash(*reinterpret_cast<const ExprHash*>(this)); }
-};
+	T& operator[](ExprHash K)
+	{
+		if ((Count + 1) * 4 > (Mask + 1) * 3)Grow();
+		for (size_t I = Home(K);; I = (I + 1) & Mask)
+		{
+			if (Stamps[I] != Gen)
+			{
+				Stamps[I] = Gen;
+				Slots[I] = { K, T() };
+				Count++;
+				return Slots[I].Value;
+			}
+			if (Slots[I].Key == K)return Slots[I].Value;
+		}
+	}
 
-/*
-- Purpose: Stores the sequence of tokens generated from the input expression.
-- Usage: After tokenization, this vector holds all the elements of the
-		 expression, such as numbers, variables, operators, and functions,
-		 which are then used to build the expression tree.
-*/
-std::vector<Token> Tokens;
+	/**
+	 * @brief Removes all entries while keeping the storage.
+	 */
+	void Clear()
+	{
+		Count = 0;
+		if (++Gen == 0)
+		{
+			std::fill(Stamps, Stamps + Mask + 1, 0);
+			Gen = 1;
+		}
+	}
 
-//Declaration of Derivative functions
-struct ExprNode;
-ExprNode* DX_ln(const ExprNode* Op1, const ExprNode* Op2, int DX);
-ExprNode* DX_log(const ExprNode* Op1, const ExprNode* Op2, int DX);
-ExprNode* DX_cos(const ExprNode* Op1, const ExprNode* Op2, int DX);
-ExprNode* DX_sin(const ExprNode* Op1, const ExprNode* Op2, int DX);
-ExprNode* DX_tan(const ExprNode* Op1, const ExprNode* Op2, int DX);
-ExprNode* DX_pow(const ExprNode* Op1, const ExprNode* Op2, int DX);
-ExprNode* DX_exp(const ExprNode* Op1, const ExprNode* Op2, int DX);
-ExprNode* DX_sinh(const ExprNode* Op1, const ExprNode* Op2, int DX);
-ExprNode* DX_cosh(const ExprNode* Op1, const ExprNode* Op2, int DX);
-ExprNode* DX_add(const ExprNode* Op1, const ExprNode* Op2, int DX);
-ExprNode* DX_sub(const ExprNode* Op1, const ExprNode* Op2, int DX);
-ExprNode* DX_mul(const ExprNode* Op1, const ExprNode* Op2, int DX);
-ExprNode* DX_div(const ExprNode* Op1, const ExprNode* Op2, int DX);
+	size_t Size() const { return Count; }
+	bool Empty() const { return Count == 0; }
+	Iterator begin() const { return Iterator(this, 0); }
+	Iterator end() const { return Iterator(this, Mask + 1); }
+};
 
 /**
- * @brief Represents a mathematical expression and provides 
- functionality for parsing, differentiation, and simplification.
+ * @brief An explicit stack for walking trees without recursion.
+ *
+ * Walks may nest (a pass can run another pass on a subtree while it walks), so
+ * every WalkStack borrows its own vector from a pool for its lifetime. The vectors
+ * keep their capacity, so walks do not allocate once the pool has warmed up.
+ *
+ * @tparam T The type of a stack frame.
  */
-struct Expr
+template<typename T>
+class WalkStack
 {
-	//Members
-	///< The root node of the expression tree.
-	ExprNode* Root{ nullptr };
+	//std::deque never moves its elements, so borrowed vectors stay in place
+	static std::deque<std::vector<T>>& Pool() { static std::deque<std::vector<T>> P; return P; }
+	static size_t& Depth() { static size_t D{ 0 }; return D; }
+	static std::vector<T>& Borrow()
+	{
+		if (Depth() == Pool().size())Pool().emplace_back();
+		return Pool()[Depth()++];
+	}
+	std::vector<T>& S;
+public:
+	WalkStack() :S(Borrow()) {}
+	~WalkStack() { S.clear(); --Depth(); }
+	WalkStack(const WalkStack&) = delete;
+	WalkStack& operator=(const WalkStack&) = delete;
+
+	void Push(const T& V) { S.push_back(V); }
+	T Pop() { T V = S.back(); S.pop_back(); return V; }
+	T& Top() { return S.back(); }
+	bool Empty() const { return S.empty(); }
+};
+
+/**
+ * @brief Chunked stack memory backing the ScratchList<T> objects.
+ *
+ * Lists take the space above the current top and give it back in reverse order
+ * of creation. The chunks are never freed, so once they are large enough for
+ * the deepest nesting, creating and filling lists does not allocate.
+ *
+ * @tparam T The element type, default constructible.
+ */
+template<typename T>
+struct ScratchArena
+{
+	///< Minimum number of elements in a chunk.
+	static constexpr size_t ChunkSize = std::max<size_t>(16, 16384 / sizeof(T));
+	struct Chunk
+	{
+		T* Data;
+		size_t Cap;
+	};
+	///< The chunks in stack order; the ones above Cur are free.
+	std::vector<Chunk> Chunks;
+	///< The chunk holding the top of the stack.
+	size_t Cur{ 0 };
+	///< The top of the stack in chunk Cur.
+	size_t Top{ 0 };
+
+	static ScratchArena& Get() { static ScratchArena A; return A; }
+	~ScratchArena() { for (auto& C : Chunks)delete[] C.Data; }
 
-	//Member Functions
-	Expr() = delete;
-	~Expr();
-	/**
-	 * @brief Constructs an expression from a sequence of tokens.
-	 *
-	 * @param Toks The vector of tokens representing the mathematical expression.
-	 */
-	Expr(const std::vector<Token>& Toks);
 	/**
-	 * @brief Constructs an expression by differentiating another expression with respect to a variable.
+	 * @brief Moves the topmost list into the next chunk that can hold twice its size.
 	 *
-	 * @param F The original expression to differentiate.
-	 * @param DX The ID of the variable with respect to which to differentiate.
-	 */
-	Expr(const Expr& F, int DX);
-	/**
-	 * @brief Prints the expression to the standard output.
+	 * @param Data Elements of the list, which ends at the top of the stack.
+	 * @param Count Number of elements.
+	 * @return T* The new location of the elements.
 	 */
-	void Print() const;
+	T* Relocate(const T* Data, size_t Count)
+	{
+		size_t Need = std::max(ChunkSize, Count * 2);
+		size_t Next = Chunks.empty() ? 0 : Cur + 1;
+		if (Next == Chunks.size() || Chunks[Next].Cap < Need)
+			Chunks.insert(Chunks.begin() + Next, Chunk{ new T[Need], Need });
+		std::copy(Data, Data + Count, Chunks[Next].Data);
+		Cur = Next;
+		Top = Count;
+		return Chunks[Cur].Data;
+	}
 };
 
 /**
- * @brief Represents a mathematical function with its properties and derivative rules.
+ * @brief A temporary list of T allocated from ScratchArena<T>, with a vector-like interface.
  *
- * This class encapsulates the necessary information for handling mathematical functions
- * within the expression tree, including the function's name, the number of parameters it expects,
- * and a pointer to the function that computes its derivative.
+ * The list is released when it goes out of scope. Lists nest like scopes, and only
+ * the most recently created list may grow. A full list moves to a bigger chunk,
+ * so element addresses are stable once the list stops growing.
+ *
+ * @tparam T The element type.
  */
-struct Function
+template<typename T>
+class ScratchList
 {
-	//Members
-	///< The name of the function (e.g., "sin", "cos").
-	const char* Name;
-	///< The number of parameters the function takes.
-	int NParam; 
-	///< Pointer to the derivative function.
-	ExprNode* (*Derivative)(const ExprNode* Op1, const ExprNode* Op2, int DX);
+	ScratchArena<T>& A;
+	size_t SavedCur, SavedTop;
+	T* Data;
+	size_t Count{ 0 };
+public:
+	ScratchList() :A(ScratchArena<T>::Get()), SavedCur(A.Cur), SavedTop(A.Top),
+		Data(A.Chunks.empty() ? nullptr : A.Chunks[A.Cur].Data + A.Top) {}
+	~ScratchList() { A.Cur = SavedCur; A.Top = SavedTop; }
+	ScratchList(const ScratchList&) = delete;
+	ScratchList& operator=(const ScratchList&) = delete;
+
+	void push_back(const T& V)
+	{
+		if (A.Chunks.empty() || A.Top == A.Chunks[A.Cur].Cap)Data = A.Relocate(Data, Count);
+		Data[Count++] = V;
+		A.Top++;
+	}
+	template<typename... Args>
+	void emplace_back(Args&&... Arg) { push_back(T(std::forward<Args>(Arg)...)); }
+	void clear() { A.Top -= Count; Count = 0; }
+
+	size_t size() const { return Count; }
+	bool empty() const { return Count == 0; }
+	T& operator[](size_t I) { return Data[I]; }
+	T& back() { return Data[Count - 1]; }
+	T* begin() { return Data; }
+	T* end() { return Data + Count; }
 };
 
-/*
-- Purpose: Maps function names to their respective metadata, including the
-           number of parameters and derivative rules.
-- Usage: During expression parsing, when a function token is encountered, 
-         the parser looks up this array to validate the function and retrieve 
-		 its details. It is also used during differentiation to apply the 
-		 correct derivative rules.
+/**
+ * @brief Adds two 64-bit integers unless the sum leaves [-LLONG_MAX, LLONG_MAX].
+ *
+ * LLONG_MIN is kept out of range so that every result can be negated.
+ *
+ * @return bool False on overflow, R is then unchanged.
  */
-Function Funcs[] = {
-#define FUNC_ln 0
-	{"ln",1,DX_ln},
-#define FUNC_log 1
-	{"log",2,DX_log},
-#define FUNC_cos 2
-	{"cos",1,DX_cos},
-#define FUNC_sin 3
-	{"sin",1,DX_sin},
-#define FUNC_tan 4
-	{"tan",1,DX_tan},
-#define FUNC_pow 5
-	{"pow",2,DX_pow},
-#define FUNC_exp 6
-	{"exp",1,DX_exp},
-//Added EXT
-#define FUNC_sinh 7
-	{"sinh",1,DX_sinh},
-//Added EXT
-#define FUNC_cosh 8
-	{"cosh",1,DX_cosh}
-};
-//Count of the Functions
-const int NFuncs = sizeof(Funcs) / sizeof(Function);
-int GetFuncID(const char* Name);//if not found return -1
-
-/*
-An array containing all valid operators and symbols used in mathematical expressions.
-- Purpose: To provide a centralized list of characters recognized as 
-           operators or special symbols.
-- Usage: This array is referenced during tokenization to identify 
-         operators and symbols in the input string.
-*/
-char Operators[] = "+-*/^,()";
-const int NOpr = sizeof(Operators) - 1;
+inline bool CheckedAdd(long long A, long long B, long long& R)
+{
+	if (B > 0 ? A > LLONG_MAX - B : A < -LLONG_MAX - B)return false;
+	R = A + B;
+	return true;
+}
 
 /**
- * @brief Checks if a character is a valid operator or special symbol.
- *
- * @param c The character to check.
- * @return true If the character is found in the Operators array.
- * @return false Otherwise.
+ * @brief Multiplies two 64-bit integers unless the product leaves [-LLONG_MAX, LLONG_MAX].
+ * @return bool False on overflow, R is then unchanged.
  */
-bool IsOpr(char c)
+inline bool CheckedMul(long long A, long long B, long long& R)
 {
-	for (int i = 0; i < NOpr; i++)
-		if (c == Operators[i])
-			return true;
-	return false;
+	unsigned long long UA = A < 0 ? 0ULL - (unsigned long long)A : (unsigned long long)A;
+	unsigned long long UB = B < 0 ? 0ULL - (unsigned long long)B : (unsigned long long)B;
+	// Two factors below 2^31 cannot overflow, which is the common case
+	if (((UA | UB) >> 31) && UA && UB > (unsigned long long)LLONG_MAX / UA)return false;
+	R = A * B;
+	return true;
 }
 
 /**
- * @brief Represents a node in the expression tree, containing information about the token it holds and its child nodes.
+ * @brief An arbitrary-precision integer, sign and magnitude in base 2^32.
+ *
+ * Only the exact folding of constants needs it, after a Fraction overflowed
+ * 64 bits, so the operations are the plain schoolbook ones.
  */
-struct ExprNode
+struct BigInt
 {
-	///< The token stored in this node (e.g., integer, variable, function, or operator).
-	Token V{};
-	///< Pointer to the previous node in the expression tree.
-	ExprNode* Prev{};
-	///< Pointer to the next node in the expression tree.
-	ExprNode* Next{};
-	///< Array storing pointers to child nodes (left and right operands).
-	ExprNode* Operand[2]{};
+	///< Magnitude, least significant limb first, without leading zero limbs
+	std::vector<uint32_t> Mag;
+	bool Neg{ false };
 
-	/**
-	 * @brief Returns the operator precedence level of this node.
-	 *
-	 * @param ConsiderUsedNode Whether to consider if the node is already used.
-	 * @return int The precedence level of the operator.
-	 */
-	int OprLevel(bool ConsiderUsedNode) const;
+	BigInt() = default;
+	BigInt(long long V) : Neg(V < 0)
+	{
+		unsigned long long M = V < 0 ? 0ULL - (unsigned long long)V : (unsigned long long)V;
+		for (; M; M >>= 32)Mag.push_back((uint32_t)M);
+	}
 
 	/**
-	 * @brief Prints the node's information for debugging purposes.
+	 * @brief Parses a run of decimal digits.
 	 */
-	void DebugPrint() const;
-	void DebugPrintTraverse(const ExprNode* End) const;
+	BigInt(const char* Begin, const char* End)
+	{
+		for (; Begin < End; ++Begin)MulAddSmall(10, *Begin - '0');
+	}
 
-	/**
-	 * @brief Prints the subtree rooted at this node in a tree-like structure.
-	 *
-	 * @param Parent The parent node of this node.
-	 * @param PrintedCount A counter for the number of nodes printed.
-	 * @param IsLeft Indicates if this node is the left child of its parent.
-	 */
-	void PrintTree(const ExprNode* Parent, int& PrintedCount, bool IsLeft) const;
-	void PrintTree(const ExprNode* Parent = nullptr) const { int C{}; PrintTree(Parent, C, false); }
-
-	/**
-	 * @brief Computes the partial derivative of this node with respect to a variable.
-	 *
-	 * @param DX The ID of the variable with respect to which to differentiate.
-	 * @return ExprNode* The resulting node after differentiation.
-	 */
-	ExprNode* Partial(int DX) const;
-
-	/**
-	 * @brief Computes the partial derivative for operator nodes.
-	 *
-	 * @param DX The ID of the variable with respect to which to differentiate.
-	 * @return ExprNode* The resulting node after differentiation.
-	 */
-	ExprNode* PartialOpr(int DX) const;
-
-	/**
-	 * @brief Creates a copy of this node.
-	 *
-	 * @return ExprNode* A duplicate of this node.
-	 */
-	ExprNode* Duplicate() const;
+	bool operator==(const BigInt& R) const { return Neg == R.Neg && Mag == R.Mag; }
+	bool IsZero() const { return Mag.empty(); }
+	bool IsOne() const { return !Neg && Mag.size() == 1 && Mag[0] == 1; }
+	void Trim()
+	{
+		while (!Mag.empty() && !Mag.back())Mag.pop_back();
+		if (Mag.empty())Neg = false;
+	}
 
 	/**
-	 * @brief Computes the hash value of this node.
-	 *
-	 * @return ExprHash The hash value of the node.
+	 * @brief Checks whether the value lies in [-LLONG_MAX, LLONG_MAX] and stores it in V.
 	 */
-	ExprHash Hash() const;
+	bool ToLL(long long& V) const
+	{
+		if (Mag.size() > 2)return false;
+		unsigned long long M = 0;
+		for (size_t I = Mag.size(); I--;)M = M << 32 | Mag[I];
+		if (M > (unsigned long long)LLONG_MAX)return false;
+		V = Neg ? -(long long)M : (long long)M;
+		return true;
+	}
+	double ToDouble() const
+	{
+		double V = 0;
+		for (size_t I = Mag.size(); I--;)V = V * 4294967296.0 + Mag[I];
+		return Neg ? -V : V;
+	}
+	size_t Bits() const
+	{
+		if (Mag.empty())return 0;
+		size_t B = Mag.size() * 32;
+		for (uint32_t Top = Mag.back(); !(Top >> 31); Top <<= 1)B--;
+		return B;
+	}
+	std::string ToString() const
+	{
+		std::string S;
+		BigInt T = *this;
+		while (!T.IsZero())
+		{
+			uint32_t R = T.DivSmall(1000000000);
+			T.Trim();
+			for (int K = 0; K < 9 && (R || !T.IsZero()); K++, R /= 10)S.push_back(char('0' + R % 10));
+		}
+		if (S.empty())S = "0";
+		if (Neg)S.push_back('-');
+		std::reverse(S.begin(), S.end());
+		return S;
+	}
 
-	/**
-	 * @brief Checks if this node represents a squared term.
-	 *
-	 * @return bool True if the node is a squared term, false otherwise.
-	 */
-	bool IsSquare() const;
+	// *this = *this * M + A on the magnitude
+	void MulAddSmall(uint32_t M, uint32_t A)
+	{
+		unsigned long long Carry = A;
+		for (auto& L : Mag)
+		{
+			Carry += (unsigned long long)L * M;
+			L = (uint32_t)Carry;
+			Carry >>= 32;
+		}
+		if (Carry)Mag.push_back((uint32_t)Carry);
+	}
+	// Divides the magnitude in place and returns the remainder
+	uint32_t DivSmall(uint32_t D)
+	{
+		unsigned long long R = 0;
+		for (size_t I = Mag.size(); I--;)
+		{
+			R = R << 32 | Mag[I];
+			Mag[I] = (uint32_t)(R / D);
+			R %= D;
+		}
+		return (uint32_t)R;
+	}
 
-	/**
-	 * @brief Checks if this node represents a constant value.
-	 *
-	 * @return bool True if the node is a constant, false otherwise.
-	 */
-	bool IsConst() const;
+	static int CompareMag(const std::vector<uint32_t>& A, const std::vector<uint32_t>& B)
+	{
+		if (A.size() != B.size())return A.size() < B.size() ? -1 : 1;
+		for (size_t I = A.size(); I--;)
+			if (A[I] != B[I])return A[I] < B[I] ? -1 : 1;
+		return 0;
+	}
+	// A += B on magnitudes
+	static void AddMag(std::vector<uint32_t>& A, const std::vector<uint32_t>& B)
+	{
+		if (A.size() < B.size())A.resize(B.size(), 0);
+		unsigned long long Carry = 0;
+		for (size_t I = 0; I < A.size(); I++)
+		{
+			Carry += (unsigned long long)A[I] + (I < B.size() ? B[I] : 0);
+			A[I] = (uint32_t)Carry;
+			Carry >>= 32;
+		}
+		if (Carry)A.push_back((uint32_t)Carry);
+	}
+	// A -= B on magnitudes, A >= B
+	static void SubMag(std::vector<uint32_t>& A, const std::vector<uint32_t>& B)
+	{
+		long long Borrow = 0;
+		for (size_t I = 0; I < A.size(); I++)
+		{
+			long long Cur = (long long)A[I] - (I < B.size() ? B[I] : 0) - Borrow;
+			Borrow = Cur < 0;
+			A[I] = (uint32_t)(Cur + (Borrow << 32));
+		}
+		while (!A.empty() && !A.back())A.pop_back();
+	}
 
-	/**
-	 * @brief Checks if this node represents a constant value excluding radicals.
-	 *
-	 * @return bool True if the node is a constant in the specified form, false otherwise.
-	 */
-	bool IsConstII() const;
+	BigInt operator-() const
+	{
+		BigInt R = *this;
+		if (!R.IsZero())R.Neg = !R.Neg;
+		return R;
+	}
+	BigInt operator+(const BigInt& R) const
+	{
+		BigInt S = *this;
+		if (Neg == R.Neg)AddMag(S.Mag, R.Mag);
+		else if (CompareMag(Mag, R.Mag) >= 0)SubMag(S.Mag, R.Mag);
+		else
+		{
+			S = R;
+			SubMag(S.Mag, Mag);
+		}
+		S.Trim();
+		return S;
+	}
+	BigInt operator-(const BigInt& R) const { return *this + (-R); }
+	BigInt operator*(const BigInt& R) const
+	{
+		BigInt P;
+		if (IsZero() || R.IsZero())return P;
+		P.Mag.assign(Mag.size() + R.Mag.size(), 0);
+		for (size_t I = 0; I < Mag.size(); I++)
+		{
+			unsigned long long Carry = 0;
+			for (size_t J = 0; J < R.Mag.size(); J++)
+			{
+				Carry += P.Mag[I + J] + (unsigned long long)Mag[I] * R.Mag[J];
+				P.Mag[I + J] = (uint32_t)Carry;
+				Carry >>= 32;
+			}
+			P.Mag[I + R.Mag.size()] = (uint32_t)Carry;
+		}
+		P.Neg = Neg != R.Neg;
+		P.Trim();
+		return P;
+	}
 
 	/**
-	 * @brief Checks if the left operand exists.
+	 * @brief Truncating division, the remainder takes the sign of the dividend.
 	 *
-	 * @return bool True if the left operand exists, false otherwise.
+	 * Shifts the dividend in bit by bit, so it is quadratic in the length.
 	 */
-	bool HasOp0() const { return Operand[0] != nullptr; }
+	static void DivMod(const BigInt& A, const BigInt& B, BigInt& Q, BigInt& R)
+	{
+		Q = BigInt();
+		R = BigInt();
+		Q.Mag.assign(A.Mag.size(), 0);
+		for (size_t I = A.Mag.size() * 32; I--;)
+		{
+			//R = R * 2 + the next bit of A
+			R.MulAddSmall(2, A.Mag[I / 32] >> (I % 32) & 1);
+			while (!R.Mag.empty() && !R.Mag.back())R.Mag.pop_back();
+			if (CompareMag(R.Mag, B.Mag) >= 0)
+			{
+				SubMag(R.Mag, B.Mag);
+				Q.Mag[I / 32] |= 1u << (I % 32);
+			}
+		}
+		Q.Neg = A.Neg != B.Neg;
+		R.Neg = A.Neg;
+		Q.Trim();
+		R.Trim();
+	}
+	BigInt operator/(const BigInt& R) const
+	{
+		BigInt Q, M;
+		DivMod(*this, R, Q, M);
+		return Q;
+	}
+	static BigInt Gcd(BigInt A, BigInt B)
+	{
+		A.Neg = B.Neg = false;
+		while (!B.IsZero())
+		{
+			BigInt Q, M;
+			DivMod(A, B, Q, M);
+			A = std::move(B);
+			B = std::move(M);
+		}
+		return A;
+	}
+};
 
-	/**
-	 * @brief Checks if the right operand exists.
-	 *
-	 * @return bool True if the right operand exists, false otherwise.
-	 */
-	bool HasOp1() const { return Operand[1] != nullptr; }
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+//---------FUNDAMENTAL TYPE DEFINITION & GLOBAL VARIABLES----------
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
 
-	/**
-	 * @brief Gets the type of the left operand's token.
-	 *
-	 * @return Token::Type The type of the left operand's token.
-	 */
-	Token::Type Ty0() const { return Operand[0]->V.Ty; }
+bool StrToIntEx(const char* Begin, const char* End, int& Value);
 
-	/**
-	 * @brief Gets the type of the right operand's token.
-	 *
-	 * @return Token::Type The type of the right operand's token.
-	 */
-	Token::Type Ty1() const { return Operand[1]->V.Ty; }
+/**
+ * @brief Computes the FNV-1a hash of a character range.
+ *
+ * @param Begin The start of the characters.
+ * @param Len The number of characters.
+ * @return ExprHash The hash value.
+ */
+ExprHash HashStr(const char* Begin, size_t Len)
+{
+	ExprHash H = 14695981039346656037ull;
+	for (size_t i = 0; i < Len; i++)H = (H ^ (unsigned char)Begin[i]) * 1099511628211ull;
+	return H;
+}
 
-	/**
-	 * @brief Gets the ID of the left operand's token.
-	 *
-	 * @return int& The ID of the left operand's token.
-	 */
-	int& ID0() const { return Operand[0]->V.ID; }
+/**
+ * @brief Interns variable names and assigns them consecutive IDs.
+ *
+ * Names are hashed once and their text is appended to a single character arena,
+ * so a name costs no allocation of its own. Clear() keeps the capacity of the
+ * arena and of the index for the next round.
+ */
+struct SymbolTable
+{
+	///< A name stored in the arena.
+	struct Symbol
+	{
+		size_t Offset;
+		size_t Len;
+		ExprHash Hash;
+	};
+	///< The text of all names, each followed by '\0'.
+	std::string Text;
+	///< The interned names, indexed by ID.
+	std::vector<Symbol> Symbols;
+	///< Open-addressing index from name hash to ID, -1 for an empty slot.
+	std::vector<int> Index;
 
 	/**
-	 * @brief Gets the ID of the right operand's token.
+	 * @brief Returns the ID of a name, assigning the next ID if it is new.
 	 *
-	 * @return int& The ID of the right operand's token.
+	 * @param Begin The start of the name.
+	 * @param Len The length of the name.
+	 * @return int The ID of the name.
 	 */
-	int& ID1() const { return Operand[1]->V.ID; }
+	int Intern(const char* Begin, size_t Len)
+	{
+		if ((Symbols.size() + 1) * 2 > Index.size())
+		{
+			Index.assign(std::max<size_t>(16, Index.size() * 2), -1);
+			for (int ID = 0; ID < (int)Symbols.size(); ID++)
+				Index[Slot(Symbols[ID].Hash, nullptr, 0)] = ID;
+		}
+		auto H = HashStr(Begin, Len);
+		auto I = Slot(H, Begin, Len);
+		if (Index[I] == -1)
+		{
+			Index[I] = (int)Symbols.size();
+			Symbols.push_back({ Text.size(), Len, H });
+			Text.append(Begin, Len);
+			Text.push_back('\0');
+		}
+		return Index[I];
+	}
 
 	/**
-	 * @brief Gets the left operand's token.
+	 * @brief Looks a name up without interning it.
 	 *
-	 * @return Token: The left operand's token.
+	 * @return int The ID of the name, -1 if it was not interned.
 	 */
-	Token V0() const { return Operand[0]->V; }
+	int Find(const char* Begin, size_t Len) const
+	{
+		if (Index.empty())return -1;
+		return Index[Slot(HashStr(Begin, Len), Begin, Len)];
+	}
 
 	/**
-	 * @brief Gets the right operand's token.
+	 * @brief Returns the name of an ID.
 	 *
-	 * @return Token: The right operand's token.
+	 * The pointer stays valid until the next name is interned.
 	 */
-	Token V1() const { return Operand[1]->V; }
-
-	/**
-	* @brief Gets the left operand node.
-	*
-	* @return ExprNode*& The left operand node.
-	*/
-	ExprNode*& L() { return Operand[0]; }
+	const char* Name(int ID) const { return Text.data() + Symbols[ID].Offset; }
 
-	/**
-	 * @brief Gets the right operand node.
-	 *
-	 * @return ExprNode*& The right operand node.
-	 */
-	ExprNode*& R() { return Operand[1]; }
+	///< Number of interned names.
+	int Size() const { return (int)Symbols.size(); }
 
 	/**
-	 * @brief Gets the left operand node (const version).
-	 *
-	 * @return const ExprNode* The left operand node.
+	 * @brief Returns all IDs ordered by name.
 	 */
-	const ExprNode* L() const { return Operand[0]; }
+	std::vector<int> SortedIDs() const
+	{
+		std::vector<int> IDs(Symbols.size());
+		std::iota(IDs.begin(), IDs.end(), 0);
+		std::sort(IDs.begin(), IDs.end(), [this](int A, int B) {return strcmp(Name(A), Name(B)) < 0; });
+		return IDs;
+	}
 
 	/**
-	 * @brief Gets the right operand node (const version).
-	 *
-	 * @return const ExprNode* The right operand node.
+	 * @brief Forgets all names while keeping the storage.
 	 */
-	const ExprNode* R() const { return Operand[1]; }
-
+	void Clear()
+	{
+		Text.clear();
+		Symbols.clear();
+		std::fill(Index.begin(), Index.end(), -1);
+	}
+private:
 	/**
-	 * @brief Copy data from another node.
+	 * @brief Finds the index slot holding a name, or the empty slot where it belongs.
+	 * With a null Begin the first empty slot is returned.
 	 */
-	void Copy(const ExprNode* r)
+	size_t Slot(ExprHash H, const char* Begin, size_t Len) const
 	{
-		V = r->V;
-		Operand[0] = r->Operand[0];
-		Operand[1] = r->Operand[1];
+		size_t Mask = Index.size() - 1;
+		for (size_t I = (size_t)H & Mask;; I = (I + 1) & Mask)
+		{
+			if (Index[I] == -1)return I;
+			auto& S = Symbols[Index[I]];
+			if (Begin && S.Hash == H && S.Len == Len && !memcmp(Text.data() + S.Offset, Begin, Len))return I;
+		}
 	}
 };
 
 /*
-- Purpose: Manages a pool of expression nodes to optimize memory usage
-		   and reuse nodes when possible.
-- Usage: Nodes are created and stored in this vector during the construction
-		 of the expression tree, allowing for efficient node management and traversal.
-*/
-std::vector<ExprNode*> Nodes;
-/*
-- Purpose: Keeps track of nodes that are no longer in use and can be
-		   reused to avoid memory reallocation.
-- Usage: When nodes are released or removed from the tree, they are
-		 added to this vector to be reused later, enhancing performance.
+- Purpose: Stores the names of variables encountered in the expression
+		   and maps them to unique integer IDs.
+- Usage: When a new variable is found during tokenization, it is interned
+		 here and gets the next ID. The variable token stores the ID and
+		 printing looks the name up by ID.
 */
-std::vector<ExprNode*> UnusedNode;
+SymbolTable Symbols;
 
 /**
- * @brief A structure used to track bracket positions during expression parsing.
+ * @brief Interns the integer literals too large for the ID of a token.
+ *
+ * A Token::Big stores the index of its value here. Equal values share an
+ * index, so they hash alike like small integers do.
  */
-struct BracketPtr
+struct BigLiteralTable
 {
-	ExprNode* Left;///< Pointer to the left bracket node.
-	ExprNode* Comma;///< Pointer to the comma node within the brackets.
-};
-
-/*
-- Purpose: Tracks the positions of brackets during the parsing process
-		   to handle nested expressions correctly.
-- Usage: As the parser encounters brackets, it records their positions
-		 in this vector to manage the scope and priority of operations
-		 within brackets.
-*/
-std::vector <BracketPtr> Brackets;
+	///< The values, indexed by ID.
+	std::vector<BigInt> Values;
+	///< The decimal text of every value, indexed by ID.
+	std::vector<std::string> Texts;
+	///< Maps the decimal text to the ID.
+	std::unordered_map<std::string, int> Index;
 
-/*
-- Purpose: Used during the creation of subtrees to hold
-		   intermediate expression nodes.
-- Usage: When constructing complex expressions, this vector helps
-		 manage the nodes that form parts of the larger expression tree.
-*/
-std::vector <ExprNode*> ExprV;
+	/**
+	 * @brief Returns the ID of a value, assigning the next ID if it is new.
+	 */
+	int Intern(const BigInt& V)
+	{
+		auto Text = V.ToString();
+		auto it = Index.find(Text);
+		if (it != Index.end())return it->second;
+		int ID = (int)Values.size();
+		Index.emplace(Text, ID);
+		Values.push_back(V);
+		Texts.push_back(std::move(Text));
+		return ID;
+	}
 
-/*
-- Purpose: Stores operator nodes during the parsing and tree construction process.
-- Usage: Helps in managing the order and precedence of operators
-		 when building the expression tree from the token sequence.
-*/
-std::vector <ExprNode*> OprV;
+	void Clear()
+	{
+		Values.clear();
+		Texts.clear();
+		Index.clear();
+	}
+};
 
 /*
-- Purpose: Keeps track of extracted hash values during the simplification
-		   process to prevent reprocessing.
-- Usage: During various simplification steps, it stores hashes of
-		 processed nodes to ensure each node is simplified only once.
+- Purpose: Holds the values of the integers that do not fit in an int.
+- Usage: Large literals of the input and large results of constant folding
+		 are interned here, the Token::Big of the node stores the ID.
 */
-std::set<ExprHash> Extracted;
+BigLiteralTable BigLiterals;
 
-/*
-A flag indicating whether the parsing process has failed.
-- Purpose: To signal errors during the parsing of the mathematical expression.
-- Usage: Checked after parsing to determine if the expression was valid.
-*/
-bool FailedToParse;
-
-/*
-A flag indicating whether there is a DividedbyZero occurred
-- Purpose: To signal errors during the calculating of the mathematical expression.
-- Usage: Checked after calculating to determine if the expression was valid.
-*/
-bool DividedbyZero;
+/**
+ * @brief A placeholder struct used to explicitly mark variable IDs.
+ */
+struct AsVarID final {};
 
 /**
- * @brief Releases a node from the expression tree, marking it as unused.
- *
- * @param pNode The node to be released.
+ * @brief A placeholder struct used to explicitly mark the IDs of large integers in BigLiterals.
  */
-void ReleaseNode(const ExprNode*);
+struct AsBigID final {};
 
 /**
- * @brief Simplifies the expression tree rooted at the given node.
+ * @brief A placeholder struct used to explicitly mark function IDs.
  *
- * @param pNode The root node of the subtree to be simplified.
+ * This struct serves as a tag to distinguish function IDs from other integer values
+ * when constructing tokens, ensuring type safety and clarity in the code.
  */
-void Simplify(ExprNode*& pNode);
+struct AsFuncID final {};
 
 /**
- * @brief Creates a new node for the expression tree.
- *
- * @return ExprNode* A pointer to the newly created node.
+ * @brief Represents a token in the mathematical expression, such as a number, variable, function, or operator.
  */
-ExprNode* CreateNode();
-ExprNode* CreateNode(Token T);
-ExprNode* CreateNode(Token T, ExprNode* Op1, ExprNode* Op2);
+struct Token
+{
+	//Enumerates the possible types of tokens.
+	enum Type
+	{
+		Int,
+		Variable,
+		Function,
+		Operator,
+		///< An integer that does not fit in ID, which indexes BigLiterals instead
+		Big
+	};
 
-/**
- * @brief Releases the memory allocated for an expression tree.
- *
- * @param pRoot The root node of the expression tree to be released.
- */
-void ReleaseTree(const ExprNode* pRoot);
+	//Members
+	///< The type of the token.
+	Type Ty{ Int };
+	///< The identifier or value of the token.
+	int ID{ 0 };
 
-/**
- * @brief Generates tokens from a mathematical expression string.
- *
- * @param Str The input string representing the mathematical expression.
- * @param Toks A reference to a vector where the generated tokens will be stored.
- */
-void GenerateTokens(const std::string& Str, std::vector<Token>& Toks);
+	//Member Functions
+	Token() = default;
+	Token(int V);
+	Token(char Opr);
+	Token(int FuncID, AsFuncID);
+	Token(int VarID, AsVarID);
+	Token(int BigID, AsBigID);
+	const char* GetText() const;
+	bool IsLBK() const { return Ty == Operator && ID == '('; }//equals to '('
+	bool IsRBK() const { return Ty == Operator && ID == ')'; }//equals to '('
+	bool IsCOM() const { return Ty == Operator && ID == ','; }//equals to ','
+	bool IsPOW() const;
+	bool IsIgnoredSymbol() const { return Ty == Operator && (ID == '(' || ID == ')' || ID == ','); }
+	bool IsSUB() const { return Ty == Operator && ID == '-'; }//equals to ','
+	/**
+	 * @brief Compares this token with another for equality.
+	 *
+	 * @param R The token to compare with.
+	 * @return true If the tokens are equal.
+	 * @return false Otherwise.
+	 */
+	bool operator==(const Token& R) const { return Ty == R.Ty && ID == R.ID; }
+	/**
+	 * Note : sizeof(Token)==sizeof(ExprHash) so this is safe
+	 * @brief Computes a hash value for the token.
+	 * 
+	 * @return ExprHash The hash value of the token.
+	 */
+	ExprHash Hash() const { return TransformHash(*reinterpret_cast<const ExprHash*>(this)); }
+};
 
 /*
-- Purpose: Holds the input mathematical expression as a string.
-- Usage: This string is processed and parsed to generate tokens
-		 and build the expression tree.
+- Purpose: Stores the sequence of tokens generated from the input expression.
+- Usage: After tokenization, this vector holds all the elements of the
+		 expression, such as numbers, variables, operators, and functions,
+		 which are then used to build the expression tree.
 */
-std::string Expression;
+std::vector<Token> Tokens;
 
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
-//--------------MULTI TEST CASE RESOURCE CLEANER-------------------
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
+//Declaration of Derivative functions
+struct ExprNode;
+ExprNode* DX_ln(const ExprNode* Op1, const ExprNode* Op2, int DX);
+ExprNode* DX_log(const ExprNode* Op1, const ExprNode* Op2, int DX);
+ExprNode* DX_cos(const ExprNode* Op1, const ExprNode* Op2, int DX);
+ExprNode* DX_sin(const ExprNode* Op1, const ExprNode* Op2, int DX);
+ExprNode* DX_tan(const ExprNode* Op1, const ExprNode* Op2, int DX);
+ExprNode* DX_pow(const ExprNode* Op1, const ExprNode* Op2, int DX);
+ExprNode* DX_exp(const ExprNode* Op1, const ExprNode* Op2, int DX);
+ExprNode* DX_sinh(const ExprNode* Op1, const ExprNode* Op2, int DX);
+ExprNode* DX_cosh(const ExprNode* Op1, const ExprNode* Op2, int DX);
+ExprNode* DX_add(const ExprNode* Op1, const ExprNode* Op2, int DX);
+ExprNode* DX_sub(const ExprNode* Op1, const ExprNode* Op2, int DX);
+ExprNode* DX_mul(const ExprNode* Op1, const ExprNode* Op2, int DX);
+ExprNode* DX_div(const ExprNode* Op1, const ExprNode* Op2, int DX);
 
 /**
- * @brief A guard class to manage resources and reset global states for each parsing round.
+ * @brief A dual number V+D*e with e*e=0.
+ *
+ * Evaluating an expression on dual numbers yields its value together with
+ * its derivative along the direction given by the D parts of the variables.
  */
-struct RoundGuard
+struct Dual
 {
-	RoundGuard();
-	~RoundGuard();
+	///< The value.
+	double V;
+	///< The directional derivative.
+	double D;
 };
 
-/**
-* @brief Initializes a new round by resetting global states.
-*
-* Clears variable mappings, extracted hashes, and other relevant data structures
-* to ensure a clean state for the upcoming parsing and processing.
-*/
-RoundGuard::RoundGuard()
-{
-	VarMap.clear();
-	Vars.clear();
-	Extracted.clear();
-}
+//Declaration of dual number functions
+Dual EV_ln(Dual Op1, Dual Op2);
+Dual EV_log(Dual Op1, Dual Op2);
+Dual EV_cos(Dual Op1, Dual Op2);
+Dual EV_sin(Dual Op1, Dual Op2);
+Dual EV_tan(Dual Op1, Dual Op2);
+Dual EV_pow(Dual Op1, Dual Op2);
+Dual EV_exp(Dual Op1, Dual Op2);
+Dual EV_sinh(Dual Op1, Dual Op2);
+Dual EV_cosh(Dual Op1, Dual Op2);
+
+//Declaration of Taylor series functions, Op1/Op2/Res hold K+1 coefficients
+void TS_ln(const double* Op1, const double* Op2, double* Res, int K);
+void TS_log(const double* Op1, const double* Op2, double* Res, int K);
+void TS_cos(const double* Op1, const double* Op2, double* Res, int K);
+void TS_sin(const double* Op1, const double* Op2, double* Res, int K);
+void TS_tan(const double* Op1, const double* Op2, double* Res, int K);
+void TS_pow(const double* Op1, const double* Op2, double* Res, int K);
+void TS_exp(const double* Op1, const double* Op2, double* Res, int K);
+void TS_sinh(const double* Op1, const double* Op2, double* Res, int K);
+void TS_cosh(const double* Op1, const double* Op2, double* Res, int K);
 
 /**
-* @brief Cleans up allocated resources and resets global states.
-*
-* Releases memory for duplicated strings and nodes, clears all global containers,
-* and resets counters and flags to their default states.
-*/
-RoundGuard::~RoundGuard()
+ * @brief Represents a mathematical expression and provides 
+ functionality for parsing, differentiation, and simplification.
+ */
+struct Expr
 {
-	for (auto& p : DupStrings)delete[] p;
-	DupStrings.clear();
-	for (auto& p : Nodes)delete p;
-	Nodes.clear();
-	UnusedNode.clear();
-	Tokens.clear();
-	VarMaxID = 0;
-	FailedToParse = false;
-	DividedbyZero = false;
-}
+	//Members
+	///< The root node of the expression tree.
+	ExprNode* Root{ nullptr };
 
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
-//------------------------EXPRESSION PARSER------------------------
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
+	//Member Functions
+	Expr() = delete;
+	~Expr();
+	/**
+	 * @brief Constructs an expression from a sequence of tokens.
+	 *
+	 * @param Toks The vector of tokens representing the mathematical expression.
+	 * @param Simplified Whether to simplify the parsed tree.
+	 */
+	Expr(const std::vector<Token>& Toks, bool Simplified = true);
+	/**
+	 * @brief Constructs an expression by differentiating another expression with respect to a variable.
+	 *
+	 * @param F The original expression to differentiate.
+	 * @param DX The ID of the variable with respect to which to differentiate.
+	 */
+	Expr(const Expr& F, int DX);
+	/**
+	 * @brief Takes over a tree that has not been simplified yet.
+	 *
+	 * @param pTree The root of the tree.
+	 */
+	explicit Expr(ExprNode* pTree);
+	/**
+	 * @brief Computes all partial derivatives of an expression in one reverse-mode sweep.
+	 *
+	 * @param F The original expression to differentiate.
+	 * @param IDs The IDs of the variables to differentiate by.
+	 * @param Out Receives one unsimplified expression per ID, in the order of IDs.
+	 */
+	static void Gradient(const Expr& F, const std::vector<int>& IDs, std::deque<Expr>& Out);
+	/**
+	 * @brief Simplifies an expression taken over by Expr(ExprNode*).
+	 */
+	void Simplify();
+	//The root is registered in LiveRoots by address, so an Expr never moves
+	Expr(const Expr&) = delete;
+	Expr& operator=(const Expr&) = delete;
+	/**
+	 * @brief Prints the expression to the standard output.
+	 */
+	void Print() const;
+};
 
 /**
- * @brief Enumerates the possible token types when parsing characters in an expression.
+ * @brief Represents a mathematical function with its properties and derivative rules.
+ *
+ * This class encapsulates the necessary information for handling mathematical functions
+ * within the expression tree, including the function's name, the number of parameters it expects,
+ * and a pointer to the function that computes its derivative.
  */
-enum class TokCond {
-	Null,       ///< No valid token type.
-	Operator,   ///< Operator token (e.g., +, -, *, /).
-	Symbol,     ///< Symbol token (e.g., variable names, function names).
-	Number      ///< Number token.
+struct Function
+{
+	//Members
+	///< The name of the function (e.g., "sin", "cos").
+	const char* Name;
+	///< The number of parameters the function takes.
+	int NParam; 
+	///< Pointer to the derivative function.
+	ExprNode* (*Derivative)(const ExprNode* Op1, const ExprNode* Op2, int DX);
+	///< Pointer to the function evaluated on dual numbers.
+	Dual (*Eval)(Dual Op1, Dual Op2);
+	///< Pointer to the function evaluated on truncated power series.
+	void (*Series)(const double* Op1, const double* Op2, double* Res, int K);
+};
+
+/*
+- Purpose: Maps function names to their respective metadata, including the
+           number of parameters, derivative rules, dual number and power
+           series evaluation.
+- Usage: During expression parsing, when a function token is encountered, 
+         the parser looks up this array to validate the function and retrieve 
+		 its details. It is also used during differentiation to apply the 
+		 correct derivative rules.
+ */
+Function Funcs[] = {
+#define FUNC_ln 0
+	{"ln",1,DX_ln,EV_ln,TS_ln},
+#define FUNC_log 1
+	{"log",2,DX_log,EV_log,TS_log},
+#define FUNC_cos 2
+	{"cos",1,DX_cos,EV_cos,TS_cos},
+#define FUNC_sin 3
+	{"sin",1,DX_sin,EV_sin,TS_sin},
+#define FUNC_tan 4
+	{"tan",1,DX_tan,EV_tan,TS_tan},
+#define FUNC_pow 5
+	{"pow",2,DX_pow,EV_pow,TS_pow},
+#define FUNC_exp 6
+	{"exp",1,DX_exp,EV_exp,TS_exp},
+//Added EXT
+#define FUNC_sinh 7
+	{"sinh",1,DX_sinh,EV_sinh,TS_sinh},
+//Added EXT
+#define FUNC_cosh 8
+	{"cosh",1,DX_cosh,EV_cosh,TS_cosh}
 };
+//Count of the Functions
+const int NFuncs = sizeof(Funcs) / sizeof(Function);
+int GetFuncID(const char* Name, size_t Len);//if not found return -1
+
+/*
+An array containing all valid operators and symbols used in mathematical expressions.
+- Purpose: To provide a centralized list of characters recognized as 
+           operators or special symbols.
+- Usage: This array is referenced during tokenization to identify 
+         operators and symbols in the input string.
+*/
+char Operators[] = "+-*/^,()";
+const int NOpr = sizeof(Operators) - 1;
 
 /**
- * @brief Determines the token type of a given character.
+ * @brief Checks if a character is a valid operator or special symbol.
  *
- * @param c The character to be judged.
- * @return TokCond The token type of the character.
+ * @param c The character to check.
+ * @return true If the character is found in the Operators array.
+ * @return false Otherwise.
  */
-TokCond Judge(char c)
+bool IsOpr(char c)
 {
-	if (isdigit(c))return TokCond::Number;
-	else if (isalpha(c))return TokCond::Symbol;
-	else if (IsOpr(c))return TokCond::Operator;
-	//Note : ignore invalid characters 
-	else return TokCond::Null;
+	for (int i = 0; i < NOpr; i++)
+		if (c == Operators[i])
+			return true;
+	return false;
 }
+
 /**
- * @brief Parses a sequence of characters into a token based on the specified type.
- *
- * @param Type The type of the token to parse.
- * @param Begin The start of the character sequence.
- * @param Idx The end of the character sequence.
- * @param Toks The vector to which the parsed token will be added.
+ * @brief Represents a node in the expression tree, containing information about the token it holds and its child nodes.
  */
-void ParseToken(TokCond Type, const char* Begin, const char* Idx, std::vector<Token>& Toks)
+struct ExprNode
+{
+	///< The token stored in this node (e.g., integer, variable, function, or operator).
+	Token V{};
+	///< Array storing pointers to child nodes (left and right operands).
+	ExprNode* Operand[2]{};
+	///< The hash value of the subtree, valid while HashStamp equals HashEpoch.
+	mutable ExprHash HashCache{};
+	///< The hash epoch in which HashCache was computed, 0 if never.
+	mutable unsigned HashStamp{};
+	///< The order-sensitive hash of the subtree, computed along with HashCache.
+	mutable ExprHash ShapeCache{};
+	///< The variables the subtree depends on, bit ID%64 per variable ID (see UpdateDeps).
+	unsigned long long DepMask{};
+
+	/**
+	 * @brief Returns the operator precedence level of this node.
+	 *
+	 * @param ConsiderUsedNode Whether to consider if the node is already used.
+	 * @return int The precedence level of the operator.
+	 */
+	int OprLevel(bool ConsiderUsedNode) const;
+
+	/**
+	 * @brief Prints the node's information for debugging purposes.
+	 */
+	void DebugPrint() const;
+
+	/**
+	 * @brief Prints the subtree rooted at this node in a tree-like structure.
+	 *
+	 * @param Parent The parent node of this node.
+	 * @param PrintedCount A counter for the number of nodes printed.
+	 * @param IsLeft Indicates if this node is the left child of its parent.
+	 */
+	void PrintTree(const ExprNode* Parent, int& PrintedCount, bool IsLeft) const;
+	void PrintTree(const ExprNode* Parent = nullptr) const { int C{}; PrintTree(Parent, C, false); }
+
+	/**
+	 * @brief Computes the partial derivative of this node with respect to a variable.
+	 *
+	 * @param DX The ID of the variable with respect to which to differentiate.
+	 * @return ExprNode* The resulting node after differentiation. It shares nodes with
+	 *         this subtree and with the derivatives of the other trees differentiated
+	 *         in the same ConsTable session, so it is materialized afterwards.
+	 */
+	ExprNode* Partial(int DX) const;
+
+	/**
+	 * @brief Applies the derivative rule of this node, taking the derivatives
+	 *        of the operands from the current Partial walk.
+	 *
+	 * @param DX The ID of the variable with respect to which to differentiate.
+	 * @return ExprNode* The resulting node after differentiation.
+	 */
+	ExprNode* PartialNode(int DX) const;
+
+	/**
+	 * @brief Computes the partial derivative for operator nodes.
+	 *
+	 * @param DX The ID of the variable with respect to which to differentiate.
+	 * @return ExprNode* The resulting node after differentiation.
+	 */
+	ExprNode* PartialOpr(int DX) const;
+
+	/**
+	 * @brief Computes the derivative of this node with respect to one of its operands.
+	 *
+	 * @param Side 0 for the left operand, 1 for the right operand.
+	 * @return ExprNode* The local derivative, sharing nodes with this subtree.
+	 */
+	ExprNode* PartialOperand(int Side) const;
+
+	/**
+	 * @brief Computes the partial derivatives with respect to all variables in one backward sweep.
+	 *
+	 * @param Grad Indexed by variable ID, receives the sum of the adjoints of the
+	 *        occurrences of each variable, or nullptr if it does not occur.
+	 *        The results share nodes, so this runs inside ConsTable.
+	 */
+	void Gradient(std::vector<ExprNode*>& Grad) const;
+
+	/**
+	 * @brief Evaluates the subtree on dual numbers.
+	 *
+	 * @param Values Indexed by variable ID, the values and directions of the variables.
+	 * @return Dual The value and the directional derivative of the subtree.
+	 */
+	Dual Evaluate(const std::vector<Dual>& Values) const;
+
+	/**
+	 * @brief Evaluates the subtree on power series truncated after order K.
+	 *
+	 * @param Values Indexed by variable ID, the values and directions of the variables.
+	 * @param K The highest order.
+	 * @param Coef Receives the K+1 Taylor coefficients along the direction.
+	 */
+	void TaylorSeries(const std::vector<Dual>& Values, int K, std::vector<double>& Coef) const;
+
+	/**
+	 * @brief Creates a copy of this node.
+	 *
+	 * @return ExprNode* A duplicate of this node.
+	 */
+	ExprNode* Duplicate() const;
+
+	/**
+	 * @brief Computes the hash value of this node.
+	 *
+	 * The value is cached in the node until the next InvalidateHashes().
+	 *
+	 * @return ExprHash The hash value of the node.
+	 */
+	ExprHash Hash() const;
+
+	/**
+	 * @brief Computes the hash of the exact shape of the subtree.
+	 *
+	 * Unlike Hash(), the order of the operands of + and * and the way their
+	 * chains are nested count, so equal shapes are the same tree.
+	 * The value is cached in the node until the next InvalidateHashes().
+	 *
+	 * @return ExprHash The shape hash of the node.
+	 */
+	ExprHash Shape() const { Hash(); return ShapeCache; }
+
+	/**
+	 * @brief Recomputes DepMask from the token and the masks of the operands.
+	 */
+	void UpdateDeps()
+	{
+		DepMask = (V.Ty == Token::Variable ? 1ull << (V.ID & 63) : 0)
+			| (Operand[0] ? Operand[0]->DepMask : 0) | (Operand[1] ? Operand[1]->DepMask : 0);
+	}
+
+	/**
+	 * @brief Checks if the subtree may depend on a variable.
+	 *
+	 * @param DX The ID of the variable.
+	 * @return bool False if the subtree does not contain the variable, true if it may.
+	 */
+	bool MayDependOn(int DX) const { return DepMask >> (DX & 63) & 1; }
+
+	/**
+	 * @brief Checks if this node represents a squared term.
+	 *
+	 * @return bool True if the node is a squared term, false otherwise.
+	 */
+	bool IsSquare() const;
+
+	/**
+	 * @brief Checks if this node represents a constant value.
+	 *
+	 * @return bool True if the node is a constant, false otherwise.
+	 */
+	bool IsConst() const;
+
+	/**
+	 * @brief Checks if this node represents a constant value excluding radicals.
+	 *
+	 * @return bool True if the node is a constant in the specified form, false otherwise.
+	 */
+	bool IsConstII() const;
+
+	/**
+	 * @brief Checks if the left operand exists.
+	 *
+	 * @return bool True if the left operand exists, false otherwise.
+	 */
+	bool HasOp0() const { return Operand[0] != nullptr; }
+
+	/**
+	 * @brief Checks if the right operand exists.
+	 *
+	 * @return bool True if the right operand exists, false otherwise.
+	 */
+	bool HasOp1() const { return Operand[1] != nullptr; }
+
+	/**
+	 * @brief Gets the type of the left operand's token.
+	 *
+	 * @return Token::Type The type of the left operand's token.
+	 */
+	Token::Type Ty0() const { return Operand[0]->V.Ty; }
+
+	/**
+	 * @brief Gets the type of the right operand's token.
+	 *
+	 * @return Token::Type The type of the right operand's token.
+	 */
+	Token::Type Ty1() const { return Operand[1]->V.Ty; }
+
+	/**
+	 * @brief Gets the ID of the left operand's token.
+	 *
+	 * @return int& The ID of the left operand's token.
+	 */
+	int& ID0() const { return Operand[0]->V.ID; }
+
+	/**
+	 * @brief Gets the ID of the right operand's token.
+	 *
+	 * @return int& The ID of the right operand's token.
+	 */
+	int& ID1() const { return Operand[1]->V.ID; }
+
+	/**
+	 * @brief Gets the left operand's token.
+	 *
+	 * @return Token: The left operand's token.
+	 */
+	Token V0() const { return Operand[0]->V; }
+
+	/**
+	 * @brief Gets the right operand's token.
+	 *
+	 * @return Token: The right operand's token.
+	 */
+	Token V1() const { return Operand[1]->V; }
+
+	/**
+	* @brief Gets the left operand node.
+	*
+	* @return ExprNode*& The left operand node.
+	*/
+	ExprNode*& L() { return Operand[0]; }
+
+	/**
+	 * @brief Gets the right operand node.
+	 *
+	 * @return ExprNode*& The right operand node.
+	 */
+	ExprNode*& R() { return Operand[1]; }
+
+	/**
+	 * @brief Gets the left operand node (const version).
+	 *
+	 * @return const ExprNode* The left operand node.
+	 */
+	const ExprNode* L() const { return Operand[0]; }
+
+	/**
+	 * @brief Gets the right operand node (const version).
+	 *
+	 * @return const ExprNode* The right operand node.
+	 */
+	const ExprNode* R() const { return Operand[1]; }
+
+	/**
+	 * @brief Copy data from another node.
+	 */
+	void Copy(const ExprNode* r)
+	{
+		V = r->V;
+		Operand[0] = r->Operand[0];
+		Operand[1] = r->Operand[1];
+		HashStamp = 0;
+		DepMask = r->DepMask;
+	}
+};
+
+/**
+ * @brief A chunked slab allocator that owns the memory of every expression node.
+ *
+ * Nodes are handed out in order from contiguous slabs, so nodes created together
+ * stay close in memory. A round is released as a whole by rewinding the cursor,
+ * the slabs themselves are kept and reused by the next round.
+ */
+struct NodeArena
+{
+	///< The number of nodes stored in one slab.
+	static constexpr size_t SlabSize = 4096;
+
+	///< All slabs allocated so far, in allocation order.
+	std::vector<ExprNode*> Slabs;
+	///< Index of the slab currently handing out nodes.
+	size_t CurSlab{ 0 };
+	///< Number of nodes already handed out from the current slab.
+	size_t Cursor{ 0 };
+
+	///< Number of nodes created and not yet released in this round.
+	size_t Live{ 0 };
+	///< The peak of Live in this round.
+	size_t PeakLive{ 0 };
+	///< Number of slab slots handed out in this round.
+	size_t Used{ 0 };
+	///< Number of nodes kept by the last compaction in this round.
+	size_t Compacted{ 0 };
+	///< Number of bytes reclaimed by compactions in this round.
+	size_t Reclaimed{ 0 };
+
+	/**
+	 * @brief Hands out the next unused slot of the slabs, allocating a new slab if needed.
+	 *
+	 * @return ExprNode* A pointer to the slot. Its content is left from the previous round.
+	 */
+	ExprNode* Allocate()
+	{
+		if (Cursor == SlabSize) { ++CurSlab; Cursor = 0; }
+		if (CurSlab == Slabs.size())Slabs.push_back(new ExprNode[SlabSize]);
+		++Used;
+		return Slabs[CurSlab] + Cursor++;
+	}
+
+	/**
+	 * @brief Releases every node of the round at once by rewinding the cursor.
+	 */
+	void Rewind()
+	{
+		CurSlab = 0;
+		Cursor = 0;
+		Live = PeakLive = Used = Compacted = Reclaimed = 0;
+	}
+
+	~NodeArena() { for (auto& p : Slabs)delete[] p; }
+};
+
+/*
+- Purpose: Owns the memory of all expression nodes in fixed-size slabs.
+- Usage: CreateNode hands out nodes from the arena and RoundGuard rewinds it
+		 when a round ends, so no node is freed individually.
+*/
+NodeArena Nodes;
+/*
+- Purpose: Keeps track of slab slots that are no longer in use and can be
+		   reused to avoid memory reallocation.
+- Usage: When nodes are released or removed from the tree, they are
+		 added to this vector to be reused later, enhancing performance.
+*/
+std::vector<ExprNode*> UnusedNode;
+/*
+- Purpose: Registers the root pointers of all live expressions.
+- Usage: Expr adds &Root when it is constructed and removes it when it is
+		 destroyed. CompactNodes relocates the trees reachable from these
+		 roots and redirects the roots to the copies.
+*/
+std::vector<ExprNode**> LiveRoots;
+
+/**
+ * @brief The key of a hash-consed node: its token and its operands.
+ */
+struct ConsKey
+{
+	Token V;
+	const ExprNode* Op1;
+	const ExprNode* Op2;
+	bool operator==(const ConsKey& R) const { return V == R.V && Op1 == R.Op1 && Op2 == R.Op2; }
+};
+
+/**
+ * @brief Computes a hash value for a ConsKey.
+ */
+struct ConsKeyHash
+{
+	size_t operator()(const ConsKey& K) const
+	{
+		return (size_t)TransformHash(K.V.Hash() + TransformHash((ExprHash)(uintptr_t)K.Op1) + (ExprHash)(uintptr_t)K.Op2);
+	}
+};
+
+/**
+ * @brief A hash-consing table used while a derivative is being built.
+ *
+ * While the table is active, creating a node with a (token, operands) triple that
+ * already exists returns the existing node, so the derivative becomes a DAG whose
+ * structurally identical subtrees are shared, and the derivative rules can refer to
+ * the operands of the original expression instead of duplicating them.
+ * The simplifier rewrites nodes in place, so the DAG is expanded into a plain tree
+ * by Materialize before it is handed over.
+ */
+struct NodeConsTable
+{
+	///< Whether node creation currently goes through the table.
+	bool Active{ false };
+	///< All nodes created since Begin, keyed by their token and operands.
+	std::unordered_map<ConsKey, ExprNode*, ConsKeyHash> Table;
+	///< Number of node creations answered by an existing node.
+	size_t Hits{ 0 };
+
+	/**
+	 * @brief Starts hash-consing node creations.
+	 */
+	void Begin()
+	{
+		Active = true;
+		Hits = 0;
+	}
+
+	/**
+	 * @brief Returns the shared node for a token and its operands, creating it if needed.
+	 * @param T The token of the node.
+	 * @param Op1 Left operand.
+	 * @param Op2 Right operand.
+	 * @return ExprNode* The shared node.
+	 */
+	ExprNode* Get(Token T, ExprNode* Op1, ExprNode* Op2);
+
+	/**
+	 * @brief Stops hash-consing and expands a DAG into a plain tree.
+	 *
+	 * All shared nodes are released afterwards. Nodes that were not created
+	 * by the table (e.g. those of the original expression) are left untouched.
+	 *
+	 * @param pRoot The root of the DAG.
+	 * @return ExprNode* The root of the new tree.
+	 */
+	ExprNode* Materialize(const ExprNode* pRoot);
+
+	/**
+	 * @brief Stops hash-consing and releases all shared nodes.
+	 *
+	 * Trees that are still needed must have been duplicated before.
+	 */
+	void End();
+};
+
+/*
+- Purpose: Shares structurally identical nodes while a derivative is being built.
+- Usage: Activated by Expr(const Expr&, int) around ExprNode::Partial, CreateNode
+		 with a token goes through it while it is active.
+*/
+NodeConsTable ConsTable;
+
+/**
+ * @brief A derivative in PartialMemo together with the subtree it belongs to.
+ */
+struct MemoizedPartial
+{
+	///< The differentiated subtree, compared with Equal before the entry is reused.
+	const ExprNode* Source;
+	///< Its derivative.
+	ExprNode* D;
+};
+
+/*
+- Purpose: Holds the derivatives of the subtrees of the trees being differentiated,
+		   keyed by PartialKey, i.e. by structure and variable.
+- Usage: ExprNode::Partial walks a tree in post-order and stores the derivative
+		 of every distinct subtree here, so DF and DG in the derivative rules look
+		 the derivatives of the operands up instead of recursing, and repeated
+		 subtrees (f in f*f/f) share a single derivative node. The derivatives
+		 are nodes of ConsTable, so the memo lives until ConsTable.End() and is
+		 shared by all trees differentiated in between (the rows of a Jacobian).
+*/
+FlatHashMap<MemoizedPartial> PartialMemo;
+
+/*
+- Purpose: Tells whether the hash cached in a node is still valid.
+- Usage: ExprNode::Hash() caches its result stamped with the current epoch.
+		 Simplify passes rewrite nodes in place without knowing their
+		 ancestors, so instead of invalidating along the path they start
+		 a new epoch (InvalidateHashes) before hashing a tree they changed.
+*/
+unsigned HashEpoch{ 1 };
+///< Number of ExprNode::Hash() calls answered from the cache.
+size_t HashCacheHits{ 0 };
+///< Number of ExprNode::Hash() calls that had to compute the value.
+size_t HashComputed{ 0 };
+
+/**
+ * @brief Invalidates the hash cached in every node.
+ */
+void InvalidateHashes() { ++HashEpoch; }
+
+/**
+ * @brief Invalidates the hash cached in the nodes of a subtree only.
+ *
+ * The hashes of the nodes above it stay cached and are stale, so this is for
+ * walks that do not hash those nodes again before the next InvalidateHashes().
+ *
+ * @param pRoot Root node of the subtree
+ */
+void InvalidateHashes(const ExprNode* pRoot);
+
+/**
+ * @brief A link of the token sequence used only while parsing.
+ *
+ * The parser keeps the tokens in a doubly linked list and collapses ranges of it
+ * into subtrees. The links live outside ExprNode and are thrown away once the
+ * expression tree is built.
+ */
+struct ParseNode
+{
+	///< The node holding the token or the subtree built so far.
+	ExprNode* Node{};
+	///< Pointer to the previous link of the token sequence.
+	ParseNode* Prev{};
+	///< Pointer to the next link of the token sequence.
+	ParseNode* Next{};
+
+	/**
+	 * @brief Prints the nodes of the sequence from this link up to End for debugging purposes.
+	 *
+	 * @param End The link to stop at (exclusive).
+	 */
+	void DebugPrintTraverse(const ParseNode* End) const;
+};
+
+/*
+- Purpose: Stores the links of the token sequence during parsing.
+- Usage: Every token and every collapsed subtree gets a link here while
+		 Expr::Expr runs. A deque keeps the links in place as it grows,
+		 and it is cleared as soon as the tree is built.
+*/
+std::deque<ParseNode> ParseLinks;
+
+/**
+ * @brief Creates a new unlinked parse link for a node.
+ *
+ * @param pNode The node held by the link.
+ * @return ParseNode* A pointer to the new link.
+ */
+ParseNode* CreateLink(ExprNode* pNode)
+{
+	ParseLinks.push_back(ParseNode{ pNode });
+	return &ParseLinks.back();
+}
+
+/**
+ * @brief A structure used to track bracket positions during expression parsing.
+ */
+struct BracketPtr
+{
+	ParseNode* Left;///< Pointer to the left bracket link.
+	ParseNode* Comma;///< Pointer to the comma link within the brackets.
+};
+
+/*
+- Purpose: Tracks the positions of brackets during the parsing process
+		   to handle nested expressions correctly.
+- Usage: As the parser encounters brackets, it records their positions
+		 in this vector to manage the scope and priority of operations
+		 within brackets.
+*/
+std::vector <BracketPtr> Brackets;
+
+/*
+- Purpose: Used during the creation of subtrees to hold
+		   intermediate expression nodes.
+- Usage: When constructing complex expressions, this vector helps
+		 manage the nodes that form parts of the larger expression tree.
+*/
+std::vector <ExprNode*> ExprV;
+
+/*
+- Purpose: Stores operator nodes during the parsing and tree construction process.
+- Usage: Helps in managing the order and precedence of operators
+		 when building the expression tree from the token sequence.
+*/
+std::vector <ExprNode*> OprV;
+
+/*
+- Purpose: Keeps track of extracted hash values during the simplification
+		   process to prevent reprocessing.
+- Usage: During various simplification steps, it stores hashes of
+		 processed nodes to ensure each node is simplified only once.
+*/
+std::set<ExprHash> Extracted;
+
+/*
+- Purpose: Hold the shapes (ExprNode::Shape) of subtrees that are fixed points
+		   of Simplify_MonomialImpl and Simplify_Polynomial respectively.
+- Usage: Filled and consulted by RewriteUnlessSettled, cleared for every input line.
+*/
+FlatHashMap<bool> SettledMonomial, SettledPolynomial;
+
+/*
+A flag indicating whether the parsing process has failed.
+- Purpose: To signal errors during the parsing of the mathematical expression.
+- Usage: Checked after parsing to determine if the expression was valid.
+*/
+bool FailedToParse;
+
+/*
+A flag indicating whether there is a DividedbyZero occurred
+- Purpose: To signal errors during the calculating of the mathematical expression.
+- Usage: Checked after calculating to determine if the expression was valid.
+*/
+bool DividedbyZero;
+
+/**
+ * @brief The modes selected on the command line.
+ */
+struct Options
+{
+	///< Compute all partials in one reverse-mode sweep (--reverse).
+	bool Reverse{ false };
+	///< Highest order of the mixed partials to print (--order k).
+	int Order{ 1 };
+	///< Highest order of the directional derivatives at a point (--taylor k).
+	int Taylor{ 0 };
+	///< The variables to differentiate against, all if empty (--wrt x,y).
+	std::vector<std::string> Wrt;
+	///< Print which first partials may be nonzero instead of them (--sparsity).
+	bool Sparsity{ false };
+	///< Simplify by equality saturation instead of the pass pipeline (--egraph).
+	bool EGraph{ false };
+};
+
+/*
+- Purpose: Holds the modes selected on the command line.
+- Usage: Filled once by ParseOptions before the first round and read by main.
+*/
+Options Opt;
+
+/**
+ * @brief Releases a node from the expression tree, marking it as unused.
+ *
+ * @param pNode The node to be released.
+ */
+void ReleaseNode(const ExprNode*);
+
+/**
+ * @brief Simplifies the expression tree rooted at the given node.
+ *
+ * @param pNode The root node of the subtree to be simplified.
+ */
+void Simplify(ExprNode*& pNode);
+///< Nesting depth of Simplify calls, 1 inside a top-level call.
+int SimplifyDepth{ 0 };
+
+/**
+ * @brief Simplifies the expression tree by equality saturation on an e-graph.
+ *
+ * @param pNode[in,out] The root node, replaced by the cheapest equal tree found.
+ */
+void Simplify_EGraph(ExprNode*& pNode);
+
+/**
+ * @brief Creates a new node for the expression tree.
+ *
+ * @return ExprNode* A pointer to the newly created node.
+ */
+ExprNode* CreateNode();
+ExprNode* CreateNode(Token T);
+ExprNode* CreateNode(Token T, ExprNode* Op1, ExprNode* Op2);
+
+/**
+ * @brief Releases the memory allocated for an expression tree.
+ *
+ * @param pRoot The root node of the expression tree to be released.
+ */
+void ReleaseTree(const ExprNode* pRoot);
+
+/**
+ * @brief Generates tokens from a mathematical expression string.
+ *
+ * @param Str The input string representing the mathematical expression.
+ * @param Toks A reference to a vector where the generated tokens will be stored.
+ */
+void GenerateTokens(const std::string& Str, std::vector<Token>& Toks);
+
+/*
+- Purpose: Holds the input mathematical expression as a string.
+- Usage: This string is processed and parsed to generate tokens
+		 and build the expression tree.
+*/
+std::string Expression;
+
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+//--------------MULTI TEST CASE RESOURCE CLEANER-------------------
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+
+/**
+ * @brief A guard class to manage resources and reset global states for each parsing round.
+ */
+struct RoundGuard
+{
+	RoundGuard();
+	~RoundGuard();
+};
+
+/**
+* @brief Initializes a new round by resetting global states.
+*
+* Clears variable mappings, extracted hashes, and other relevant data structures
+* to ensure a clean state for the upcoming parsing and processing.
+*/
+RoundGuard::RoundGuard()
+{
+	Symbols.Clear();
+	Extracted.clear();
+	SettledMonomial.Clear();
+	SettledPolynomial.Clear();
+}
+
+/**
+* @brief Cleans up allocated resources and resets global states.
+*
+* Releases all nodes of the round by
+* rewinding the node arena, clears all global containers,
+* and resets counters and flags to their default states.
+*/
+RoundGuard::~RoundGuard()
+{
+	if constexpr (EnableDebugMemory)
+	{
+		printf("Nodes: peak %zu live, %zu slots used, %zu slabs (%zu bytes), %zu bytes reclaimed\n", Nodes.PeakLive, Nodes.Used,
+			Nodes.Slabs.size(), Nodes.Slabs.size() * NodeArena::SlabSize * sizeof(ExprNode), Nodes.Reclaimed);
+	}
+	if constexpr (EnableDebugHash)
+	{
+		printf("Hash: %zu computed, %zu rehashes avoided\n", HashComputed, HashCacheHits);
+	}
+	HashCacheHits = HashComputed = 0;
+	Nodes.Rewind();
+	UnusedNode.clear();
+	Tokens.clear();
+	BigLiterals.Clear();
+	FailedToParse = false;
+	DividedbyZero = false;
+}
+
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+//------------------------EXPRESSION PARSER------------------------
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+
+/**
+ * @brief Enumerates the possible token types when parsing characters in an expression.
+ */
+enum class TokCond {
+	Null,       ///< No valid token type.
+	Operator,   ///< Operator token (e.g., +, -, *, /).
+	Symbol,     ///< Symbol token (e.g., variable names, function names).
+	Number      ///< Number token.
+};
+
+/**
+ * @brief Determines the token type of a given character.
+ *
+ * @param c The character to be judged.
+ * @return TokCond The token type of the character.
+ */
+TokCond Judge(char c)
+{
+	if (isdigit(c))return TokCond::Number;
+	else if (isalpha(c))return TokCond::Symbol;
+	else if (IsOpr(c))return TokCond::Operator;
+	//Note : ignore invalid characters 
+	else return TokCond::Null;
+}
+/**
+ * @brief Parses a sequence of characters into a token based on the specified type.
+ *
+ * @param Type The type of the token to parse.
+ * @param Begin The start of the character sequence.
+ * @param Idx The end of the character sequence.
+ * @param Toks The vector to which the parsed token will be added.
+ */
+void ParseToken(TokCond Type, const char* Begin, const char* Idx, std::vector<Token>& Toks)
 {
 	switch (Type)
 	{
-		// Nothing to do for null type
-	case TokCond::Null: break;
-		// Create operator token from single character
-	case TokCond::Operator: Toks.emplace_back(*Begin); break;
-		// Convert numeric string to integer token
-	case TokCond::Number: Toks.emplace_back(StrToIntEx(Begin, Idx)); break;
-		// Handle symbols which could be variables or functions
-	case TokCond::Symbol:
+		// Nothing to do for null type
+	case TokCond::Null: break;
+		// Create operator token from single character
+	case TokCond::Operator: Toks.emplace_back(*Begin); break;
+		// Convert numeric string to integer token
+	case TokCond::Number:
+	{
+		// Literals too large for an int are kept exactly in BigLiterals
+		int Value;
+		if (StrToIntEx(Begin, Idx, Value))Toks.emplace_back(Value);
+		else Toks.emplace_back(BigLiterals.Intern(BigInt(Begin, Idx)), AsBigID{});
+	}break;
+		// Handle symbols which could be variables or functions
+	case TokCond::Symbol:
+	{
+		// Check if it's a known function
+		int ID = GetFuncID(Begin, Idx - Begin);
+		// If not a function, create variable token
+		if (ID == -1)Toks.emplace_back(Symbols.Intern(Begin, Idx - Begin), AsVarID{});
+		// If it is a function, create function token
+		else Toks.emplace_back(ID, AsFuncID{});
+	}break;
+	};
+}
+
+/**
+ * @brief Generates tokens from a mathematical expression string.
+ *
+ * @param Str The input string representing the mathematical expression.
+ * @param Toks A reference to a vector where the generated tokens will be stored.
+ */
+void GenerateTokens(const std::string& Str, std::vector<Token>& Toks)
+{
+	auto Begin = Str.begin(), Idx = Str.begin();
+	TokCond LastType{ TokCond::Null }, CurType;
+	for (; Idx != Str.end(); ++Idx)
+	{
+		// Determine current character type
+		CurType = Judge(*Idx);
+		if (LastType == CurType)
+		{
+			// Handle consecutive characters of same type
+			if (CurType == TokCond::Operator)
+			{
+				// Operators are single-character, so add immediately
+				Toks.emplace_back(*Begin);
+				Begin = Idx;
+			}
+			continue;
+		}
+		// Parse previous token segment
+		ParseToken(LastType, Begin.operator->(), Idx.operator->(), Toks);
+
+		// Update for next iteration
+		Begin = Idx;
+		LastType = CurType;
+	}
+	// Parse the last token segment
+	ParseToken(LastType, Begin.operator->(), Idx.operator->(), Toks);
+}
+
+//ADD COMMENTS FROM HERE !!!
+
+// Token constructor implementations
+
+/**
+ * @brief Constructs a Token from an integer value.
+ * @param V The integer value to store in the token.
+ */
+Token::Token(int V) : Ty(Token::Type::Int), ID(V) {}
+
+/**
+ * @brief Constructs a Token from an operator character.
+ * @param Opr The operator character (e.g., '+', '-', '*', etc.).
+ */
+Token::Token(char Opr) : Ty(Token::Type::Operator), ID(Opr) {}
+
+/**
+ * @brief Constructs a Token representing a function with a given ID.
+ * @param FuncID The ID of the function as defined in Funcs array.
+ * @param (Unused) A tag to differentiate this constructor from others.
+ */
+Token::Token(int FuncID, AsFuncID) : Ty(Token::Type::Function), ID(FuncID) {}
+
+/**
+ * @brief Constructs a Token representing a variable.
+ * @param VarID The ID of the variable as assigned by Symbols.
+ * @param (Unused) A tag to differentiate this constructor from others.
+ */
+Token::Token(int VarID, AsVarID) : Ty(Token::Type::Variable), ID(VarID) {}
+
+/**
+ * @brief Constructs a Token representing an integer too large for an int.
+ * @param BigID The ID of the value as assigned by BigLiterals.
+ */
+Token::Token(int BigID, AsBigID) : Ty(Token::Type::Big), ID(BigID) {}
+
+/**
+ * @brief Returns the textual representation of the token based on its type.
+ * @return const char* The string representation (function name, operator char, variable name, or integer value).
+ */
+const char* Token::GetText() const
+{
+	switch (Ty)
+	{
+	case Token::Function: return Funcs[ID].Name;
+		// Lookup function name from Funcs array
+	case Token::Operator:
+	{
+		// Look the operator up in a static table of one-character strings
+		static const auto OprText = [] {
+			struct { char T[128][2]; } Table{};
+			for (int i = 0; i < 128; i++)Table.T[i][0] = (char)i;
+			return Table;
+		}();
+		return OprText.T[ID & 127];
+	}
+	// Get variable name from the symbol table
+	case Token::Variable: return Symbols.Name(ID);
+		// Convert integer ID to string
+	case Token::Int:
+	{
+		// A few rotating static buffers, so the result outlives the next call
+		static char Buf[4][16];
+		static int Next = 0;
+		char* p = Buf[Next++ & 3];
+		snprintf(p, 16, "%d", ID);
+		return p;
+	}
+	// Large integers keep their text in the table
+	case Token::Big: return BigLiterals.Texts[ID].c_str();
+	default: return "";//solve a warning
+	}
+}
+
+/**
+ * @brief Converts a substring to an integer.
+ * @param Begin Start iterator of the substring.
+ * @param End End iterator of the substring.
+ * @param Value[out] The parsed integer value.
+ * @return bool False if the value does not fit in an int.
+ */
+bool StrToIntEx(const char* Begin, const char* End, int& Value)
+{
+	Value = 0;// Only handles non-negative integers
+	while (Begin < End)
+	{
+		int Digit = *Begin - '0';
+		if (Value > (INT_MAX - Digit) / 10)return false;
+		Value = Value * 10 + Digit;
+		++Begin;
+	}
+	return true;
+}
+
+/**
+ * @brief Looks up a function ID by name.
+ * @param Name The function name to search for, not null-terminated.
+ * @param Len The length of the name.
+ * @return int The function ID if found, -1 otherwise.
+ */
+int GetFuncID(const char* Name, size_t Len)
+{
+	for (int i = 0; i < NFuncs; i++)
+	{
+		if (!strncmp(Funcs[i].Name, Name, Len) && Funcs[i].Name[Len] == '\0')
+			return i;
+	}
+	return -1;
+}
+
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+//------------------EXPRESSION TREE CONSTRUCTION-------------------
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+
+/**
+ * @brief Determines if operator merging should occur based on precedence.
+ * @param Back The previous operator node.
+ * @param CurLevel The precedence level of the current operator.
+ * @return bool True if merging should trigger.
+ */
+bool TriggerMerge(const ExprNode* Back, int CurLevel)
+{
+	// Handle right-associative operators like '-' and '/'
+	if (Back->V.Ty == Token::Operator && (Back->V.ID == '-' || Back->V.ID == '/'))
+		return Back->OprLevel(false) >= CurLevel;
+	else return Back->OprLevel(false) > CurLevel;
+}
+
+/**
+ * @brief Merges operator nodes in the operator stack based on precedence.
+ * @param CurLevel The precedence level of the current operator.
+ * @return bool False if syntax error occurs (e.g., missing operands).
+ */
+bool MergeTop(int CurLevel)
+{
+	while (!OprV.empty() && TriggerMerge(OprV.back(), CurLevel))
+	{
+		if (ExprV.size() < 2) { puts("Syntax Error: missing operand."); FailedToParse = true; return false; }
+		
+		// Build tree: attach operands to operator
+		OprV.back()->R() = ExprV.back();
+		OprV.back()->L() = ExprV[ExprV.size() - 2];
+		ExprV[ExprV.size() - 2] = OprV.back();
+		OprV.pop_back();
+		ExprV.pop_back();
+	}
+	return true;
+}
+
+/**
+ * @brief Constructs an expression tree from a token sequence.
+ * @param Begin Start link of the token sequence.
+ * @param End End link of the token sequence (exclusive).
+ * @return ParseNode* Link holding the root of the constructed subtree.
+ */
+ParseNode* CreateTree(ParseNode* Begin, ParseNode* End)// PARSE TO: [Begin,End)
+{
+	extern Token MUL;
+	if constexpr (EnableDebugData) { printf("\nEnd: "); End->Node->DebugPrint(); printf("\nToCreate: "); Begin->DebugPrintTraverse(End); }
+	//Note: Prev always exists
+	if (Begin == End) return CreateLink(CreateNode());
+
+	// Handle unary minus: prepend a zero (e.g., "-x" -> "0 - x")
+	else if (Begin->Node->OprLevel(false) && Begin->Node->V.IsSUB())
+	{
+		auto V = CreateLink(CreateNode(Token((int)0)));
+		V->Next = Begin;
+		V->Prev = Begin->Prev;
+		Begin->Prev->Next = V;
+		Begin->Prev = V;
+		Begin = V;
+	}
+
+	OprV.clear();
+	ExprV.clear();
+	int Level;
+	bool LastHasLevel = true;
+	auto UP = Begin->Prev;
+
+	// Process each node in the token sequence
+	for (auto pLink = Begin; pLink != End; pLink = pLink->Next)
+	{
+		auto pNode = pLink->Node;
+		// Skip brackets/comma
+		if (pNode->V.IsIgnoredSymbol())continue;
+		Level = pNode->OprLevel(false);
+
+		// Operand (number/variable)
+		if (!Level)
+		{
+			// Implicit multiplication (e.g., "2x")
+			if (!LastHasLevel)
+			{
+				if (!MergeTop(2))return CreateLink(CreateNode());
+				OprV.push_back(CreateNode(MUL));
+			}
+			ExprV.push_back(pNode);
+		}
+		// Operator or function
+		else
+		{
+			if (!MergeTop(Level))return CreateLink(CreateNode());
+			OprV.push_back(pNode);
+		}
+		LastHasLevel = Level != 0;
+		if constexpr (EnableDebugData) { printf("\nPush: "); pNode->DebugPrint(); }
+	}
+	// Merge remaining operators
+	while (!OprV.empty())if (!MergeTop(0))return CreateLink(CreateNode());
+
+	// Link the final tree in place of [Begin,End)
+	auto pTree = CreateLink(ExprV[0]);
+	pTree->Next = End;
+	pTree->Prev = UP;
+	End->Prev = pTree;
+	UP->Next = pTree;
+
+	if constexpr (EnableDebugData) { printf("\nCreate: "); ExprV[0]->DebugPrint(); }
+
+	return pTree;
+}
+
+/**
+ * @brief Validates function argument counts in the expression tree.
+ * @param E Root node of the subtree to check.
+ * @return bool True if all functions have correct parameter counts.
+ */
+bool CheckArgument(const ExprNode* E)
+{
+	bool OK = true;
+	WalkStack<const ExprNode*> S;
+	if (E)S.Push(E);
+	while (!S.Empty())
+	{
+		E = S.Pop();
+		if (E->V.Ty == Token::Function)
+		{
+			int NArg = !!(E->L()) + !!(E->R());
+			if (NArg != Funcs[E->V.ID].NParam)
+			{
+				printf("Syntax Error: Function %s expected %d Arguments, Found %d Arguments\n", Funcs[E->V.ID].Name, Funcs[E->V.ID].NParam, NArg);
+				OK = false;
+			}
+		}
+		// Check children, left subtree first
+		else
+		{
+			if (E->R())S.Push(E->R());
+			if (E->L())S.Push(E->L());
+		}
+	}
+	return OK;
+}
+
+/**
+ * @brief Destructor for Expr. Releases the entire expression tree.
+ */
+Expr::~Expr()
+{
+	ReleaseTree(Root);
+	LiveRoots.erase(std::find(LiveRoots.begin(), LiveRoots.end(), &Root));
+}
+
+
+Expr::Expr(const std::vector<Token>& Toks, bool Simplified)
+{
+	LiveRoots.push_back(&Root);
+	DividedbyZero = false;
+	ParseNode* pNew;
+	ExprNode Head{}, Tail{};
+	ParseNode M{ &Head }, N{ &Tail };
+	ParseNode* pCur = &M;
+	Brackets.clear();
+	ParseLinks.clear();
+
+	// Build linked list of tokens
+	for (auto& T : Toks)
+	{
+		pNew = CreateLink(CreateNode(T));
+		pCur->Next = pNew;
+		pNew->Prev = pCur;
+		pCur = pNew;
+		if constexpr (EnableDebugData) { putchar('\n'); printf("New: "); M.Next->DebugPrintTraverse(nullptr); }
+
+		// Handle brackets and commas for function arguments
+		if (T.IsLBK())
+		{
+			Brackets.emplace_back();
+			Brackets.back().Left = pCur;
+			Brackets.back().Comma = nullptr;
+			if constexpr (EnableDebugData) { puts("Push:"); pCur->Node->DebugPrint(); }
+		}
+		else if (T.IsCOM())
+		{
+			if (!Brackets.empty())
+			{
+				if (Brackets.back().Comma) { puts("Syntax Error: Too many arguments."); FailedToParse = true; return; }
+				else Brackets.back().Comma = pCur;
+			}
+			else { puts("Syntax Error: \",\"is not in a \"()\"."); FailedToParse = true; return; }
+		}
+		else if (T.IsRBK())
+		{
+			if (Brackets.empty()) { puts("Syntax Error: \")\"is lonely."); FailedToParse = true; return; }
+			if (Brackets.back().Comma)
+			{
+				auto pTok = Brackets.back().Left->Prev;
+				auto pCom = Brackets.back().Comma;
+				//putchar('\n'); M.Next->DebugPrintTraverse(nullptr);
+				//putchar('\n'); M.Next->DebugPrintTraverse(Brackets.back().Left);
+				auto T1 = CreateTree(Brackets.back().Left->Next, pCom);
+				auto T2 = CreateTree(pCom->Next, pCur);
+				if (FailedToParse)return;
+				//pTok-> ( ->T1->Comma->T2->pCur
+				if (pTok->Node->V.Ty == Token::Function)
+				{
+					ReleaseNode(pCur->Node);//)
+					pTok->Node->L() = T1->Node;
+					pTok->Node->R() = T2->Node;
+					pCur = pTok;
+				}
+				else { puts("Syntax Error: \",\" is only for functions."); FailedToParse = true; return; }
+			}
+			// Single argument in brackets
+			else
+			{
+				auto pTok = Brackets.back().Left->Prev;
+				auto T1 = CreateTree(Brackets.back().Left->Next, pCur);
+				Brackets.back().Left->Next = T1;
+				T1->Next = pCur;
+				if (FailedToParse)return;
+				if constexpr (EnableDebugData) { putchar('\n'); M.Next->DebugPrintTraverse(nullptr); }
+				//L->T->pCur
+				//ReleaseNode(pCur);//)
+				if (pTok->Node->V.Ty == Token::Function)
+				{
+					pTok->Node->L() = T1->Node;
+					pCur = pTok;
+					pCur->Next = nullptr;
+					//if (EnableDebugData) { putchar('\n'); M.Next->DebugPrintTraverse(nullptr); }
+				}
+				else
+				{
+					pTok->Next = T1;
+					T1->Prev = pTok;
+					pCur = T1;
+				}
+			}
+			Brackets.pop_back();
+		}
+	}
+	if (!Brackets.empty()) { puts("Syntax Error: expected \")\"for a lonely \"(\" qwq. "); FailedToParse = true; return; }
+	
+	// Finalize tree construction
+	pCur->Next = &N;
+	N.Prev = pCur;
+	if constexpr (EnableDebugData) puts("Make End!");
+	Root = CreateTree(M.Next, &N)->Node;
+	ParseLinks.clear();
+
+	// Check Arguments
+	if (!CheckArgument(Root)) { FailedToParse = true; return; }
+
+	// Apply simplification rules
+	if (Simplified)::Simplify(Root);
+}
+
+/**
+ * @brief Prints the expression tree.
+ */
+void Expr::Print() const
+{
+	if (!DividedbyZero)
+	{
+		if (Root)Root->PrintTree();
+		else printf("NULL");
+		putchar('\n');
+	}
+}
+
+/**
+ * @brief Constructs an Expr by differentiating another Expr.
+ * @param F The original expression to differentiate.
+ * @param DX The variable ID to differentiate with respect to.
+ */
+Expr::Expr(const Expr& F, int DX)
+{
+	LiveRoots.push_back(&Root);
+	DividedbyZero = false;
+	// Build the derivative as a DAG of shared nodes, then expand it into
+	// a tree since Simplify rewrites nodes in place
+	ConsTable.Begin();
+	Root = ConsTable.Materialize(F.Root->Partial(DX));
+	::Simplify(Root);
+}
+
+/**
+ * @brief Constructs an Expr that owns a given tree.
+ */
+Expr::Expr(ExprNode* pTree)
+{
+	LiveRoots.push_back(&Root);
+	Root = pTree;
+}
+
+/**
+ * @brief Computes the gradient of an Expr by reverse-mode differentiation.
+ */
+void Expr::Gradient(const Expr& F, const std::vector<int>& IDs, std::deque<Expr>& Out)
+{
+	std::vector<ExprNode*> Grad(Symbols.Size(), nullptr);
+	// The adjoints form one DAG shared by all partials, each partial
+	// is expanded into its own tree since Simplify rewrites in place
+	ConsTable.Begin();
+	F.Root->Gradient(Grad);
+	ConsTable.Active = false;
+	for (int ID : IDs)
+		Out.emplace_back(Grad[ID] ? Grad[ID]->Duplicate() : CreateNode(Token(0)));
+	ConsTable.End();
+}
+
+/**
+ * @brief Simplifies the expression.
+ */
+void Expr::Simplify()
+{
+	DividedbyZero = false;
+	::Simplify(Root);
+}
+
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+//-----------------------NODE MEMORY MANAGER-----------------------
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+
+/**
+ * @brief Releases a node from the expression tree, marking it as unused.
+ *
+ * @param pNode The node to be released.
+ */
+void ReleaseNode(const ExprNode* pNode)
+{
+	if constexpr (EnableDebugData) { printf("\nReleaseNode:"); if (pNode)pNode->DebugPrint(); else printf("NULL"); }
+	if (pNode)
+	{
+		UnusedNode.push_back((ExprNode*)pNode);
+		--Nodes.Live;
+	}
+}
+
+/**
+ * @brief Resets a node's state for reuse.
+ * @param pNode The node to clear.
+ * @return ExprNode* The cleared node.
+ */
+ExprNode* ClearNode(ExprNode* pNode)
+{
+	pNode->L() = nullptr;
+	pNode->R() = nullptr;
+	pNode->V = Token();
+	pNode->HashStamp = 0;
+	pNode->DepMask = 0;
+	return pNode;
+}
+
+
+/**
+ * @brief Creates a new node for the expression tree.
+ *
+ * Released slots are reused first, otherwise the next slot of the node arena is taken.
+ *
+ * @return ExprNode* A pointer to the newly created node.
+ */
+ExprNode* CreateNode()
+{
+	ExprNode* P;
+	if (UnusedNode.empty())P = Nodes.Allocate();
+	else { P = UnusedNode.back(); UnusedNode.pop_back(); }
+	Nodes.PeakLive = std::max(Nodes.PeakLive, ++Nodes.Live);
+	return ClearNode(P);
+}
+
+/**
+ * @brief Creates a node initialized with a token.
+ * @param T The token to store in the node.
+ * @return ExprNode* The created node.
+ */
+ExprNode* CreateNode(Token T)
+{
+	if (ConsTable.Active)return ConsTable.Get(T, nullptr, nullptr);
+	auto N = CreateNode();
+	N->V = T;
+	N->UpdateDeps();
+	return N;
+}
+
+/**
+ * @brief Creates a node with operands.
+ * @param T The token for the node.
+ * @param Op1 Left operand.
+ * @param Op2 Right operand.
+ * @return ExprNode* The created node.
+ */
+ExprNode* CreateNode(Token T, ExprNode* Op1, ExprNode* Op2)
+{
+	if (ConsTable.Active)return ConsTable.Get(T, Op1, Op2);
+	auto N = CreateNode();
+	N->V = T;
+	N->L() = Op1;
+	N->R() = Op2;
+	N->UpdateDeps();
+	return N;
+}
+
+ExprNode* NodeConsTable::Get(Token T, ExprNode* Op1, ExprNode* Op2)
+{
+	auto& N = Table[ConsKey{ T, Op1, Op2 }];
+	if (N) { ++Hits; return N; }
+	N = CreateNode();
+	N->V = T;
+	N->L() = Op1;
+	N->R() = Op2;
+	N->UpdateDeps();
+	return N;
+}
+
+ExprNode* NodeConsTable::Materialize(const ExprNode* pRoot)
+{
+	Active = false;
+	auto pTree = pRoot->Duplicate();
+	End();
+	return pTree;
+}
+
+void NodeConsTable::End()
+{
+	Active = false;
+	if constexpr (EnableDebugMemory) { printf("ConsTable: %zu shared nodes, %zu hits\n", Table.size(), Hits); }
+	for (auto& [K, N] : Table)ReleaseNode(N);
+	Table.clear();
+	PartialMemo.Clear();
+}
+
+/**
+ * @brief Releases an entire subtree.
+ * @param pRoot Root of the subtree to release.
+ */
+void ReleaseTree(const ExprNode* pRoot)
+{
+	if (!pRoot)return;
+	WalkStack<const ExprNode*> S;
+	S.Push(pRoot);
+	while (!S.Empty())
+	{
+		auto p = S.Pop();
+		if (p->R())S.Push(p->R());
+		if (p->L())S.Push(p->L());
+		ReleaseNode(p);
+	}
+}
+
+/**
+ * @brief Copies a tree into the slabs in post-order, children before parents.
+ * @param pRoot Root of the tree to copy.
+ * @return ExprNode* Root of the copy.
+ */
+ExprNode* CopyPostOrder(const ExprNode* pRoot)
+{
+	WalkStack<std::pair<const ExprNode*, bool>> S;
+	WalkStack<ExprNode*> Copies;
+	S.Push({ pRoot, false });
+	while (!S.Empty())
+	{
+		auto& [pNode, Expanded] = S.Top();
+		auto p = pNode;
+		if (!Expanded)
+		{
+			Expanded = true;
+			if (p->R())S.Push({ p->R(), false });
+			if (p->L())S.Push({ p->L(), false });
+			continue;
+		}
+		S.Pop();
+		// Token, operands and the cached hash, which stays valid
+		auto C = Nodes.Allocate();
+		*C = *p;
+		if (p->R())C->R() = Copies.Pop();
+		if (p->L())C->L() = Copies.Pop();
+		Copies.Push(C);
+	}
+	return Copies.Pop();
+}
+
+/**
+ * @brief Relocates all live trees into dense post-order storage and reclaims everything else.
+ *
+ * The trees reachable from LiveRoots are copied into the free slabs and the roots are
+ * redirected to the copies. Every other slot becomes free, including nodes that rewrites
+ * dropped without releasing them. Any other pointer into the trees is left dangling, so
+ * this may only run where the registered roots are the only references.
+ *
+ * @return size_t The number of bytes reclaimed.
+ */
+size_t CompactNodes()
+{
+	if (Nodes.Slabs.empty())return 0;
+	size_t Before = Nodes.Used;
+	// Copy into the slabs above the current one, the ones in use are read meanwhile
+	std::vector<ExprNode*> From(Nodes.Slabs.begin(), Nodes.Slabs.begin() + Nodes.CurSlab + 1);
+	Nodes.Slabs.erase(Nodes.Slabs.begin(), Nodes.Slabs.begin() + Nodes.CurSlab + 1);
+	Nodes.CurSlab = Nodes.Cursor = Nodes.Used = 0;
+	for (auto ppRoot : LiveRoots)
+		if (*ppRoot)*ppRoot = CopyPostOrder(*ppRoot);
+	// The old slabs are free now and are reused after the copies
+	Nodes.Slabs.insert(Nodes.Slabs.end(), From.begin(), From.end());
+	UnusedNode.clear();
+	Nodes.Live = Nodes.Compacted = Nodes.Used;
+	size_t Bytes = (Before - Nodes.Used) * sizeof(ExprNode);
+	Nodes.Reclaimed += Bytes;
+	if constexpr (EnableDebugMemory) { printf("Compact: %zu nodes kept, %zu bytes reclaimed\n", Nodes.Used, Bytes); }
+	return Bytes;
+}
+
+/**
+ * @brief Compacts the nodes once the slots handed out since the last compaction
+ *        outnumber the nodes it kept, so the copying cost stays proportional to the garbage.
+ */
+void CompactNodesIfSparse()
+{
+	if (Nodes.Used >= 2 * Nodes.Compacted + NodeArena::SlabSize)CompactNodes();
+}
+
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+//---------------------TREE GENERATION HELPERS---------------------
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+
+bool Token::IsPOW() const { return (Ty == Operator && ID == '^') || (Ty == Function && ID == FUNC_pow); }
+
+/**
+ * @brief Helper structure for function token generation and tree construction.
+ * @tparam T The token type to handle (functions/operators)
+ */
+struct NodeCalcHelper
+{
+	Token T;
+	const ExprNode* Op1;
+};
+NodeCalcHelper operator<(const ExprNode* Op1, Token R)
+{
+	return NodeCalcHelper{ R, Op1 };
+}
+ExprNode* operator>(const NodeCalcHelper& L, ExprNode* Op2)
+{
+	return CreateNode(L.T, (ExprNode*)L.Op1, Op2);
+}
+struct FuncTokenHelper
+{
+	Token T;///< Stores the function/operator token
+
+	/**
+	 * @brief Returns the stored token
+	 * @return const Token& Reference to the stored token
+	 */
+	const Token& operator()()const { return T; }
+
+	/**
+	 * @brief Creates a function node with single operand
+	 * @param Op1 The operand node
+	 * @return ExprNode* New function node
+	 */
+	ExprNode* operator()(const ExprNode* Op1)
+	{
+		return CreateNode(T, (ExprNode*)Op1, nullptr);
+	}
+
+	/**
+	* @brief Creates a function node with two operands
+	* @param Op1 First operand node
+	* @param Op2 Second operand node
+	* @return ExprNode* New function node
+	*/
+	ExprNode* operator()(const ExprNode* Op1, const ExprNode* Op2)
+	{
+		return CreateNode(T, (ExprNode*)Op1, (ExprNode*)Op2);
+	}
+};
+
+// Global operator token definitions
+// -purpose: Represents addition operator
+Token ADD{ '+' };  
+// -purpose: Represents subtraction operator
+Token SUB{ '-' };  
+// -purpose: Represents multiplication operator
+Token MUL{ '*' };  
+// -purpose: Represents division operator
+Token DIV{ '/' };  
+// -purpose: Represents power operator
+Token POW{ '^' };  
+
+
+// Macro helpers for operator token construction
+// Helper for addition operator token
+#define Add <ADD>  
+// Helper for subtraction operator token
+#define Sub <SUB>  
+// Helper for multiplication operator token
+#define Mul <MUL>  
+ // Helper for division operator token
+#define Div <DIV> 
+// Helper for power operator token
+#define Pwr <POW>  
+
+// Function token helpers initialization
+FuncTokenHelper Ln{ Token{FUNC_ln, AsFuncID{}} };
+FuncTokenHelper Log{ Token{FUNC_log, AsFuncID{}} };
+FuncTokenHelper Sin{ Token{FUNC_sin, AsFuncID{}} };
+FuncTokenHelper Cos{ Token{FUNC_cos, AsFuncID{}} };
+FuncTokenHelper Tan{ Token{FUNC_tan, AsFuncID{}} };
+FuncTokenHelper Pow{ Token{FUNC_pow, AsFuncID{}} };
+FuncTokenHelper Exp{ Token{FUNC_exp, AsFuncID{}} };
+FuncTokenHelper Sinh{ Token{FUNC_sinh, AsFuncID{}} };
+FuncTokenHelper Cosh{ Token{FUNC_cosh, AsFuncID{}} };
+
+// Constant node creation macro
+// -purpose: Shortcut for creating integer constant nodes
+#define Const(x) CreateNode(Token(int(x)))
+
+/**
+ * @brief Creates an integer node, a Token::Big if the value does not fit in an int
+ * @param V The value
+ * @return ExprNode* The new leaf
+ */
+ExprNode* IntNode(long long V)
+{
+	if (V >= -INT_MAX && V <= INT_MAX)return Const(V);
+	return CreateNode(Token(BigLiterals.Intern(BigInt(V)), AsBigID{}));
+}
+
+/**
+ * @brief Creates an integer node from an arbitrary-precision value
+ * @param V The value
+ * @return ExprNode* The new leaf
+ */
+ExprNode* IntNode(const BigInt& V)
+{
+	long long S;
+	if (V.ToLL(S))return IntNode(S);
+	return CreateNode(Token(BigLiterals.Intern(V), AsBigID{}));
+}
+
+/**
+ * @brief Represents a rational number with simplification capabilities
+ *
+ * The value lives in 64 bits while it fits. An operation that would overflow
+ * is redone on BigInt, and the result moves back to 64 bits once it fits
+ * again, so only large values pay for the exact arithmetic.
+ */
+struct Fraction
+{
+	long long N, D;//Numerator, Denominator, D > 0, both unused while Big is set
+	///< The exact value when it does not fit in N and D, shared by copies
+	std::shared_ptr<const std::pair<BigInt, BigInt>> Big;
+
+	/**
+	 * @brief Constructs a fraction with automatic simplification
+	 * @param N Numerator
+	 * @param D Denominator
+	 */
+	Fraction(long long N, long long D) : N(N), D(D) { Simplify(); }
+
+	/**
+	 * @brief Constructs whole number fraction
+	 * @param N Integer value
+	 */
+	Fraction(long long N) : N(N), D(1) {}
+
+	/**
+	 * @brief Constructs zero
+	 */
+	Fraction() : Fraction(0) {}
+
+	/**
+	 * @brief Builds the reduced fraction N/D, in 64 bits if it fits
+	 * @param N Numerator
+	 * @param D Denominator
+	 * @return Fraction The value
+	 */
+	static Fraction FromBig(BigInt N, BigInt D)
+	{
+		if (D.IsZero())return Fraction(1, 0);
+		if (D.Neg)
+		{
+			N = -N;
+			D = -D;
+		}
+		auto G = BigInt::Gcd(N, D);
+		if (!G.IsOne())
+		{
+			N = N / G;
+			D = D / G;
+		}
+		long long SN, SD;
+		if (N.ToLL(SN) && D.ToLL(SD))return Fraction(SN, SD);
+		Fraction F;
+		F.Big = std::make_shared<const std::pair<BigInt, BigInt>>(std::move(N), std::move(D));
+		return F;
+	}
+	BigInt BigN() const { return Big ? Big->first : BigInt(N); }
+	BigInt BigD() const { return Big ? Big->second : BigInt(D); }
+
+	/**
+	 * @brief Simplifies fraction using GCD
+	 */
+	void Simplify()
+	{
+		if (!D)// Handle division by zero
+		{
+			if(!DividedbyZero)puts("Runtime Error: Divided by 0");
+			DividedbyZero = true;
+			return;
+		}
+		if (D < 0)
+		{
+			N = -N;
+			D = -D;
+		}
+		if (!N)D = 1;// Zero case
+		else
+		{
+			auto G = std::gcd(N, D);// C++17 cross-platform GCD
+			N /= G;
+			D /= G;
+		}
+	}
+
+	// Arithmetic operators overloaded for fraction handling, 64 bits first
+	Fraction operator-() const
+	{
+		return Big ? FromBig(-Big->first, Big->second) : Fraction(-N, D);
+	}
+	Fraction operator+(const Fraction& R) const
+	{
+		long long A, B, C;
+		if (!Big && !R.Big && CheckedMul(N, R.D, A) && CheckedMul(R.N, D, B) && CheckedAdd(A, B, A) && CheckedMul(D, R.D, C))
+			return Fraction(A, C);
+		return FromBig(BigN() * R.BigD() + R.BigN() * BigD(), BigD() * R.BigD());
+	}
+	Fraction operator-(const Fraction& R) const
+	{
+		return *this + (-R);
+	}
+	Fraction operator*(const Fraction& R) const
+	{
+		long long A, C;
+		if (!Big && !R.Big && CheckedMul(N, R.N, A) && CheckedMul(D, R.D, C))return Fraction(A, C);
+		return FromBig(BigN() * R.BigN(), BigD() * R.BigD());
+	}
+	Fraction operator/(const Fraction& R) const
+	{
+		if (R == 0)return Fraction(1, 0);
+		long long A, C;
+		if (!Big && !R.Big && CheckedMul(N, R.D, A) && CheckedMul(D, R.N, C))return Fraction(A, C);
+		return FromBig(BigN() * R.BigD(), BigD() * R.BigN());
+	}
+
+	///< Pow refuses results with more bits than this
+	static constexpr size_t MaxPowBits = 1024;
+
+	/**
+	 * @brief Raises the fraction to an integer power exactly by repeated squaring
+	 * @param E The exponent
+	 * @param Out[out] The power
+	 * @return bool False if the result would need more than MaxPowBits bits
+	 */
+	bool Pow(long long E, Fraction& Out) const
+	{
+		if (E < 0)
+		{
+			if (*this == 0)
+			{
+				Out = Fraction(1, 0);
+				return true;
+			}
+			return (Fraction(1) / *this).Pow(-E, Out);
+		}
+		size_t Bits = std::max(BigN().Bits(), BigD().Bits());
+		if (Bits > 1 && (unsigned long long)E > MaxPowBits / (Bits - 1))return false;
+		Fraction R(1), B = *this;
+		for (; E; E >>= 1)
+		{
+			if (E & 1)R = R * B;
+			if (E > 1)B = B * B;
+		}
+		Out = R;
+		return true;
+	}
+	Fraction& operator+=(const Fraction& R)
+	{
+		*this = *this + R;
+		return *this;
+	}
+	Fraction& operator-=(const Fraction& R)
+	{
+		*this = *this - R;
+		return *this;
+	}
+	Fraction& operator*=(const Fraction& R)
+	{
+		*this = *this * R;
+		return *this;
+	}
+	Fraction& operator/=(const Fraction& R)
+	{
+		*this = *this / R;
+		return *this;
+	}
+	bool operator==(const Fraction& R) const
+	{
+		// A value is big only if it does not fit, so a big value never equals a small one
+		if (Big || R.Big)return Big && R.Big && Big->first == R.Big->first && Big->second == R.Big->second;
+		return N == R.N && D == R.D;
+	}
+	bool operator==(int R) const { return !Big && N == R && D == 1; }
+
+	/**
+	 * @brief The largest fraction both are integer multiples of
+	 * @return Fraction The GCD of the numerators over the LCM of the denominators
+	 */
+	static Fraction Gcd(const Fraction& A, const Fraction& B)
+	{
+		if ((!A.Big && !A.D) || (!B.Big && !B.D))return Fraction(0);
+		long long L;
+		if (!A.Big && !B.Big && CheckedMul(A.D / std::gcd(A.D, B.D), B.D, L))return Fraction(std::gcd(A.N, B.N), L);
+		auto G = BigInt::Gcd(A.BigD(), B.BigD());
+		return FromBig(BigInt::Gcd(A.BigN(), B.BigN()), A.BigD() / G * B.BigD());
+	}
+
+	/**
+	 * @brief Formats the fraction as n/d, or n if d=1
+	 */
+	std::string ToString() const
+	{
+		auto S = Big ? Big->first.ToString() : std::to_string(N);
+		if (Big ? !Big->second.IsOne() : D != 1)S += "/" + (Big ? Big->second.ToString() : std::to_string(D));
+		return S;
+	}
+
+	/**
+	 * @brief Converts fraction to expression tree node
+	 * @return ExprNode* Tree representation (n/d or integer if d=1)
+	 */
+	ExprNode* ToNode() const
+	{
+		if (Big)return Big->second.IsOne() ? IntNode(Big->first) : (IntNode(Big->first) Div IntNode(Big->second));
+		return D == 1 ? IntNode(N) : (IntNode(N) Div IntNode(D));
+	}
+};
+
+/**
+ * @brief Extracts greatest common divisor from a range of fractions
+ * @tparam It Iterator type
+ * @tparam Se Sentinel type
+ * @param Begin Start iterator
+ * @param End End iterator
+ * @return Fraction The GCD of all fractions in range
+ */
+template<typename It, typename Se>
+Fraction ExtractGCD(It Begin, Se End)
+{
+	Fraction G = *Begin;
+	for (auto p = Begin; p != End; ++p)G = Fraction::Gcd(G, *p);
+	return G;
+}
+
+/**
+ * @brief Extracts GCD between two fractions
+ * @param F1 First fraction
+ * @param F2 Second fraction
+ * @return Fraction The GCD fraction
+ */
+Fraction ExtractGCD(Fraction F1, Fraction F2)
+{
+	if (F1 == 0 || F2 == 0)return Fraction(0);
+	return Fraction::Gcd(F1, F2);
+}
+
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+//----------------------TREE TRAVERSE HELPERS----------------------
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+
+/**
+ * @brief Applies a rewrite to every node of a subtree in post-order without recursion.
+ *
+ * Visit receives the slot holding a node after both operands of the node have been
+ * visited, exactly like a recursive pass that handles L() and R() first, and may
+ * replace the node through the slot.
+ *
+ * @param pRoot[in,out] Root node of the subtree
+ * @param Visit The rewrite, bool(ExprNode*&) returning whether it changed anything
+ * @return bool True if any call of Visit returned true
+ */
+template<typename Fn>
+bool RewritePostOrder(ExprNode*& pRoot, Fn&& Visit)
+{
+	bool Changed = false;
+	WalkStack<std::pair<ExprNode**, bool>> S;
+	if (pRoot)S.Push({ &pRoot, false });
+	while (!S.Empty())
+	{
+		auto& [ppNode, Expanded] = S.Top();
+		auto pp = ppNode;
+		if (Expanded)
+		{
+			S.Pop();
+			Changed |= Visit(*pp);
+			continue;
+		}
+		// The operand slots stay in place while the operands are rewritten
+		Expanded = true;
+		if ((*pp)->R())S.Push({ &(*pp)->R(), false });
+		if ((*pp)->L())S.Push({ &(*pp)->L(), false });
+	}
+	return Changed;
+}
+
+/**
+ * @brief Runs a pass on a subtree unless it left a subtree of the same shape unchanged before.
+ *
+ * A pass is a function of the subtree it gets, so a shape it did not change is
+ * a fixed point of it wherever it occurs. A rewrite gives new shapes only to the
+ * rewritten node and its ancestors, so the following rounds run the pass again
+ * on those and skip every settled subtree.
+ *
+ * The cached hashes must be valid when it is called, so a caller that rewrote
+ * nodes in place starts a new hash epoch first. A skipped subtree then costs a
+ * cache lookup. A pass that ran may have rewritten any node of the subtree in
+ * place, even if it returns false, so the subtree is hashed again; the nodes
+ * above it are left stale for the caller.
+ *
+ * @param pNode[in,out] Root node of the subtree
+ * @param Settled The shapes the pass is known to leave unchanged
+ * @param Pass The pass, bool(ExprNode*&)
+ * @return bool The result of the pass, false if it was skipped
+ */
+template<typename Fn>
+bool RewriteUnlessSettled(ExprNode*& pNode, FlatHashMap<bool>& Settled, Fn&& Pass)
+{
+	auto Before = pNode->Shape();
+	if (Settled.Find(Before))return false;
+	bool Changed = Pass(pNode);
+	InvalidateHashes(pNode);
+	//A pass that divided by zero has to run again to report it
+	if (!DividedbyZero && pNode->Shape() == Before)Settled[Before] = true;
+	return Changed;
+}
+
+/**
+ * @brief Implementation for collecting tree nodes matching required parent type
+ * @param Series[out] Vector to store collected nodes
+ * @param pNode Root node of the subtree to process
+ * @param RequiredParentType Token type that parent nodes must match for collection
+ */
+void TraverseTreeNodes_Impl(ScratchList<ExprNode*>& Series, const ExprNode* pNode, Token RequiredParentType)
+{
+	WalkStack<const ExprNode*> S;
+	if (pNode)S.Push(pNode);
+	while (!S.Empty())
+	{
+		pNode = S.Pop();
+		// Match parent type condition
+		if (pNode->V == RequiredParentType)
+		{
+			// Process children for additive/multiplicative nodes, left subtree first
+			if (pNode->HasOp1())S.Push(pNode->R());
+			if (pNode->HasOp0())S.Push(pNode->L());
+		}
+		// Collect non-parent-type nodes
+		else Series.push_back((ExprNode*)pNode);
+	}
+}
+
+/**
+ * @brief Initializes traversal of tree nodes with specified parent type
+ * @param Series[out] Vector to store collected nodes
+ * @param pNode Root node of the subtree to traverse
+ * @param RequiredParentType Token type that parent nodes must match
+ */
+void TraverseTreeNodes(ScratchList<ExprNode*>& Series, const ExprNode* pNode, Token RequiredParentType)
+{
+	Series.clear();
+	TraverseTreeNodes_Impl(Series, pNode, RequiredParentType);
+}
+
+/**
+ * @brief Implementation for counting tree nodes matching parent type
+ * @param Result[out] Counter for matching nodes
+ * @param pNode Root node of the subtree to process
+ * @param RequiredParentType Token type that parent nodes must match
+ */
+void TraverseCountTreeNodes_Impl(int& Result, const ExprNode* pNode, Token RequiredParentType)
+{
+	WalkStack<const ExprNode*> S;
+	if (pNode)S.Push(pNode);
+	while (!S.Empty())
+	{
+		pNode = S.Pop();
+		// Match parent type condition
+		if (pNode->V == RequiredParentType)
+		{
+			// Count children for additive/multiplicative nodes
+			if (pNode->HasOp1())S.Push(pNode->R());
+			if (pNode->HasOp0())S.Push(pNode->L());
+		}
+		// Increment counter for non-parent-type nodes
+		else ++Result;
+	}
+}
+
+/**
+ * @brief Counts nodes matching specified parent type in subtree
+ * @param pNode Root node of the subtree to count
+ * @param RequiredParentType Token type that parent nodes must match
+ * @return int Total count of matching nodes
+ */
+int TraverseCountTreeNodes(const ExprNode* pNode, Token RequiredParentType)
+{
+	int Result = 0;
+	TraverseCountTreeNodes_Impl(Result, pNode, RequiredParentType);
+	return Result;
+}
+
+// Macro for local type-based traversal
+// -purpose: Enables type-specific traversal with local storage
+// -usage: Creates a named scratch list and loop for traversal context
+#define TraverseTypeLocal(Cont, Node, Ty, Idx) \
+ScratchList<ExprNode*> Cont;\
+TraverseTreeNodes(Cont, Node, Ty);\
+ExprNode* Idx{};\
+for(size_t _I=0;_I<Cont.size()&&(Idx=Cont[_I],true);++_I)
+
+// Macro for type-based tree traversal
+// -purpose: Simplifies traversal code for specific node types
+// -usage: Expands to traversal loop over a scratch list named after Idx,
+//		   so traversals nest safely
+#define TraverseType(Node, Ty, Idx) TraverseTypeLocal(_Series_##Idx, Node, Ty, Idx)
+
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+//-------------------------NODE OPERATIONS-------------------------
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+
+/**
+* @brief Computes the hash value of this node.
+*
+* @return ExprHash The hash value of the node.
+*/
+ExprHash ExprNode::Hash() const
+{
+	if (HashStamp == HashEpoch) { ++HashCacheHits; return HashCache; }
+	//Post-order: a node is hashed once the hashes of its operands are cached
+	WalkStack<std::pair<const ExprNode*, bool>> S;
+	S.Push({ this, false });
+	while (!S.Empty())
+	{
+		auto& [pNode, Expanded] = S.Top();
+		auto p = pNode;
+		if (!Expanded)
+		{
+			Expanded = true;
+			for (auto c : p->Operand)
+			{
+				if (!c)continue;
+				if (c->HashStamp == HashEpoch)++HashCacheHits;
+				else S.Push({ c, false });
+			}
+			continue;
+		}
+		S.Pop();
+		++HashComputed;
+		ExprHash H = p->V.Hash();
+		//Considering exchangeable + and * and commutative property
+		if (p->V == ADD || p->V == MUL)
+		{
+			//The hash sums over the flattened operands of the chain, so an operand
+			//of the same type contributes its own hash without its token part
+			for (auto c : p->Operand)
+				if (c)H += c->V == p->V ? c->HashCache - p->V.Hash() : TransformHash(c->HashCache);
+			if (EnableDebugData) { printf("Hash()=%016llX Tree: ", H), p->PrintTree(); putchar('\n'); }
+		}
+		else
+		{
+			//The right operand is transformed twice, so swapping the operands
+			//of -, / and ^ changes the hash
+			H += (p->L() ? TransformHash(p->L()->HashCache) : 0)
+				+ (p->R() ? TransformHash(TransformHash(p->R()->HashCache)) : 0);
+			if (EnableDebugSimplifyII) { printf("Hash()=%016llX Tree: ", H); p->PrintTree(); putchar('\n'); }
+		}
+		p->HashCache = H;
+		p->ShapeCache = p->V.Hash() + (p->L() ? TransformHash(p->L()->ShapeCache) : 0)
+			+ (p->R() ? TransformHash(TransformHash(p->R()->ShapeCache)) : 0);
+		p->HashStamp = HashEpoch;
+	}
+	return HashCache;
+}
+
+void InvalidateHashes(const ExprNode* pRoot)
+{
+	WalkStack<const ExprNode*> S;
+	if (pRoot)S.Push(pRoot);
+	while (!S.Empty())
+	{
+		auto p = S.Pop();
+		p->HashStamp = 0;
+		if (p->L())S.Push(p->L());
+		if (p->R())S.Push(p->R());
+	}
+}
+
+/**
+* @brief Checks if this node represents a squared term.
+*
+* @return bool True if the node is a squared term, false otherwise.
+*/
+bool ExprNode::IsSquare() const
+{
+	return V.IsPOW() && V1() == Token((int)2);
+}
+
+/**
+* @brief Checks if this node represents a constant value.
+*
+* @return bool True if the node is a constant, false otherwise.
+*/
+bool ExprNode::IsConst() const
+{
+	if (V.Ty == Token::Int || V.Ty == Token::Big)return true;
+	else if (V.Ty == Token::Variable || V.Ty == Token::Function)return false;
+	WalkStack<const ExprNode*> S;
+	S.Push(this);
+	while (!S.Empty())
+	{
+		auto p = S.Pop();
+		if (p->V.Ty == Token::Int || p->V.Ty == Token::Big)continue;
+		else if (p->V.Ty == Token::Variable)return false;
+		else if (p->V.Ty == Token::Function)return false;
+		if (p->R())S.Push(p->R());
+		if (p->L())S.Push(p->L());
+	}
+	return true;
+}
+
+/**
+* @brief Checks if this node represents a constant value excluding radicals.
+*
+* @return bool True if the node is a constant in the specified form, false otherwise.
+*/
+bool ExprNode::IsConstII() const
+{
+	if (V.Ty == Token::Int || V.Ty == Token::Big)return true;
+	else if (V.Ty == Token::Variable || V.Ty == Token::Function)return false;
+	WalkStack<const ExprNode*> S;
+	S.Push(this);
+	while (!S.Empty())
+	{
+		auto p = S.Pop();
+		if (p->V.Ty == Token::Int || p->V.Ty == Token::Big)continue;
+		else if (p->V.Ty == Token::Variable)return false;
+		else if (p->V.Ty == Token::Function)return false;
+		else if (p->V.ID == '^')return false;
+		if (p->R())S.Push(p->R());
+		if (p->L())S.Push(p->L());
+	}
+	return true;
+}
+
+/**
+* @brief Returns the operator precedence level of this node.
+*
+* @param ConsiderUsedNode Whether to consider if the node is already used.
+* @return int The precedence level of the operator.
+*/
+int ExprNode::OprLevel(bool ConsiderUsedNode) const
+{
+	if (V.Ty == Token::Operator)
+	{
+		if (L() && !ConsiderUsedNode)return 0;
+		else if (V.ID == '+' || V.ID == '-')return 1;
+		else if (V.ID == '*' || V.ID == '/')return 2;
+		else if (V.ID == '^')return 3;
+		else return 114514;//never occur
+	}
+	else return 0;
+}
+
+/**
+* @brief Prints the node's information for debugging purposes.
+*/
+void ExprNode::DebugPrint() const
+{
+	/*Token V;
+	ExprNode* Operand[2];*/
+	if (V.Ty == Token::Function || V.Ty == Token::Operator)
+	{
+		printf("<%04X>%s:{", unsigned(((size_t)this) % 0xFFFF), V.GetText());
+		if (L())L()->DebugPrint();
+		printf("}{");
+		if (R())R()->DebugPrint();
+		printf("}");
+	}
+	else printf("<%04X>%s", unsigned(((size_t)this) % 0xFFFF), V.GetText());
+}
+
+/**
+* @brief Tells whether PrintTree puts an operator node in brackets.
+*
+* @param N The operator node.
+* @param Parent The parent node of N, nullptr for the root.
+* @param IsLeft Whether N is the left operand of Parent.
+* @param First Whether nothing was printed before N.
+* @return bool True if N is printed in brackets.
+*/
+bool PrintsBracket(const ExprNode* N, const ExprNode* Parent, bool IsLeft, bool First)
+{
+	bool NeedsBracket;
+	bool Neg = N->V.ID == '*' && N->V0() == Token((int)-1);
+	if (Parent && Parent->V.Ty == Token::Operator)
+	{
+		int PL = Parent->OprLevel(true);
+		int ML = N->OprLevel(true);
+		NeedsBracket = (PL > ML || (PL == ML && PL &&
+			((Parent->V.ID == '-' && !IsLeft) || (Parent->V.ID == '/' && !IsLeft) || (Parent->V.ID == '^' && IsLeft))));
+	}
+	else NeedsBracket = false;
+	return !(Neg && First) && (NeedsBracket || (Parent && Neg));
+}
+
+/**
+* @brief Tells whether the printed form of a right operand starts with a digit.
+*
+* PrintTree leaves out the '*' after an integer, as in 2x, which must not
+* glue two numbers together, as in 33^x for 3*3^x.
+*
+* @param N The right operand.
+* @param Parent The parent node of N.
+* @return bool True if the first printed character of N is a digit.
+*/
+bool PrintsDigitFirst(const ExprNode* N, const ExprNode* Parent)
+{
+	for (bool IsLeft = false; N->V.Ty == Token::Operator; IsLeft = true)
 	{
-		// Duplicate the string for symbol
-		char* p = DuplicateStr(Begin, Idx - Begin);
-		// Check if it's a known function
-		int ID = GetFuncID(p);
-		// If not a function, create variable token
-		if (ID == -1)Toks.emplace_back(DuplicateStr(Begin, Idx - Begin));
-		// If it is a function, create function token
-		else Toks.emplace_back(ID, AsFuncID{});
-	}break;
-	};
+		if (PrintsBracket(N, Parent, IsLeft, false))return false;
+		Parent = N;
+		N = N->L();
+	}
+	// Negative numbers below the root are printed in brackets
+	if (N->V.Ty == Token::Int)return N->V.ID >= 0;
+	return N->V.Ty == Token::Big && !BigLiterals.Values[N->V.ID].Neg;
 }
 
 /**
- * @brief Generates tokens from a mathematical expression string.
- *
- * @param Str The input string representing the mathematical expression.
- * @param Toks A reference to a vector where the generated tokens will be stored.
- */
-void GenerateTokens(const std::string& Str, std::vector<Token>& Toks)
+* @brief Prints the subtree rooted at this node in a tree-like structure.
+*
+* @param Parent The parent node of this node.
+* @param PrintedCount A counter for the number of nodes printed.
+* @param IsLeft Indicates if this node is the left child of its parent.
+*/
+void ExprNode::PrintTree(const ExprNode* Parent, int& PrintedCount, bool IsLeft) const
 {
-	auto Begin = Str.begin(), Idx = Str.begin();
-	TokCond LastType{ TokCond::Null }, CurType;
-	for (; Idx != Str.end(); ++Idx)
+	//Stage 0: before the left operand, 1: between the operands, 2: after the right operand
+	struct Frame
 	{
-		// Determine current character type
-		CurType = Judge(*Idx);
-		if (LastType == CurType)
+		const ExprNode* N;
+		const ExprNode* Parent;
+		bool IsLeft;
+		bool NeedsBracket;
+		int Stage;
+	};
+	WalkStack<Frame> S;
+	S.Push({ this, Parent, IsLeft, false, 0 });
+	while (!S.Empty())
+	{
+		auto& F = S.Top();
+		auto N = F.N;
+		switch (F.Stage++)
 		{
-			// Handle consecutive characters of same type
-			if (CurType == TokCond::Operator)
+		case 0:
+			switch (N->V.Ty)
 			{
-				// Operators are single-character, so add immediately
-				Toks.emplace_back(*Begin);
-				Begin = Idx;
+			case Token::Int:
+				if (N->V.ID >= 0 || !F.Parent)printf("%d", N->V.ID);
+				else printf("(%d)", N->V.ID);
+				++PrintedCount; S.Pop();
+				break;
+			case Token::Big:
+				if (!BigLiterals.Values[N->V.ID].Neg || !F.Parent)printf("%s", N->V.GetText());
+				else printf("(%s)", N->V.GetText());
+				++PrintedCount; S.Pop();
+				break;
+			case Token::Variable:
+				printf("%s", N->V.GetText());
+				++PrintedCount; S.Pop();
+				break;
+			case Token::Operator:
+			{
+				bool Neg = N->V.ID == '*' && N->V0() == Token((int)-1);
+				F.NeedsBracket = PrintsBracket(N, F.Parent, F.IsLeft, !PrintedCount);
+				if (F.NeedsBracket)putchar('(');
+				//-1*x -> -x
+				if (Neg)
+				{
+					putchar('-');
+					F.Stage = 2;
+					S.Push({ N->R(), N, false, false, 0 });
+				}
+				else S.Push({ N->L(), N, true, false, 0 });
+				break;
 			}
-			continue;
+			case Token::Function:
+				printf("%s(", N->V.GetText());
+				S.Push({ N->L(), N, true, false, 0 });
+				break;
+			default:
+				++PrintedCount; S.Pop();
+				break;
+			}
+			break;
+		case 1:
+			if (N->V.Ty == Token::Operator)
+			{
+				if (!(N->V.ID == '*' && N->Ty0() == Token::Int && N->Ty1() != Token::Int && N->Ty1() != Token::Big
+					&& !PrintsDigitFirst(N->R(), N)))putchar(N->V.ID);
+				S.Push({ N->R(), N, false, false, 0 });
+			}
+			else if (Funcs[N->V.ID].NParam == 2)
+			{
+				putchar(',');
+				S.Push({ N->R(), N, false, false, 0 });
+			}
+			break;
+		default:
+			if (N->V.Ty == Token::Function || F.NeedsBracket)putchar(')');
+			++PrintedCount; S.Pop();
+			break;
 		}
-		// Parse previous token segment
-		ParseToken(LastType, Begin.operator->(), Idx.operator->(), Toks);
+	}
+}
+void ParseNode::DebugPrintTraverse(const ParseNode* End) const
+{
+	for (auto V = this; V != End; V = V->Next)
+	{
+		V->Node->DebugPrint();
+		putchar('\n');
+	}
+}
 
-		// Update for next iteration
-		Begin = Idx;
-		LastType = CurType;
+/**
+* @brief Recomputes DepMask for every node of a tree, operands first.
+*
+* The node constructors keep DepMask up to date, so this is only needed
+* for trees whose nodes were linked or rewritten in place.
+*
+* @param pRoot Root of the tree.
+*/
+void UpdateTreeDeps(ExprNode* pRoot)
+{
+	if (!pRoot)return;
+	WalkStack<std::pair<ExprNode*, bool>> S;
+	S.Push({ pRoot, false });
+	while (!S.Empty())
+	{
+		auto& [pNode, Expanded] = S.Top();
+		auto p = pNode;
+		if (!Expanded)
+		{
+			Expanded = true;
+			if (p->R())S.Push({ p->R(), false });
+			if (p->L())S.Push({ p->L(), false });
+			continue;
+		}
+		S.Pop();
+		p->UpdateDeps();
 	}
-	// Parse the last token segment
-	ParseToken(LastType, Begin.operator->(), Idx.operator->(), Toks);
 }
 
-//ADD COMMENTS FROM HERE !!!
+/**
+* @brief Creates a copy of this node.(Only Token, Operand & DepMask)
+*
+* @return ExprNode* A duplicate of this node.
+*/
+ExprNode* ExprNode::Duplicate() const
+{
+	auto N = CreateNode();
+	N->V = V;
+	N->DepMask = DepMask;
+	WalkStack<std::pair<const ExprNode*, ExprNode*>> S;
+	S.Push({ this, N });
+	while (!S.Empty())
+	{
+		auto [Src, Dst] = S.Pop();
+		for (int i = 1; i >= 0; i--)
+		{
+			if (!Src->Operand[i])continue;
+			auto C = CreateNode();
+			C->V = Src->Operand[i]->V;
+			C->DepMask = Src->Operand[i]->DepMask;
+			Dst->Operand[i] = C;
+			S.Push({ Src->Operand[i], C });
+		}
+	}
+	return N;
+}
 
-// Token constructor implementations
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+//-----------------------PARTIAL DERIVATIVE------------------------
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
 
 /**
- * @brief Constructs a Token from an integer value.
- * @param V The integer value to store in the token.
- */
-Token::Token(int V) : Ty(Token::Type::Int), ID(V) {}
+* @brief Returns the key of a subtree and a variable in PartialMemo.
+*
+* Local derivatives of the reverse sweep (DX < 0) seed the tangents of the operands
+* of a single node, which may be structurally equal, so they are keyed by address.
+*
+* @param pNode The subtree.
+* @param DX The ID of the variable with respect to which to differentiate.
+* @return ExprHash The key.
+*/
+ExprHash PartialKey(const ExprNode* pNode, int DX)
+{
+	if (DX < 0)return (ExprHash)(uintptr_t)pNode;
+	return pNode->Hash() + TransformHash((ExprHash)DX);
+}
+
+bool Equal(const ExprNode* L, const ExprNode* R);
 
 /**
- * @brief Constructs a Token from an operator character.
- * @param Opr The operator character (e.g., '+', '-', '*', etc.).
- */
-Token::Token(char Opr) : Ty(Token::Type::Operator), ID(Opr) {}
+* @brief Looks the derivative of a subtree up in PartialMemo.
+*
+* @param pNode The subtree.
+* @param K Its key, see PartialKey.
+* @return ExprNode* The derivative, nullptr if the entry is missing or holds
+*         another subtree with the same key.
+*/
+ExprNode* FindPartial(const ExprNode* pNode, ExprHash K)
+{
+	auto p = PartialMemo.Find(K);
+	return p && Equal(p->Source, pNode) ? p->D : nullptr;
+}
 
 /**
- * @brief Constructs a Token representing a function with a given ID.
- * @param FuncID The ID of the function as defined in Funcs array.
- * @param (Unused) A tag to differentiate this constructor from others.
- */
-Token::Token(int FuncID, AsFuncID) : Ty(Token::Type::Function), ID(FuncID) {}
+* @brief Stores the derivative of a subtree in PartialMemo unless its key is taken.
+*/
+void StorePartial(const ExprNode* pNode, ExprHash K, ExprNode* D)
+{
+	auto& E = PartialMemo[K];
+	if (!E.Source)E = { pNode, D };
+}
 
 /**
- * @brief Constructs a Token representing a variable.
- * @param Var The name of the variable. Automatically assigns a unique ID via GetVarID.
- */
-Token::Token(char* Var) : Ty(Token::Type::Variable), ID(GetVarID(Var)) {}
+* @brief Returns the derivative of a subtree, from PartialMemo if it was seen before.
+*
+* Subtrees created by the derivative rules themselves (e.g. g*ln(f) in DX_pow)
+* are memoized here as well. Leaves are not worth a lookup, except for the
+* seeded operands of a local derivative, and subtrees without the variable
+* are 0 without looking at them.
+*
+* @param pNode The subtree.
+* @param DX The ID of the variable with respect to which to differentiate.
+* @return ExprNode* The derivative of the subtree.
+*/
+ExprNode* PartialOf(const ExprNode* pNode, int DX)
+{
+	if (DX >= 0 && !pNode->MayDependOn(DX))return Const(0);
+	if (DX >= 0 && !pNode->L())return pNode->PartialNode(DX);
+	auto K = PartialKey(pNode, DX);
+	if (auto p = FindPartial(pNode, K))return p;
+	auto D = pNode->PartialNode(DX);
+	StorePartial(pNode, K, D);
+	return D;
+}
 
 /**
- * @brief Returns the textual representation of the token based on its type.
- * @return const char* The string representation (function name, operator char, variable name, or integer value).
- */
-const char* Token::GetText() const
+* @brief Computes the partial derivative of this node with respect to a variable.
+*
+* @param DX The ID of the variable with respect to which to differentiate.
+* @return ExprNode* The resulting node after differentiation.
+*/
+ExprNode* ExprNode::Partial(int DX) const
 {
-	switch (Ty)
-	{
-	case Token::Function: return Funcs[ID].Name;
-		// Lookup function name from Funcs array
-	case Token::Operator:
+	//Post-order: the rule of a node runs once its operands are differentiated,
+	//subtrees equal to one differentiated before are not entered again.
+	//The tree was rewritten by Simplify since it was hashed last
+	InvalidateHashes();
+	if (!L() || !MayDependOn(DX))return PartialOf(this, DX);
+	struct Frame { const ExprNode* pNode; ExprHash Key; bool Expanded; };
+	WalkStack<Frame> S;
+	ExprNode* D{};
+	S.Push({ this, PartialKey(this, DX), false });
+	while (!S.Empty())
 	{
-		// Convert operator ID to a string
-		char* p = MakeStr(1);
-		p[0] = (char)ID;
-		return p;
+		auto& Top = S.Top();
+		auto p = Top.pNode;
+		if (!Top.Expanded)
+		{
+			Top.Expanded = true;
+			//Leaves and subtrees without DX are differentiated on the spot by PartialOf
+			for (auto c : { p->R(), p->L() })
+			{
+				if (!c || !c->L() || !c->MayDependOn(DX))continue;
+				auto K = PartialKey(c, DX);
+				if (!FindPartial(c, K))S.Push({ c, K, false });
+			}
+			continue;
+		}
+		auto K = S.Pop().Key;
+		//A subtree whose key is taken by another one is differentiated again by
+		//PartialOf wherever it occurs
+		D = p->PartialNode(DX);
+		StorePartial(p, K, D);
 	}
-	// Get variable name from Vars vector
-	case Token::Variable: return Vars[ID].c_str();
-		// Convert integer ID to string
-	case Token::Int:
+	return D;
+}
+
+/**
+* @brief Applies the derivative rule of this node.
+*
+* @param DX The ID of the variable with respect to which to differentiate.
+* @return ExprNode* The resulting node after differentiation.
+*/
+ExprNode* ExprNode::PartialNode(int DX) const
+{
+	switch (V.Ty)
 	{
-		char* p = MakeStr(16);
-		snprintf(p, 16, "%d", ID);
-		return p;
+		// Derivative of constant is 0
+	case Token::Int: return Const(0);
+	case Token::Big: return Const(0);
+		// dx/dx=1, dy/dx=0
+	case Token::Variable: return V.ID == DX ? Const(1) : Const(0);
+		// Handle operator nodes
+	case Token::Operator: return PartialOpr(DX);
+		// Use function-specific rules
+	case Token::Function: return Funcs[V.ID].Derivative(L(), R(), DX);
+		// Fallback for undefined types
+	default:return Const(0);
 	}
-	default: return "";//solve a warning
+}
+
+/**
+* @brief Computes the partial derivative for operator nodes.
+*
+* @param DX The ID of the variable with respect to which to differentiate.
+* @return ExprNode* The resulting node after differentiation.
+*/
+ExprNode* ExprNode::PartialOpr(int DX) const
+{
+	switch (V.ID)
+	{
+		// d(f+g)/dx = f' + g'
+	case '+':return DX_add(L(), R(), DX);
+		// d(f-g)/dx = f' - g'
+	case '-':return DX_sub(L(), R(), DX);
+		// d(f*g)/dx = f'*g + f*g'
+	case '*':return DX_mul(L(), R(), DX);
+		// d(f/g)/dx = (f'g - fg')/g
+	case '/':return DX_div(L(), R(), DX);
+	case '^':return DX_pow(L(), R(), DX);
+	default: 
+		// Safety fallback
+		("Fatal Error: Unknown Operator %c", V.ID); 
+		return Duplicate();//How could this happen?
 	}
 }
 
+// Derivative rule macros (avoid code duplication)
+// -purpose: Share left operand (the derivative is hash-consed, see NodeConsTable)
+#define F  ((ExprNode*)Op1)
+// -purpose: Derivative of left operand
+#define DF (PartialOf(Op1, DX))
+// -purpose: Share right operand
+#define G  ((ExprNode*)Op2)
+// -purpose: Derivative of right operand
+#define DG (PartialOf(Op2, DX))
+// -purpose: Checks for a zero derivative, whose operand does not depend on the variable
+#define IsZero(D) ((D)->V.Ty == Token::Int && (D)->V.ID == 0)
+// -purpose: Unary negation in the form Simplify_Neg produces, (-1)*x
+#define Neg(x) (Const(-1) Mul (x))
+
+/**
+ * @brief Derivative rule for addition: d(f+g)/dx = df/dx + dg/dx
+ * 
+ * @param Op1 Left operand expression (f)
+ * @param Op2 Right operand expression (g)
+ * @param DX Target variable ID
+ * @return ExprNode* Resulting derivative tree
+ */
+ExprNode* DX_add(const ExprNode* Op1, const ExprNode* Op2, int DX)
+{
+	//f+g -> f'+g'
+	auto dF = DF, dG = DG;
+	if (IsZero(dG))return dF;
+	if (IsZero(dF))return dG;
+	return dF Add dG;
+}
+
+/**
+ * @brief Derivative rule for subtraction: d(f-g)/dx = df/dx - dg/dx
+ * @param Op1 Left operand expression (f)
+ * @param Op2 Right operand expression (g)
+ * @param DX Target variable ID
+ * @return ExprNode* Resulting derivative tree
+ */
+ExprNode* DX_sub(const ExprNode* Op1, const ExprNode* Op2, int DX)
+{
+	//f-g -> f'-g'
+	auto dF = DF, dG = DG;
+	if (IsZero(dG))return dF;
+	if (IsZero(dF))return Neg(dG);
+	return dF Sub dG;
+}
+
+/**
+ * @brief Derivative rule for multiplication: d(f*g)/dx = f'*g + f*g'
+ * @param Op1 Left operand expression (f)
+ * @param Op2 Right operand expression (g)
+ * @param DX Target variable ID
+ * @return ExprNode* Resulting derivative tree
+ */
+ExprNode* DX_mul(const ExprNode* Op1, const ExprNode* Op2, int DX)
+{
+	//f*g -> f'*g+f*g'
+	auto dF = DF, dG = DG;
+	if (IsZero(dG))return dF Mul G;
+	if (IsZero(dF))return F Mul dG;
+	return (dF Mul G)Add(F Mul dG);
+}
+
+/**
+ * @brief Derivative rule for division: d(f/g)/dx = (f'g - fg')/g^2
+ * @param Op1 Numerator expression (f)
+ * @param Op2 Denominator expression (g)
+ * @param DX Target variable ID
+ * @return ExprNode* Resulting derivative tree, f'/g for a constant denominator
+ */
+ExprNode* DX_div(const ExprNode* Op1, const ExprNode* Op2, int DX)
+{
+	//f/g -> (f'*g-f*g')/(g^2)
+	auto dF = DF, dG = DG;
+	if (IsZero(dG))return dF Div G;
+	if (IsZero(dF))return Neg(F Mul dG) Div(G Pwr Const(2));
+	return ((dF Mul G)Sub(F Mul dG))Div(G Pwr Const(2));
+}
+
 /**
- * @brief Converts a substring to an integer.
- * @param Begin Start iterator of the substring.
- * @param End End iterator of the substring.
- * @return int The parsed integer value.
+ * @brief Derivative rule for natural logarithm: d(ln(f))/dx = f'/f
+ * @param Op1 Inner function expression (f)
+ * @param Op2 (Unused) Placeholder for interface consistency
+ * @param DX Target variable ID
+ * @return ExprNode* Resulting derivative tree
  */
-int StrToIntEx(const char* Begin, const char* End)
+ExprNode* DX_ln(const ExprNode* Op1, const ExprNode* Op2, int DX)
 {
-	int Value = 0;// Only handles non-negative integers
-	while (Begin < End)
-	{
-		Value *= 10;
-		Value += *Begin - '0';
-		++Begin;
-	}
-	return Value;
+	//ln(f) -> f'/f
+	return DF Div F;
 }
 
 /**
- * @brief Looks up a function ID by name.
- * @param Name The function name to search for.
- * @return int The function ID if found, -1 otherwise.
+ * @brief Derivative rule for logarithm: d(log_b(f))/dx = (ln(f)/ln(b))'
+ * @param Op1 Base expression (b)
+ * @param Op2 Argument expression (f)
+ * @param DX Target variable ID
+ * @return ExprNode* Resulting derivative tree, f'/(f*ln(b)) for a constant base
  */
-int GetFuncID(const char* Name)
+ExprNode* DX_log(const ExprNode* Op1, const ExprNode* Op2, int DX)
 {
-	for (int i = 0; i < NFuncs; i++)
-	{
-		if (!strcmp(Funcs[i].Name, Name))
-			return i;
-	}
-	return -1;
+	//log(f,g)=ln(g)/ln(f)
+	auto dF = DF, dG = DG;
+	if (IsZero(dF))return dG Div(G Mul Ln(F));
+	//log(f,g) -> -ln(g)*f'/(f*ln(f)^2) for a constant argument
+	if (IsZero(dG))return Neg(Ln(G) Mul dF) Div(F Mul(Ln(F) Pwr Const(2)));
+	return DX_div(Ln(G), Ln(F), DX);
 }
 
 /**
- * @brief Retrieves or creates a variable ID for a given variable name.
- * @param Name The variable name.
- * @return int Unique integer ID assigned to the variable.
+ * @brief Derivative rule for cosine: d(cos(f))/dx = -f'*sin(f)
+ * @param Op1 Inner function expression (f)
+ * @param Op2 (Unused) Placeholder for interface consistency
+ * @param DX Target variable ID
+ * @return ExprNode* Resulting derivative tree
  */
-int GetVarID(const char* Name)
+ExprNode* DX_cos(const ExprNode* Op1, const ExprNode* Op2, int DX)
 {
-	auto it = VarMap.find(Name);
-	if (it != VarMap.end())return it->second;
-	else
-	{
-		VarMap[Name] = VarMaxID;
-		Vars.push_back(Name);
-		return VarMaxID++;
-	}
+	//cos(f) -> -f'*sin(f)
+	return Neg(DF Mul Sin(F));
 }
 
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
-//------------------EXPRESSION TREE CONSTRUCTION-------------------
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
-
 /**
- * @brief Determines if operator merging should occur based on precedence.
- * @param Back The previous operator node.
- * @param CurLevel The precedence level of the current operator.
- * @return bool True if merging should trigger.
+ * @brief Computes the derivative of the sine function
+ * @param Op1 The inner function expression (f in sin(f))
+ * @param Op2 Unused parameter (maintained for interface consistency)
+ * @param DX The variable ID to differentiate against
+ * @return ExprNode* Derivative expression tree: cos(f) * f'
  */
-bool TriggerMerge(const ExprNode* Back, int CurLevel)
+ExprNode* DX_sin(const ExprNode* Op1, const ExprNode* Op2, int DX)
 {
-	// Handle right-associative operators like '-' and '/'
-	if (Back->V.Ty == Token::Operator && (Back->V.ID == '-' || Back->V.ID == '/'))
-		return Back->OprLevel(false) >= CurLevel;
-	else return Back->OprLevel(false) > CurLevel;
+	//sin(f) -> f'*cos(f)
+	return DF Mul Cos(F);
 }
 
 /**
- * @brief Merges operator nodes in the operator stack based on precedence.
- * @param CurLevel The precedence level of the current operator.
- * @return bool False if syntax error occurs (e.g., missing operands).
+ * @brief Computes the derivative of the tangent function
+ * @param Op1 The inner function expression (f in tan(f))
+ * @param Op2 Unused parameter (interface consistency)
+ * @param DX The variable ID to differentiate against
+ * @return ExprNode* Derivative expression tree: f' / cos(f)^2
  */
-bool MergeTop(int CurLevel)
+ExprNode* DX_tan(const ExprNode* Op1, const ExprNode* Op2, int DX)
 {
-	while (!OprV.empty() && TriggerMerge(OprV.back(), CurLevel))
-	{
-		if (ExprV.size() < 2) { puts("Syntax Error: missing operand."); FailedToParse = true; return false; }
-		
-		// Build tree: attach operands to operator
-		OprV.back()->R() = ExprV.back();
-		OprV.back()->L() = ExprV[ExprV.size() - 2];
-		ExprV[ExprV.size() - 2] = OprV.back();
-		OprV.pop_back();
-		ExprV.pop_back();
-	}
-	return true;
+	//tan(f) -> f'/cos^2(f)
+	return DF Div(Cos(F) Pwr Const(2));
 }
 
 /**
- * @brief Constructs an expression tree from a token sequence.
- * @param Begin Start node of the token sequence.
- * @param End End node of the token sequence (exclusive).
- * @return ExprNode* Root of the constructed subtree.
+ * @brief Computes the derivative of the power function (f^g)
+ * @param Op1 Base expression (f in f^g)
+ * @param Op2 Exponent expression (g in f^g)
+ * @param DX The variable ID to differentiate against
+ * @return ExprNode* Derivative expression tree: the power rule for a constant
+ *         exponent, the exponential rule for a constant base, otherwise
+ *         logarithmic differentiation
  */
-ExprNode* CreateTree(ExprNode* Begin, ExprNode* End)// PARSE TO: [Begin,End)
+ExprNode* DX_pow(const ExprNode* Op1, const ExprNode* Op2, int DX)
 {
-	extern Token MUL;
-	if constexpr (EnableDebugData) { printf("\nEnd: "); End->DebugPrint(); printf("\nToCreate: "); Begin->DebugPrintTraverse(End); }
-	//Note: Prev always exists
-	if (Begin == End) return CreateNode();
-
-	// Handle unary minus: prepend a zero (e.g., "-x" -> "0 - x")
-	else if (Begin->OprLevel(false) && Begin->V.IsSUB())
-	{
-		auto V = CreateNode(Token((int)0));
-		V->Next = Begin;
-		V->Prev = Begin->Prev;
-		Begin->Prev->Next = V;
-		Begin->Prev = V;
-		Begin = V;
-	}
-
-	OprV.clear();
-	ExprV.clear();
-	int Level;
-	bool LastHasLevel = true;
-	auto UP = Begin->Prev;
-
-	// Process each node in the token sequence
-	for (auto pNode = Begin; pNode != End; pNode = pNode->Next)
+	auto dF = DF, dG = DG;
+	if (IsZero(dF) && IsZero(dG))return Const(0);
+	//f^c -> c*f^(c-1)*f'
+	if (IsZero(dG))
 	{
-		// Skip brackets/comma
-		if (pNode->V.IsIgnoredSymbol())continue;
-		Level = pNode->OprLevel(false);
-
-		// Operand (number/variable)
-		if (!Level)
-		{
-			// Implicit multiplication (e.g., "2x")
-			if (!LastHasLevel)
-			{
-				if (!MergeTop(2))return CreateNode();
-				OprV.push_back(CreateNode(MUL));
-			}
-			ExprV.push_back(pNode);
-		}
-		// Operator or function
-		else
-		{
-			if (!MergeTop(Level))return CreateNode();
-			OprV.push_back(pNode);
-		}
-		LastHasLevel = Level != 0;
-		if constexpr (EnableDebugData) { printf("\nPush: "); pNode->DebugPrint(); }
+		if (G->V.Ty != Token::Int)return (G Mul(F Pwr(G Sub Const(1))))Mul dF;
+		if (G->V.ID == 2)return (Const(2) Mul F)Mul dF;
+		return (G Mul(F Pwr Const(G->V.ID - 1)))Mul dF;
 	}
-	// Merge remaining operators
-	while (!OprV.empty())if (!MergeTop(0))return CreateNode();
-
-	// Link the final tree
-	ExprV[0]->Next = End;
-	ExprV[0]->Prev = UP;
-	End->Prev = ExprV[0];
-	UP->Next = ExprV[0];
-
-	if constexpr (EnableDebugData) { printf("\nCreate: "); ExprV[0]->DebugPrint(); }
-
-	return ExprV[0];
+	//c^g -> ln(c)*c^g*g'
+	if (IsZero(dF))return (Ln(F) Mul(F Pwr G))Mul dG;
+	//f^g=exp(g*lnf) -> f^g*(g'*lnf+g*f'/f)
+	return (F Pwr G)Mul((dG Mul Ln(F))Add(G Mul(dF Div F)));
 }
 
 /**
- * @brief Validates function argument counts in the expression tree.
- * @param E Root node of the subtree to check.
- * @return bool True if all functions have correct parameter counts.
+ * @brief Computes the derivative of the exponential function (e^f)
+ * @param Op1 The exponent expression (f in exp(f))
+ * @param Op2 Unused parameter (interface consistency)
+ * @param DX The variable ID to differentiate against
+ * @return ExprNode* Derivative expression tree: exp(f) * f'
  */
-bool CheckArgument(const ExprNode* E)
+ExprNode* DX_exp(const ExprNode* Op1, const ExprNode* Op2, int DX)
 {
-	if (!E)return true;
-	else if (E->V.Ty == Token::Function)
-	{
-		int NArg = !!(E->L()) + !!(E->R());
-		if (NArg != Funcs[E->V.ID].NParam)
-		{
-			printf("Syntax Error: Function %s expected %d Arguments, Found %d Arguments\n", Funcs[E->V.ID].Name, Funcs[E->V.ID].NParam, NArg);
-			return false;
-		}
-		else return true;
-	}
-	// Recursively check children
-	else
-	{
-		bool OK = true;
-		OK &= CheckArgument(E->L());
-		OK &= CheckArgument(E->R());
-		return OK;
-	}
+	//exp(f) -> f'*exp(f)
+	return DF Mul Exp(F);
 }
 
 /**
- * @brief Destructor for Expr. Releases the entire expression tree.
+ * @brief Computes the derivative of the hyperbolic sine function
+ * @param Op1 The inner function expression (f in sinh(f))
+ * @param Op2 Unused parameter (interface consistency)
+ * @param DX The variable ID to differentiate against
+ * @return ExprNode* Derivative expression tree: cosh(f) * f'
  */
-Expr::~Expr()
+ExprNode* DX_sinh(const ExprNode* Op1, const ExprNode* Op2, int DX)
 {
-	ReleaseTree(Root);
+	//sinhf -> f'*coshf
+	return DF Mul Cosh(F);
 }
 
-
-Expr::Expr(const std::vector<Token>& Toks)
-{
-	DividedbyZero = false;
-	ExprNode* pNew;
-	ExprNode M{}, N{};
-	ExprNode* pCur = &M;
-	Brackets.clear();
-
-	// Build linked list of tokens
-	for (auto& T : Toks)
-	{
-		pNew = CreateNode(T);
-		pCur->Next = pNew;
-		pNew->Prev = pCur;
-		pCur = pNew;
-		if constexpr (EnableDebugData) { putchar('\n'); printf("New: "); M.Next->DebugPrintTraverse(nullptr); }
-
-		// Handle brackets and commas for function arguments
-		if (T.IsLBK())
-		{
-			Brackets.emplace_back();
-			Brackets.back().Left = pCur;
-			Brackets.back().Comma = nullptr;
-			if constexpr (EnableDebugData) { puts("Push:"); pCur->DebugPrint(); }
-		}
-		else if (T.IsCOM())
-		{
-			if (!Brackets.empty())
-			{
-				if (Brackets.back().Comma) { puts("Syntax Error: Too many arguments."); FailedToParse = true; return; }
-				else Brackets.back().Comma = pCur;
-			}
-			else { puts("Syntax Error: \",\"is not in a \"()\"."); FailedToParse = true; return; }
-		}
-		else if (T.IsRBK())
-		{
-			if (Brackets.empty()) { puts("Syntax Error: \")\"is lonely."); FailedToParse = true; return; }
-			if (Brackets.back().Comma)
-			{
-				auto pTok = Brackets.back().Left->Prev;
-				auto pCom = Brackets.back().Comma;
-				//putchar('\n'); M.Next->DebugPrintTraverse(nullptr);
-				//putchar('\n'); M.Next->DebugPrintTraverse(Brackets.back().Left);
-				auto T1 = CreateTree(Brackets.back().Left->Next, pCom);
-				auto T2 = CreateTree(pCom->Next, pCur);
-				if (FailedToParse)return;
-				//pTok-> ( ->T1->Comma->T2->pCur
-				if (pTok->V.Ty == Token::Function)
-				{
-					ReleaseNode(pCur);//)
-					pTok->L() = T1;
-					pTok->R() = T2;
-					pCur = pTok;
-				}
-				else { puts("Syntax Error: \",\" is only for functions."); FailedToParse = true; return; }
-			}
-			// Single argument in brackets
-			else
-			{
-				auto pTok = Brackets.back().Left->Prev;
-				auto T1 = CreateTree(Brackets.back().Left->Next, pCur);
-				Brackets.back().Left->Next = T1;
-				T1->Next = pCur;
-				if (FailedToParse)return;
-				if constexpr (EnableDebugData) { putchar('\n'); M.Next->DebugPrintTraverse(nullptr); }
-				//L->T->pCur
-				//ReleaseNode(pCur);//)
-				if (pTok->V.Ty == Token::Function)
-				{
-					pTok->L() = T1;
-					pCur = pTok;
-					pCur->Next = nullptr;
-					//if (EnableDebugData) { putchar('\n'); M.Next->DebugPrintTraverse(nullptr); }
-				}
-				else
-				{
-					pTok->Next = T1;
-					T1->Prev = pTok;
-					pCur = T1;
-				}
-			}
-			Brackets.pop_back();
-		}
-	}
-	if (!Brackets.empty()) { puts("Syntax Error: expected \")\"for a lonely \"(\" qwq. "); FailedToParse = true; return; }
-	
-	// Finalize tree construction
-	pCur->Next = &N;
-	N.Prev = pCur;
-	if constexpr (EnableDebugData) puts("Make End!");
-	Root = CreateTree(M.Next, &N);
-
-	// Check Arguments
-	if (!CheckArgument(Root)) { FailedToParse = true; return; }
-
-	// Apply simplification rules
-	Simplify(Root);
+/**
+ * @brief Computes the derivative of the hyperbolic cosine function
+ * @param Op1 The inner function expression (f in cosh(f))
+ * @param Op2 Unused parameter (interface consistency)
+ * @param DX The variable ID to differentiate against
+ * @return ExprNode* Derivative expression tree: sinh(f) * f'
+ */
+ExprNode* DX_cosh(const ExprNode* Op1, const ExprNode* Op2, int DX)
+{
+	//coshf -> f'*sinhf
+	return DF Mul Sinh(F);
 }
 
 /**
- * @brief Prints the expression tree.
- */
-void Expr::Print() const
+* @brief Computes the derivative of this node with respect to one of its operands.
+*
+* Products have their own rule, every other node reuses its forward rule
+* with the tangent of the chosen operand set to 1 and the other one to 0.
+*
+* @param Side 0 for the left operand, 1 for the right operand.
+* @return ExprNode* The local derivative.
+*/
+ExprNode* ExprNode::PartialOperand(int Side) const
 {
-	if (!DividedbyZero)
-	{
-		if (Root)Root->PrintTree();
-		else printf("NULL");
-		putchar('\n');
-	}
+	auto Op1 = L(), Op2 = R();
+	//d(f*g)/df = g, d(f*g)/dg = f
+	if (V.Ty == Token::Operator && V.ID == '*')return Side ? F : G;
+	PartialMemo.Clear();
+	StorePartial(Op1, PartialKey(Op1, -1), Const(Side == 0));
+	if (Op2)StorePartial(Op2, PartialKey(Op2, -1), Const(Side == 1));
+	return PartialNode(-1);
 }
 
 /**
- * @brief Constructs an Expr by differentiating another Expr.
- * @param F The original expression to differentiate.
- * @param DX The variable ID to differentiate with respect to.
- */
-Expr::Expr(const Expr& F, int DX)
+* @brief Computes the partial derivatives with respect to all variables in one backward sweep.
+*
+* @param Grad Indexed by variable ID, receives the derivative with respect to each variable.
+*/
+void ExprNode::Gradient(std::vector<ExprNode*>& Grad) const
 {
-	DividedbyZero = false;
-	Root = F.Root->Partial(DX);
-	Simplify(Root);
+	//Pre-order: every node has a single parent, so its adjoint
+	//is complete when it is reached
+	WalkStack<std::pair<const ExprNode*, ExprNode*>> S;
+	S.Push({ this, Const(1) });
+	while (!S.Empty())
+	{
+		auto [p, Adj] = S.Pop();
+		if (p->V.Ty == Token::Variable)
+		{
+			auto& D = Grad[p->V.ID];
+			D = D ? (D Add Adj) : Adj;
+		}
+		else if (p->V.Ty == Token::Operator && p->V.ID == '+')
+		{
+			if (p->R()->DepMask)S.Push({ p->R(), Adj });
+			if (p->L()->DepMask)S.Push({ p->L(), Adj });
+		}
+		else if (p->V.Ty == Token::Operator && p->V.ID == '-')
+		{
+			if (p->R()->DepMask)S.Push({ p->R(), Neg(Adj) });
+			if (p->L()->DepMask)S.Push({ p->L(), Adj });
+		}
+		else
+		{
+			//Constant operands receive no adjoint
+			if (p->R() && p->R()->DepMask)S.Push({ p->R(), Adj Mul p->PartialOperand(1) });
+			if (p->L() && p->L()->DepMask)S.Push({ p->L(), Adj Mul p->PartialOperand(0) });
+		}
+	}
 }
 
+// Macro cleanup to prevent namespace pollution
+#undef F  
+#undef DF 
+#undef G 
+#undef DG 
+#undef IsZero
+#undef Neg
+
 //-----------------------------------------------------------------
 //-----------------------------------------------------------------
-//-----------------------NODE MEMORY MANAGER-----------------------
+//--------------------DUAL NUMBER EVALUATION-----------------------
 //-----------------------------------------------------------------
 //-----------------------------------------------------------------
 
+// Dual number arithmetic, (a+a'e) op (b+b'e) dropping e^2
+Dual operator+(Dual A, Dual B) { return { A.V + B.V, A.D + B.D }; }
+Dual operator-(Dual A, Dual B) { return { A.V - B.V, A.D - B.D }; }
+Dual operator*(Dual A, Dual B) { return { A.V * B.V, A.D * B.V + A.V * B.D }; }
+Dual operator/(Dual A, Dual B) { return { A.V / B.V, (A.D * B.V - A.V * B.D) / (B.V * B.V) }; }
+
 /**
- * @brief Releases a node from the expression tree, marking it as unused.
- *
- * @param pNode The node to be released.
+ * @brief Evaluates ln(f) on dual numbers: (ln(f), f'/f)
+ * @param Op1 The argument (f)
+ * @param Op2 Unused parameter (interface consistency)
+ * @return Dual The value and the derivative
  */
-void ReleaseNode(const ExprNode* pNode)
+Dual EV_ln(Dual Op1, Dual Op2)
 {
-	if constexpr (EnableDebugData) { printf("\nReleaseNode:"); if (pNode)pNode->DebugPrint(); else printf("NULL"); }
-	if (pNode)UnusedNode.push_back((ExprNode*)pNode);
+	return { log(Op1.V), Op1.D / Op1.V };
 }
 
 /**
- * @brief Resets a node's state for reuse.
- * @param pNode The node to clear.
- * @return ExprNode* The cleared node.
+ * @brief Evaluates log(b,f)=ln(f)/ln(b) on dual numbers
+ * @param Op1 The base (b)
+ * @param Op2 The argument (f)
+ * @return Dual The value and the derivative
  */
-ExprNode* ClearNode(ExprNode* pNode)
+Dual EV_log(Dual Op1, Dual Op2)
 {
-	pNode->L() = nullptr;
-	pNode->R() = nullptr;
-	pNode->V = Token();
-	pNode->Next = nullptr;
-	pNode->Prev = nullptr;
-	return pNode;
+	return EV_ln(Op2, {}) / EV_ln(Op1, {});
 }
 
 /**
- * @brief Creates a new node for the expression tree.
- *
- * @return ExprNode* A pointer to the newly created node.
+ * @brief Evaluates cos(f) on dual numbers: (cos(f), -f'*sin(f))
+ * @param Op1 The argument (f)
+ * @param Op2 Unused parameter (interface consistency)
+ * @return Dual The value and the derivative
  */
-ExprNode* CreateNode()
+Dual EV_cos(Dual Op1, Dual Op2)
 {
-	if (UnusedNode.empty()) { Nodes.push_back(new ExprNode); return Nodes.back(); }
-	else { auto P = ClearNode(UnusedNode.back()); UnusedNode.pop_back(); return P; }
+	return { cos(Op1.V), -Op1.D * sin(Op1.V) };
 }
 
 /**
- * @brief Creates a node initialized with a token.
- * @param T The token to store in the node.
- * @return ExprNode* The created node.
+ * @brief Evaluates sin(f) on dual numbers: (sin(f), f'*cos(f))
+ * @param Op1 The argument (f)
+ * @param Op2 Unused parameter (interface consistency)
+ * @return Dual The value and the derivative
  */
-ExprNode* CreateNode(Token T)
+Dual EV_sin(Dual Op1, Dual Op2)
 {
-	auto N = CreateNode();
-	N->V = T;
-	return N;
+	return { sin(Op1.V), Op1.D * cos(Op1.V) };
 }
 
 /**
- * @brief Creates a node with operands.
- * @param T The token for the node.
- * @param Op1 Left operand.
- * @param Op2 Right operand.
- * @return ExprNode* The created node.
+ * @brief Evaluates tan(f) on dual numbers: (tan(f), f'/cos(f)^2)
+ * @param Op1 The argument (f)
+ * @param Op2 Unused parameter (interface consistency)
+ * @return Dual The value and the derivative
  */
-ExprNode* CreateNode(Token T, ExprNode* Op1, ExprNode* Op2)
+Dual EV_tan(Dual Op1, Dual Op2)
 {
-	auto N = CreateNode();
-	N->V = T;
-	N->L() = Op1;
-	N->R() = Op2;
-	return N;
+	double C = cos(Op1.V);
+	return { tan(Op1.V), Op1.D / (C * C) };
 }
 
 /**
- * @brief Recursively releases an entire subtree.
- * @param pRoot Root of the subtree to release.
+ * @brief Evaluates f^g on dual numbers
+ * @param Op1 The base (f)
+ * @param Op2 The exponent (g)
+ * @return Dual The value and the derivative
+ *
+ * A constant exponent uses g*f^(g-1)*f', so negative bases work for it.
  */
-void ReleaseTree(const ExprNode* pRoot)
+Dual EV_pow(Dual Op1, Dual Op2)
 {
-	if (pRoot)
-	{
-		ReleaseTree(pRoot->L());
-		ReleaseTree(pRoot->R());
-		ReleaseNode(pRoot);
-	}
+	double P = pow(Op1.V, Op2.V);
+	if (Op2.D == 0)return { P, Op2.V * pow(Op1.V, Op2.V - 1) * Op1.D };
+	//f^g=exp(g*lnf)
+	return { P, P * (Op2.D * log(Op1.V) + Op2.V * Op1.D / Op1.V) };
 }
 
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
-//---------------------TREE GENERATION HELPERS---------------------
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
-
-bool Token::IsPOW() const { return (Ty == Operator && ID == '^') || (Ty == Function && ID == FUNC_pow); }
-
 /**
- * @brief Helper structure for function token generation and tree construction.
- * @tparam T The token type to handle (functions/operators)
+ * @brief Evaluates exp(f) on dual numbers: (exp(f), f'*exp(f))
+ * @param Op1 The argument (f)
+ * @param Op2 Unused parameter (interface consistency)
+ * @return Dual The value and the derivative
  */
-struct NodeCalcHelper
-{
-	Token T;
-	const ExprNode* Op1;
-};
-NodeCalcHelper operator<(const ExprNode* Op1, Token R)
+Dual EV_exp(Dual Op1, Dual Op2)
 {
-	return NodeCalcHelper{ R, Op1 };
+	double E = exp(Op1.V);
+	return { E, Op1.D * E };
 }
-ExprNode* operator>(const NodeCalcHelper& L, ExprNode* Op2)
+
+/**
+ * @brief Evaluates sinh(f) on dual numbers: (sinh(f), f'*cosh(f))
+ * @param Op1 The argument (f)
+ * @param Op2 Unused parameter (interface consistency)
+ * @return Dual The value and the derivative
+ */
+Dual EV_sinh(Dual Op1, Dual Op2)
 {
-	return CreateNode(L.T, (ExprNode*)L.Op1, Op2);
+	return { sinh(Op1.V), Op1.D * cosh(Op1.V) };
 }
-struct FuncTokenHelper
-{
-	Token T;///< Stores the function/operator token
-
-	/**
-	 * @brief Returns the stored token
-	 * @return const Token& Reference to the stored token
-	 */
-	const Token& operator()()const { return T; }
-
-	/**
-	 * @brief Creates a function node with single operand
-	 * @param Op1 The operand node
-	 * @return ExprNode* New function node
-	 */
-	ExprNode* operator()(const ExprNode* Op1)
-	{
-		return CreateNode(T, (ExprNode*)Op1, nullptr);
-	}
-
-	/**
-	* @brief Creates a function node with two operands
-	* @param Op1 First operand node
-	* @param Op2 Second operand node
-	* @return ExprNode* New function node
-	*/
-	ExprNode* operator()(const ExprNode* Op1, const ExprNode* Op2)
-	{
-		return CreateNode(T, (ExprNode*)Op1, (ExprNode*)Op2);
-	}
-};
-
-// Global operator token definitions
-// -purpose: Represents addition operator
-Token ADD{ '+' };  
-// -purpose: Represents subtraction operator
-Token SUB{ '-' };  
-// -purpose: Represents multiplication operator
-Token MUL{ '*' };  
-// -purpose: Represents division operator
-Token DIV{ '/' };  
-// -purpose: Represents power operator
-Token POW{ '^' };  
-
-
-// Macro helpers for operator token construction
-// Helper for addition operator token
-#define Add <ADD>  
-// Helper for subtraction operator token
-#define Sub <SUB>  
-// Helper for multiplication operator token
-#define Mul <MUL>  
- // Helper for division operator token
-#define Div <DIV> 
-// Helper for power operator token
-#define Pwr <POW>  
-
-// Function token helpers initialization
-FuncTokenHelper Ln{ Token{FUNC_ln, AsFuncID{}} };
-FuncTokenHelper Log{ Token{FUNC_log, AsFuncID{}} };
-FuncTokenHelper Sin{ Token{FUNC_sin, AsFuncID{}} };
-FuncTokenHelper Cos{ Token{FUNC_cos, AsFuncID{}} };
-FuncTokenHelper Tan{ Token{FUNC_tan, AsFuncID{}} };
-FuncTokenHelper Pow{ Token{FUNC_pow, AsFuncID{}} };
-FuncTokenHelper Exp{ Token{FUNC_exp, AsFuncID{}} };
-FuncTokenHelper Sinh{ Token{FUNC_sinh, AsFuncID{}} };
-FuncTokenHelper Cosh{ Token{FUNC_cosh, AsFuncID{}} };
-
-// Constant node creation macro
-// -purpose: Shortcut for creating integer constant nodes
-#define Const(x) CreateNode(Token(int(x)))
 
 /**
- * @brief Represents a rational number with simplification capabilities
+ * @brief Evaluates cosh(f) on dual numbers: (cosh(f), f'*sinh(f))
+ * @param Op1 The argument (f)
+ * @param Op2 Unused parameter (interface consistency)
+ * @return Dual The value and the derivative
  */
-struct Fraction
+Dual EV_cosh(Dual Op1, Dual Op2)
 {
-	int N, D;//Numerator, Denominator
-
-	/**
-	 * @brief Constructs a fraction with automatic simplification
-	 * @param N Numerator
-	 * @param D Denominator
-	 */
-	Fraction(int N, int D) : N(N), D(D) { Simplify(); }
-
-	/**
-	 * @brief Constructs whole number fraction
-	 * @param N Integer value
-	 */
-	Fraction(int N) : N(N), D(1) {}
+	return { cosh(Op1.V), Op1.D * sinh(Op1.V) };
+}
 
-	/**
-	 * @brief Simplifies fraction using GCD
-	 */
-	void Simplify()
+/**
+* @brief Evaluates the subtree on dual numbers in one post-order walk.
+*
+* @param Values Indexed by variable ID, the values and directions of the variables.
+* @return Dual The value and the directional derivative of the subtree.
+*/
+Dual ExprNode::Evaluate(const std::vector<Dual>& Values) const
+{
+	//Post-order evaluation, the values of the operands are on the value stack
+	WalkStack<std::pair<const ExprNode*, bool>> S;
+	WalkStack<Dual> Results;
+	S.Push({ this, false });
+	while (!S.Empty())
 	{
-		if (!D)// Handle division by zero
+		auto& [pNode, Expanded] = S.Top();
+		auto p = pNode;
+		if (!Expanded && p->L())
 		{
-			if(!DividedbyZero)puts("Runtime Error: Divided by 0");
-			DividedbyZero = true;
-			return;
+			Expanded = true;
+			if (p->R())S.Push({ p->R(), false });
+			S.Push({ p->L(), false });
+			continue;
 		}
-		if (!N)D = 1;// Zero case
-		else
+		S.Pop();
+		switch (p->V.Ty)
 		{
-			int G = std::gcd(N, D);// C++17 cross-platform GCD
-			N /= G;
-			D /= G;
+		case Token::Int: Results.Push({ (double)p->V.ID, 0 }); break;
+		case Token::Big: Results.Push({ BigLiterals.Values[p->V.ID].ToDouble(), 0 }); break;
+		case Token::Variable: Results.Push(Values[p->V.ID]); break;
+		case Token::Function:
+		{
+			Dual B{};
+			if (p->R())B = Results.Pop();
+			auto A = Results.Pop();
+			Results.Push(Funcs[p->V.ID].Eval(A, B));
+		}break;
+		default:
+		{
+			auto B = Results.Pop(), A = Results.Pop();
+			switch (p->V.ID)
+			{
+			case '+':Results.Push(A + B); break;
+			case '-':Results.Push(A - B); break;
+			case '*':Results.Push(A * B); break;
+			case '/':Results.Push(A / B); break;
+			default:Results.Push(EV_pow(A, B)); break;
+			}
+		}break;
 		}
 	}
+	return Results.Pop();
+}
 
-	// Arithmetic operators overloaded for fraction handling
-	Fraction operator+(const Fraction& R) const
-	{
-		return Fraction(N * R.D + R.N * D, D * R.D);
-	}
-	Fraction operator-(const Fraction& R) const
-	{
-		return Fraction(N * R.D - R.N * D, D * R.D);
-	}
-	Fraction operator*(const Fraction& R) const
-	{
-		return Fraction(N * R.N, D * R.D);
-	}
-	Fraction operator/(const Fraction& R) const
-	{
-		return Fraction(N * R.D, D * R.N);
-	}
-	Fraction operator^(const Fraction& R) const
-	{
-		return Fraction((int)pow(N, ((double)R.N) / R.D), (int)pow(D, ((double)R.N) / R.D));
-	}
-	Fraction& operator+=(const Fraction& R)
-	{
-		*this = *this + R;
-		return *this;
-	}
-	Fraction& operator-=(const Fraction& R)
-	{
-		*this = *this - R;
-		return *this;
-	}
-	Fraction& operator*=(const Fraction& R)
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+//-------------------------GRADIENT TAPE---------------------------
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+
+/**
+ * @brief A linear tape (Wengert list) of the primitive operations of an expression.
+ *
+ * Compile() flattens the tree once in post-order, so every entry refers to its
+ * operands by smaller indices. Forward() fills the value of every entry at a point,
+ * and Reverse() then sweeps the tape backwards accumulating the adjoints, which
+ * gives the whole gradient for a small constant multiple of one evaluation.
+ * The buffers are sized in Compile(), so evaluating at a new point does not allocate.
+ */
+class Tape
+{
+	struct Entry
 	{
-		*this = *this * R;
-		return *this;
-	}
-	Fraction& operator/=(const Fraction& R)
+		///< The primitive operation, a constant, a variable, a function or an operator.
+		Token V;
+		///< The indices of the operands, -1 if absent.
+		int A, B;
+		///< Whether the entry depends on any variable; only those receive adjoints.
+		bool Active;
+	};
+	std::vector<Entry> Entries;
+	///< The values of the entries from the last Forward().
+	std::vector<double> Val;
+	///< The adjoints of the entries during Reverse().
+	std::vector<double> Adj;
+public:
+	/**
+	 * @brief Flattens the tree rooted at pRoot into the tape.
+	 * @param pRoot The root of the expression tree.
+	 */
+	void Compile(const ExprNode* pRoot)
 	{
-		*this = *this / R;
-		return *this;
+		Entries.clear();
+		WalkStack<std::pair<const ExprNode*, bool>> S;
+		WalkStack<int> Indices;
+		S.Push({ pRoot, false });
+		while (!S.Empty())
+		{
+			auto& [pNode, Expanded] = S.Top();
+			auto p = pNode;
+			if (!Expanded && p->L())
+			{
+				Expanded = true;
+				if (p->R())S.Push({ p->R(), false });
+				S.Push({ p->L(), false });
+				continue;
+			}
+			S.Pop();
+			Entry E{ p->V, -1, -1, p->V.Ty == Token::Variable };
+			if (p->R()) { E.B = Indices.Pop(); E.Active = Entries[E.B].Active; }
+			if (p->L()) { E.A = Indices.Pop(); E.Active |= Entries[E.A].Active; }
+			Indices.Push((int)Entries.size());
+			Entries.push_back(E);
+		}
+		Val.assign(Entries.size(), 0);
+		Adj.assign(Entries.size(), 0);
 	}
-	bool operator==(const Fraction& R) const { return N == R.N && D == R.D; }
-	bool operator==(int R) const { return N == R && D == 1; }
 
 	/**
-	 * @brief Converts fraction to expression tree node
-	 * @return ExprNode* Tree representation (n/d or integer if d=1)
+	 * @brief The forward sweep, records the value of every entry.
+	 * @param X Indexed by variable ID, the point to evaluate at.
+	 * @return double The value of the expression.
 	 */
-	ExprNode* ToNode() const { return D == 1 ? Const(N) : (Const(N) Div Const(D)); }
-};
-
-/**
- * @brief Extracts greatest common divisor from a range of fractions
- * @tparam It Iterator type
- * @tparam Se Sentinel type
- * @param Begin Start iterator
- * @param End End iterator
- * @return Fraction The GCD of all fractions in range
- */
-template<typename It, typename Se>
-Fraction ExtractGCD(It Begin, Se End)
-{
-	int N0 = Begin->N, D0 = Begin->D;
-	for (auto p = Begin; p != End; ++p)
+	double Forward(const std::vector<double>& X)
 	{
-		N0 = std::gcd(N0, p->N); // Numerator GCD
-		D0 = std::lcm(D0, p->D); // Denominator LCM
+		for (size_t i = 0; i < Entries.size(); i++)
+		{
+			auto& E = Entries[i];
+			double Va = E.A >= 0 ? Val[E.A] : 0, Vb = E.B >= 0 ? Val[E.B] : 0;
+			switch (E.V.Ty)
+			{
+			case Token::Int: Val[i] = E.V.ID; break;
+			case Token::Big: Val[i] = BigLiterals.Values[E.V.ID].ToDouble(); break;
+			case Token::Variable: Val[i] = X[E.V.ID]; break;
+			case Token::Function: Val[i] = Funcs[E.V.ID].Eval({ Va, 0 }, { Vb, 0 }).V; break;
+			default:
+				switch (E.V.ID)
+				{
+				case '+':Val[i] = Va + Vb; break;
+				case '-':Val[i] = Va - Vb; break;
+				case '*':Val[i] = Va * Vb; break;
+				case '/':Val[i] = Va / Vb; break;
+				default:Val[i] = pow(Va, Vb); break;
+				}
+				break;
+			}
+		}
+		return Val.back();
 	}
-	return Fraction(std::abs(N0), std::abs(D0));
-}
 
-/**
- * @brief Extracts GCD between two fractions
- * @param F1 First fraction
- * @param F2 Second fraction
- * @return Fraction The GCD fraction
- */
-Fraction ExtractGCD(Fraction F1, Fraction F2)
-{
-	if (F1 == 0 || F2 == 0)return Fraction(0);
-	return Fraction(std::gcd(F1.N, F2.N), std::lcm(F1.D, F2.D));
-}
+	/**
+	 * @brief The reverse sweep, accumulates the adjoints of the last Forward().
+	 * @param Grad Indexed by variable ID and sized by the caller, receives the gradient.
+	 */
+	void Reverse(std::vector<double>& Grad)
+	{
+		std::fill(Grad.begin(), Grad.end(), 0.0);
+		std::fill(Adj.begin(), Adj.end(), 0.0);
+		Adj.back() = 1;
+		for (size_t i = Entries.size(); i-- > 0;)
+		{
+			auto& E = Entries[i];
+			double a = Adj[i];
+			if (!E.Active || a == 0)continue;
+			double Va = E.A >= 0 ? Val[E.A] : 0, Vb = E.B >= 0 ? Val[E.B] : 0;
+			double Da = 0, Db = 0;//local partials by the operands
+			switch (E.V.Ty)
+			{
+			case Token::Int: break;
+			case Token::Big: break;
+			case Token::Variable: Grad[E.V.ID] += a; break;
+			case Token::Function:
+				Da = Funcs[E.V.ID].Eval({ Va, 1 }, { Vb, 0 }).D;
+				if (E.B >= 0 && Entries[E.B].Active)Db = Funcs[E.V.ID].Eval({ Va, 0 }, { Vb, 1 }).D;
+				break;
+			default:
+				switch (E.V.ID)
+				{
+				case '+':Da = 1; Db = 1; break;
+				case '-':Da = 1; Db = -1; break;
+				case '*':Da = Vb; Db = Va; break;
+				case '/':Da = 1 / Vb; Db = -Val[i] / Vb; break;
+				default:
+					//same rule as EV_pow, the log term only for a variable exponent
+					Da = Vb * pow(Va, Vb - 1);
+					if (Entries[E.B].Active)Db = Val[i] * log(Va);
+					break;
+				}
+				break;
+			}
+			if (E.A >= 0 && Entries[E.A].Active)Adj[E.A] += a * Da;
+			if (E.B >= 0 && Entries[E.B].Active)Adj[E.B] += a * Db;
+		}
+	}
+};
 
 //-----------------------------------------------------------------
 //-----------------------------------------------------------------
-//----------------------TREE TRAVERSE HELPERS----------------------
+//--------------------TAYLOR SERIES EVALUATION---------------------
 //-----------------------------------------------------------------
 //-----------------------------------------------------------------
 
-/*
-- Purpose: Temporarily stores nodes during tree traversal operations.
-- Usage: Various simplification and manipulation functions use this
-		 vector to collect nodes of specific types or properties
-		 for further processing.
-*/
-std::vector<ExprNode*> TraverseSeries;
+// Truncated power series a_0+a_1*t+...+a_K*t^K are stored as K+1 coefficients.
+// Every rule below comes from the ODE its function satisfies and takes O(K^2).
+// Res never aliases the operands.
 
 /**
- * @brief Recursive implementation for collecting tree nodes matching required parent type
- * @param Series[out] Vector to store collected nodes
- * @param pNode Current node being processed
- * @param RequiredParentType Token type that parent nodes must match for collection
+ * @brief Multiplies two series: c_j=sum a_i*b_(j-i)
+ * @param A The first factor
+ * @param B The second factor
+ * @param C The product
+ * @param K The highest order
  */
-void TraverseTreeNodes_Impl(std::vector<ExprNode*>& Series, const ExprNode* pNode, Token RequiredParentType)
+void TS_Mul(const double* A, const double* B, double* C, int K)
 {
-	if (!pNode)return;
-
-	// Match parent type condition
-	if (pNode->V == RequiredParentType)
+	for (int j = 0; j <= K; j++)
 	{
-		// Recursively process children for additive/multiplicative nodes
-		if (pNode->HasOp0())TraverseTreeNodes_Impl(Series, pNode->L(), RequiredParentType);
-		if (pNode->HasOp1())TraverseTreeNodes_Impl(Series, pNode->R(), RequiredParentType);
+		C[j] = 0;
+		for (int i = 0; i <= j; i++)C[j] += A[i] * B[j - i];
 	}
-	// Collect non-parent-type nodes
-	else Series.push_back((ExprNode*)pNode);
 }
 
 /**
- * @brief Initializes traversal of tree nodes with specified parent type
- * @param Series[out] Vector to store collected nodes
- * @param pNode Root node of the subtree to traverse
- * @param RequiredParentType Token type that parent nodes must match
+ * @brief Divides two series, from A=B*C: c_j=(a_j-sum b_i*c_(j-i))/b_0
+ * @param A The dividend
+ * @param B The divisor
+ * @param C The quotient
+ * @param K The highest order
  */
-void TraverseTreeNodes(std::vector<ExprNode*>& Series, const ExprNode* pNode, Token RequiredParentType)
+void TS_Div(const double* A, const double* B, double* C, int K)
 {
-	Series.clear();
-	TraverseTreeNodes_Impl(Series, pNode, RequiredParentType);
+	for (int j = 0; j <= K; j++)
+	{
+		C[j] = A[j];
+		for (int i = 1; i <= j; i++)C[j] -= B[i] * C[j - i];
+		C[j] /= B[0];
+	}
 }
 
 /**
- * @brief Recursive implementation for counting tree nodes matching parent type
- * @param Result[out] Counter for matching nodes
- * @param pNode Current node being processed
- * @param RequiredParentType Token type that parent nodes must match
+ * @brief Evaluates ln(f), from f*c'=f'
+ * @param Op1 The argument (f)
+ * @param Op2 Unused parameter (interface consistency)
+ * @param Res The result
+ * @param K The highest order
  */
-void TraverseCountTreeNodes_Impl(int& Result, const ExprNode* pNode, Token RequiredParentType)
+void TS_ln(const double* Op1, const double* Op2, double* Res, int K)
 {
-	if (!pNode)return;
-
-	// Match parent type condition
-	if (pNode->V == RequiredParentType)
+	Res[0] = log(Op1[0]);
+	for (int j = 1; j <= K; j++)
 	{
-		// Recursively count children for additive/multiplicative nodes
-		if (pNode->HasOp0())TraverseCountTreeNodes_Impl(Result, pNode->L(), RequiredParentType);
-		if (pNode->HasOp1())TraverseCountTreeNodes_Impl(Result, pNode->R(), RequiredParentType);
+		double S = 0;
+		for (int i = 1; i < j; i++)S += i * Res[i] * Op1[j - i];
+		Res[j] = (Op1[j] - S / j) / Op1[0];
 	}
-	// Increment counter for non-parent-type nodes
-	else ++Result;
 }
 
 /**
- * @brief Counts nodes matching specified parent type in subtree
- * @param pNode Root node of the subtree to count
- * @param RequiredParentType Token type that parent nodes must match
- * @return int Total count of matching nodes
+ * @brief Evaluates log(b,f)=ln(f)/ln(b)
+ * @param Op1 The base (b)
+ * @param Op2 The argument (f)
+ * @param Res The result
+ * @param K The highest order
  */
-int TraverseCountTreeNodes(const ExprNode* pNode, Token RequiredParentType)
+void TS_log(const double* Op1, const double* Op2, double* Res, int K)
 {
-	int Result = 0;
-	TraverseCountTreeNodes_Impl(Result, pNode, RequiredParentType);
-	return Result;
+	ScratchList<double> T;
+	for (int j = 0; j <= 2 * K + 1; j++)T.push_back(0);
+	TS_ln(Op2, nullptr, T.begin(), K);
+	TS_ln(Op1, nullptr, T.begin() + K + 1, K);
+	TS_Div(T.begin(), T.begin() + K + 1, Res, K);
 }
 
-// Macro for type-based tree traversal
-// -purpose: Simplifies traversal code for specific node types
-// -usage: Expands to traversal loop using global TraverseSeries vector
-#define TraverseType(Node, Ty, Idx) \
-TraverseTreeNodes(TraverseSeries, Node, Ty);\
-ExprNode* Idx{TraverseSeries[0]};\
-for(size_t _I=0;_I<TraverseSeries.size();Idx=TraverseSeries[++_I])
-
-// Macro for local type-based traversal
-// -purpose: Enables type-specific traversal with local storage
-// -usage: Creates local vector and loop for traversal context
-#define TraverseTypeLocal(Cont, Node, Ty, Idx) \
-std::vector<ExprNode*> Cont;\
-TraverseTreeNodes(Cont, Node, Ty);\
-ExprNode* Idx{Cont[0]};for(size_t _I=0;_I<Cont.size();Idx=Cont[++_I])
-
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
-//-------------------------NODE OPERATIONS-------------------------
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
-
 /**
-* @brief Computes the hash value of this node.
-*
-* @return ExprHash The hash value of the node.
-*/
-ExprHash ExprNode::Hash() const
+ * @brief Evaluates sin(f) and cos(f) together, from s'=f'*c and c'=-f'*s
+ * @param A The argument (f)
+ * @param S The sine
+ * @param C The cosine
+ * @param K The highest order
+ */
+void TS_SinCos(const double* A, double* S, double* C, int K)
 {
-	//Considering exchangeable + and * and commutative property
-	if (V == ADD || V == MUL)
-	{
-		ExprHash H = V.Hash();
-		TraverseTypeLocal(C, this, V, p)
-			H += p ? TransformHash(p->Hash()) : 0;
-		if (EnableDebugData) { printf("Size=%zu Hash()=%016llX Tree: ",TraverseSeries.size(), H), PrintTree(); putchar('\n'); }
-		return H;
-	}
-	else
+	S[0] = sin(A[0]);
+	C[0] = cos(A[0]);
+	for (int j = 1; j <= K; j++)
 	{
-		auto H= V.Hash()
-			+ (L() ? TransformHash(L()->Hash()) : 0)
-			+ (R() ? TransformHash(R()->Hash()) : 0);
-		if (EnableDebugSimplifyII) { printf("Hash()=%016llX Tree: ", H); PrintTree(); putchar('\n'); }
-		return H;
+		S[j] = C[j] = 0;
+		for (int i = 1; i <= j; i++)
+		{
+			S[j] += i * A[i] * C[j - i];
+			C[j] -= i * A[i] * S[j - i];
+		}
+		S[j] /= j;
+		C[j] /= j;
 	}
 }
 
 /**
-* @brief Checks if this node represents a squared term.
-*
-* @return bool True if the node is a squared term, false otherwise.
-*/
-bool ExprNode::IsSquare() const
-{
-	return V.IsPOW() && V1() == Token((int)2);
-}
-
-/**
-* @brief Checks if this node represents a constant value.
-*
-* @return bool True if the node is a constant, false otherwise.
-*/
-bool ExprNode::IsConst() const
+ * @brief Evaluates cos(f)
+ * @param Op1 The argument (f)
+ * @param Op2 Unused parameter (interface consistency)
+ * @param Res The result
+ * @param K The highest order
+ */
+void TS_cos(const double* Op1, const double* Op2, double* Res, int K)
 {
-	if (V.Ty == Token::Int)return true;
-	else if (V.Ty == Token::Variable)return false;
-	else if (V.Ty == Token::Function)return false;
-	else return (L() ? L()->IsConst() : true) && (R() ? R()->IsConst() : true);
+	ScratchList<double> S;
+	for (int j = 0; j <= K; j++)S.push_back(0);
+	TS_SinCos(Op1, S.begin(), Res, K);
 }
 
 /**
-* @brief Checks if this node represents a constant value excluding radicals.
-*
-* @return bool True if the node is a constant in the specified form, false otherwise.
-*/
-bool ExprNode::IsConstII() const
+ * @brief Evaluates sin(f)
+ * @param Op1 The argument (f)
+ * @param Op2 Unused parameter (interface consistency)
+ * @param Res The result
+ * @param K The highest order
+ */
+void TS_sin(const double* Op1, const double* Op2, double* Res, int K)
 {
-	if (V.Ty == Token::Int)return true;
-	else if (V.Ty == Token::Variable)return false;
-	else if (V.Ty == Token::Function)return false;
-	else if (V.ID == '^')return false;
-	else return (L() ? L()->IsConstII() : true) && (R() ? R()->IsConstII() : true);
+	ScratchList<double> C;
+	for (int j = 0; j <= K; j++)C.push_back(0);
+	TS_SinCos(Op1, Res, C.begin(), K);
 }
 
 /**
-* @brief Returns the operator precedence level of this node.
-*
-* @param ConsiderUsedNode Whether to consider if the node is already used.
-* @return int The precedence level of the operator.
-*/
-int ExprNode::OprLevel(bool ConsiderUsedNode) const
+ * @brief Evaluates tan(f), from t'=f'*q and q=1+t^2
+ * @param Op1 The argument (f)
+ * @param Op2 Unused parameter (interface consistency)
+ * @param Res The result
+ * @param K The highest order
+ */
+void TS_tan(const double* Op1, const double* Op2, double* Res, int K)
 {
-	if (V.Ty == Token::Operator)
+	ScratchList<double> Q;
+	Res[0] = tan(Op1[0]);
+	Q.push_back(1 + Res[0] * Res[0]);
+	for (int j = 1; j <= K; j++)
 	{
-		if (L() && !ConsiderUsedNode)return 0;
-		else if (V.ID == '+' || V.ID == '-')return 1;
-		else if (V.ID == '*' || V.ID == '/')return 2;
-		else if (V.ID == '^')return 3;
-		else return 114514;//never occur
+		Res[j] = 0;
+		for (int i = 1; i <= j; i++)Res[j] += i * Op1[i] * Q[j - i];
+		Res[j] /= j;
+		double S = 0;
+		for (int i = 0; i <= j; i++)S += Res[i] * Res[j - i];
+		Q.push_back(S);
 	}
-	else return 0;
 }
 
 /**
-* @brief Prints the node's information for debugging purposes.
-*/
-void ExprNode::DebugPrint() const
+ * @brief Evaluates exp(f), from c'=f'*c
+ * @param Op1 The argument (f)
+ * @param Op2 Unused parameter (interface consistency)
+ * @param Res The result
+ * @param K The highest order
+ */
+void TS_exp(const double* Op1, const double* Op2, double* Res, int K)
 {
-	/*Token V;
-	ExprNode* Prev, *Next;
-	ExprNode* Operand[2];*/
-	if (V.Ty == Token::Function || V.Ty == Token::Operator)
+	Res[0] = exp(Op1[0]);
+	for (int j = 1; j <= K; j++)
 	{
-		printf("<%04X>%s:{", unsigned(((size_t)this) % 0xFFFF), V.GetText());
-		if (L())L()->DebugPrint();
-		printf("}{");
-		if (R())R()->DebugPrint();
-		printf("}");
+		Res[j] = 0;
+		for (int i = 1; i <= j; i++)Res[j] += i * Op1[i] * Res[j - i];
+		Res[j] /= j;
 	}
-	else printf("<%04X>%s", unsigned(((size_t)this) % 0xFFFF), V.GetText());
 }
 
 /**
-* @brief Prints the subtree rooted at this node in a tree-like structure.
-*
-* @param Parent The parent node of this node.
-* @param PrintedCount A counter for the number of nodes printed.
-* @param IsLeft Indicates if this node is the left child of its parent.
-*/
-void ExprNode::PrintTree(const ExprNode* Parent, int& PrintedCount, bool IsLeft) const
+ * @brief Evaluates f^g
+ * @param Op1 The base (f)
+ * @param Op2 The exponent (g)
+ * @param Res The result
+ * @param K The highest order
+ *
+ * A constant exponent p uses f*c'=p*f'*c, so negative bases work for it,
+ * and a natural p at a zero base is expanded by repeated multiplication.
+ * Otherwise f^g=exp(g*lnf).
+ */
+void TS_pow(const double* Op1, const double* Op2, double* Res, int K)
 {
-	int tpc = PrintedCount;
-	switch (V.Ty)
-	{
-	case Token::Int:
-		if (V.ID >= 0 || !Parent)printf("%d", V.ID);
-		else printf("(%d)", V.ID);
-		break;
-	case Token::Variable:
-		printf("%s", V.GetText()); break;
-	case Token::Operator:
+	bool ConstExp = std::all_of(Op2 + 1, Op2 + K + 1, [](double b) {return b == 0; });
+	double P = Op2[0];
+	if (ConstExp && Op1[0] != 0)
 	{
-		bool NeedsBracket;
-		bool Neg = V.ID == '*' && V0() == Token((int)-1);
-		if (Parent && Parent->V.Ty == Token::Operator)
-		{
-			int PL = Parent->OprLevel(true);
-			int ML = OprLevel(true);
-			NeedsBracket = (PL > ML || (PL == ML && PL &&
-				((Parent->V.ID == '-' && !IsLeft) || (Parent->V.ID == '/' && !IsLeft) || (Parent->V.ID == '^' && IsLeft))));
-		}
-		else NeedsBracket = false;
-		NeedsBracket = !(Neg && !tpc) && (NeedsBracket || (Parent && Neg));
-		if (NeedsBracket)putchar('(');
-		//-1*x -> -x
-		if (Neg)putchar('-');
-		else
+		Res[0] = pow(Op1[0], P);
+		for (int j = 1; j <= K; j++)
 		{
-			L()->PrintTree(this, PrintedCount, true);
-			if (!(V.ID == '*' && Ty0() == Token::Int && Ty1() != Token::Int))putchar(V.ID);
+			Res[j] = 0;
+			for (int i = 1; i <= j; i++)Res[j] += (P * i - (j - i)) * Op1[i] * Res[j - i];
+			Res[j] /= j * Op1[0];
 		}
-		R()->PrintTree(this, PrintedCount, false);
-		if (NeedsBracket)putchar(')');
-		break;
+		return;
 	}
-	case Token::Function:
-		printf("%s(", V.GetText());
-		L()->PrintTree(this, PrintedCount, true);
-		if (Funcs[V.ID].NParam == 2)
+	ScratchList<double> T;
+	for (int j = 0; j <= 2 * K + 1; j++)T.push_back(0);
+	if (ConstExp && P >= 0 && P == floor(P) && P <= 64)
+	{
+		std::fill(Res, Res + K + 1, 0.0);
+		Res[0] = 1;
+		for (int n = 0; n < (int)P; n++)
 		{
-			putchar(',');
-			R()->PrintTree(this, PrintedCount, false);
+			TS_Mul(Res, Op1, T.begin(), K);
+			std::copy(T.begin(), T.begin() + K + 1, Res);
 		}
-		putchar(')');
-		break;
-	}
-	++PrintedCount;
-}
-void ExprNode::DebugPrintTraverse(const ExprNode* End) const
-{
-	for (auto V = this; V != End; V = V->Next)
-	{
-		V->DebugPrint();
-		putchar('\n');
-	}
-}
-
-/**
-* @brief Creates a copy of this node.(Only Token & Operand)
-*
-* @return ExprNode* A duplicate of this node.
-*/
-ExprNode* ExprNode::Duplicate() const
-{
-	auto N = CreateNode();
-	N->V = V;
-	if (L())N->L() = L()->Duplicate();
-	if (R())N->R() = R()->Duplicate();
-	return N;
-}
-
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
-//-----------------------PARTIAL DERIVATIVE------------------------
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
-
-/**
-* @brief Computes the partial derivative of this node with respect to a variable.
-*
-* @param DX The ID of the variable with respect to which to differentiate.
-* @return ExprNode* The resulting node after differentiation.
-*/
-ExprNode* ExprNode::Partial(int DX) const
-{
-	switch (V.Ty)
-	{
-		// Derivative of constant is 0
-	case Token::Int: return Const(0);
-		// dx/dx=1, dy/dx=0
-	case Token::Variable: return V.ID == DX ? Const(1) : Const(0);
-		// Handle operator nodes
-	case Token::Operator: return PartialOpr(DX);
-		// Use function-specific rules
-	case Token::Function: return Funcs[V.ID].Derivative(L(), R(), DX);
-		// Fallback for undefined types
-	default:return Const(0);
+		return;
 	}
+	TS_ln(Op1, nullptr, T.begin(), K);
+	TS_Mul(Op2, T.begin(), T.begin() + K + 1, K);
+	TS_exp(T.begin() + K + 1, nullptr, Res, K);
 }
 
 /**
-* @brief Computes the partial derivative for operator nodes.
-*
-* @param DX The ID of the variable with respect to which to differentiate.
-* @return ExprNode* The resulting node after differentiation.
-*/
-ExprNode* ExprNode::PartialOpr(int DX) const
+ * @brief Evaluates sinh(f) and cosh(f) together, from s'=f'*c and c'=f'*s
+ * @param A The argument (f)
+ * @param S The hyperbolic sine
+ * @param C The hyperbolic cosine
+ * @param K The highest order
+ */
+void TS_SinhCosh(const double* A, double* S, double* C, int K)
 {
-	switch (V.ID)
+	S[0] = sinh(A[0]);
+	C[0] = cosh(A[0]);
+	for (int j = 1; j <= K; j++)
 	{
-		// d(f+g)/dx = f' + g'
-	case '+':return DX_add(L(), R(), DX);
-		// d(f-g)/dx = f' - g'
-	case '-':return DX_sub(L(), R(), DX);
-		// d(f*g)/dx = f'*g + f*g'
-	case '*':return DX_mul(L(), R(), DX);
-		// d(f/g)/dx = (f'g - fg')/g
-	case '/':return DX_div(L(), R(), DX);
-	case '^':return DX_pow(L(), R(), DX);
-	default: 
-		// Safety fallback
-		("Fatal Error: Unknown Operator %c", V.ID); 
-		return Duplicate();//How could this happen?
+		S[j] = C[j] = 0;
+		for (int i = 1; i <= j; i++)
+		{
+			S[j] += i * A[i] * C[j - i];
+			C[j] += i * A[i] * S[j - i];
+		}
+		S[j] /= j;
+		C[j] /= j;
 	}
 }
 
-// Derivative rule macros (avoid code duplication)
-// -purpose: Clone left operand
-#define F  (Op1->Duplicate())
-// -purpose: Derivative of left operand
-#define DF (Op1->Partial(DX))
-// -purpose: Clone right operand
-#define G  (Op2->Duplicate())
-// -purpose: Derivative of right operand
-#define DG (Op2->Partial(DX))
-
 /**
- * @brief Derivative rule for addition: d(f+g)/dx = df/dx + dg/dx
- * 
- * @param Op1 Left operand expression (f)
- * @param Op2 Right operand expression (g)
- * @param DX Target variable ID
- * @return ExprNode* Resulting derivative tree
+ * @brief Evaluates sinh(f)
+ * @param Op1 The argument (f)
+ * @param Op2 Unused parameter (interface consistency)
+ * @param Res The result
+ * @param K The highest order
  */
-ExprNode* DX_add(const ExprNode* Op1, const ExprNode* Op2, int DX)
+void TS_sinh(const double* Op1, const double* Op2, double* Res, int K)
 {
-	//f+g -> f'+g'
-	return DF Add DG;
+	ScratchList<double> C;
+	for (int j = 0; j <= K; j++)C.push_back(0);
+	TS_SinhCosh(Op1, Res, C.begin(), K);
 }
 
 /**
- * @brief Derivative rule for subtraction: d(f-g)/dx = df/dx - dg/dx
- * @param Op1 Left operand expression (f)
- * @param Op2 Right operand expression (g)
- * @param DX Target variable ID
- * @return ExprNode* Resulting derivative tree
+ * @brief Evaluates cosh(f)
+ * @param Op1 The argument (f)
+ * @param Op2 Unused parameter (interface consistency)
+ * @param Res The result
+ * @param K The highest order
  */
-ExprNode* DX_sub(const ExprNode* Op1, const ExprNode* Op2, int DX)
+void TS_cosh(const double* Op1, const double* Op2, double* Res, int K)
 {
-	//f-g -> f'-g'
-	return DF Sub DG;
+	ScratchList<double> S;
+	for (int j = 0; j <= K; j++)S.push_back(0);
+	TS_SinhCosh(Op1, S.begin(), Res, K);
 }
 
 /**
- * @brief Derivative rule for multiplication: d(f*g)/dx = f'*g + f*g'
- * @param Op1 Left operand expression (f)
- * @param Op2 Right operand expression (g)
- * @param DX Target variable ID
- * @return ExprNode* Resulting derivative tree
+* @brief Evaluates the subtree on power series truncated after order K.
+*
+* The variables are the series x+d*t of their values and directions, so the
+* j-th coefficient of the result is the j-th directional derivative over j!.
+* Every node costs O(K^2), the walk O(K^2*n).
+*
+* @param Values Indexed by variable ID, the values and directions of the variables.
+* @param K The highest order.
+* @param Coef Receives the K+1 Taylor coefficients along the direction.
+*/
+void ExprNode::TaylorSeries(const std::vector<Dual>& Values, int K, std::vector<double>& Coef) const
+{
+	//Post-order evaluation, the series of the operands are on the coefficient stack
+	const size_t W = K + 1;
+	WalkStack<std::pair<const ExprNode*, bool>> S;
+	std::vector<double> Stack;
+	S.Push({ this, false });
+	while (!S.Empty())
+	{
+		auto& [pNode, Expanded] = S.Top();
+		auto p = pNode;
+		if (!Expanded && p->L())
+		{
+			Expanded = true;
+			if (p->R())S.Push({ p->R(), false });
+			S.Push({ p->L(), false });
+			continue;
+		}
+		S.Pop();
+		size_t N = Stack.size();
+		if (!p->L())
+		{
+			Stack.resize(N + W, 0.0);
+			if (p->V.Ty == Token::Int)Stack[N] = p->V.ID;
+			else if (p->V.Ty == Token::Big)Stack[N] = BigLiterals.Values[p->V.ID].ToDouble();
+			else { Stack[N] = Values[p->V.ID].V; if (K)Stack[N + 1] = Values[p->V.ID].D; }
+			continue;
+		}
+		//The operands are A (and B) on top, the result is built above them
+		size_t NArg = p->R() ? 2 : 1;
+		Stack.resize(N + W, 0.0);
+		double* A = &Stack[N - NArg * W], * B = NArg == 2 ? A + W : nullptr, * C = &Stack[N];
+		if (p->V.Ty == Token::Function)Funcs[p->V.ID].Series(A, B, C, K);
+		else switch (p->V.ID)
+		{
+		case '+':for (size_t j = 0; j < W; j++)C[j] = A[j] + B[j]; break;
+		case '-':for (size_t j = 0; j < W; j++)C[j] = A[j] - B[j]; break;
+		case '*':TS_Mul(A, B, C, K); break;
+		case '/':TS_Div(A, B, C, K); break;
+		default:TS_pow(A, B, C, K); break;
+		}
+		std::copy(C, C + W, A);
+		Stack.resize(N - (NArg - 1) * W);
+	}
+	Coef.assign(Stack.begin(), Stack.end());
+}
+
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+//------------------------SIMPLIFY HELPERS-------------------------
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+
+/**
+ * @brief Checks if two expression nodes are structurally equivalent
+ * @param L First node to compare
+ * @param R Second node to compare
+ * @return bool True if nodes have identical structure and values
  */
-ExprNode* DX_mul(const ExprNode* Op1, const ExprNode* Op2, int DX)
+bool Equal(const ExprNode* L, const ExprNode* R)
 {
-	//f*g -> f'*g+f*g'
-	return (DF Mul G)Add(F Mul DG);
+	// Shared nodes are trivially equivalent
+	if (L == R)return true;
+	// Different hashes rule equality out quickly
+	if (!L || !R || L->Hash() != R->Hash())return false;
+	// Equal hashes are confirmed node by node, the operands of + and * chains
+	// are matched in hash order because the hash ignores their order
+	WalkStack<std::pair<const ExprNode*, const ExprNode*>> S;
+	S.Push({ L, R });
+	while (!S.Empty())
+	{
+		auto [A, B] = S.Pop();
+		if (A == B)continue;
+		if (!A || !B || !(A->V == B->V) || A->Hash() != B->Hash())return false;
+		if (A->V == ADD || A->V == MUL)
+		{
+			ScratchList<ExprNode*> OA, OB;
+			TraverseTreeNodes(OA, A, A->V);
+			TraverseTreeNodes(OB, B, B->V);
+			if (OA.size() != OB.size())return false;
+			auto ByHash = [](const ExprNode* X, const ExprNode* Y) { return X->Hash() < Y->Hash(); };
+			std::sort(OA.begin(), OA.end(), ByHash);
+			std::sort(OB.begin(), OB.end(), ByHash);
+			for (size_t I = 0; I < OA.size(); I++)S.Push({ OA[I], OB[I] });
+		}
+		else
+		{
+			S.Push({ A->L(), B->L() });
+			S.Push({ A->R(), B->R() });
+		}
+	}
+	return true;
 }
 
 /**
- * @brief Derivative rule for division: d(f/g)/dx = (f'g - fg')/g^2
- * @param Op1 Numerator expression (f)
- * @param Op2 Denominator expression (g)
- * @param DX Target variable ID
- * @return ExprNode* Resulting derivative tree
+ * @brief Extracts constant value from constant expression subtree
+ * @param pNode Root node of the subtree to evaluate
+ * @return Fraction The numerical value as a reduced fraction
  */
-ExprNode* DX_div(const ExprNode* Op1, const ExprNode* Op2, int DX)
+Fraction ExtractConst(const ExprNode* pNode)
 {
-	//f/g -> (f'*g-f*g')/(g^2)
-	return ((DF Mul G)Sub(F Mul DG))Div(G Pwr Const(2));
+	//Post-order evaluation, the values of the operands are on the value stack
+	WalkStack<std::pair<const ExprNode*, bool>> S;
+	WalkStack<Fraction> Values;
+	S.Push({ pNode, false });
+	while (!S.Empty())
+	{
+		auto& [p, Expanded] = S.Top();
+		pNode = p;
+		bool Arith = pNode->V.Ty == Token::Operator && strchr("+-*/", pNode->V.ID);
+		if (Arith && !Expanded)
+		{
+			Expanded = true;
+			S.Push({ pNode->R(), false });
+			S.Push({ pNode->L(), false });
+			continue;
+		}
+		S.Pop();
+		if (Arith)
+		{
+			auto B = Values.Pop(), A = Values.Pop();
+			switch (pNode->V.ID)
+			{
+			case '+':Values.Push(A + B); break;
+			case '-':Values.Push(A - B); break;
+			case '*':Values.Push(A * B); break;
+			case '/':Values.Push(A / B); break;
+			}
+		}
+		// Other operators are not folded
+		else if (pNode->V.Ty == Token::Operator)Values.Push(Fraction(0));
+		// Return integer value for constant nodes
+		else if (pNode->V.Ty == Token::Big)Values.Push(Fraction::FromBig(BigLiterals.Values[pNode->V.ID], 1));
+		else Values.Push(Fraction(pNode->V.ID));
+	}
+	return Values.Pop();
 }
 
 /**
- * @brief Derivative rule for natural logarithm: d(ln(f))/dx = f'/f
- * @param Op1 Inner function expression (f)
- * @param Op2 (Unused) Placeholder for interface consistency
- * @param DX Target variable ID
- * @return ExprNode* Resulting derivative tree
+ * @brief Extracts coefficients from multiplicative expressions
+ * @param pNode Root node of the expression to analyze
+ * @return pair<bool, Fraction> (modified status, extracted coefficient)
  */
-ExprNode* DX_ln(const ExprNode* Op1, const ExprNode* Op2, int DX)
+std::pair<bool, Fraction> ExtractCoefficient(const ExprNode* pNode)
 {
-	//ln(f) -> f'/f
-	return DF Div F;
+	bool Simplify_FoldConst(ExprNode * &pNode);
+	Fraction F(1);
+	bool Changed = false;
+
+	// Traverse multiplicative terms
+	TraverseType(pNode, MUL, p)
+	{
+		if (p->V.Ty == Token::Int && p->V.ID != 1)
+		{
+			F = F * Fraction(p->V.ID);
+			p->V = Token(int(1));
+			Changed = true;
+		}
+		else if (p->IsConstII())
+		{
+			// Handle complex constants
+			auto alt = CreateNode();
+			alt->Copy(p);
+			Simplify_FoldConst(alt);
+			F = F * ExtractConst(alt);
+			ReleaseTree(alt);
+			ClearNode(p);
+			p->V = Token(int(1));
+			Changed = true;
+		}
+	}
+	return { Changed, F };
 }
 
+//Maps the hash of a factor to the slot holding it
+using FactorMap = FlatHashMap<ExprNode**>;
+
 /**
- * @brief Derivative rule for logarithm: d(log_b(f))/dx = (ln(f)/ln(b))'
- * @param Op1 Base expression (b)
- * @param Op2 Argument expression (f)
- * @param DX Target variable ID
- * @return ExprNode* Resulting derivative tree using quotient rule
+ * @brief An operand of a flattened + or * chain together with its hash.
+ *
+ * Sorting the operands of a chain puts identical operands next to each other
+ * in their original order, so they can be merged in one linear pass.
  */
-ExprNode* DX_log(const ExprNode* Op1, const ExprNode* Op2, int DX)
+struct HashedOperand
 {
-	//log(f,g)=ln(g)/ln(f)
-	return DX_div(Ln(Op2), Ln(Op1), DX);
+	ExprHash Hash;
+	///< Position of the operand in the flattened chain.
+	size_t Index;
+	bool operator<(const HashedOperand& R) const { return Hash != R.Hash ? Hash < R.Hash : Index < R.Index; }
+};
+
+/**
+ * @brief Merges one factor of a product with an identical factor seen before
+ * @param pNode Factor to process, products are left to MergeSame
+ * @param Tg Map tracking factor hashes to detect duplicates
+ * @return bool True if a merge occurred
+ */
+bool MergeSameFactor(ExprNode*& pNode, FactorMap& Tg)
+{
+	if constexpr (EnableDebugSimplifyII) { printf("GetMS: "); pNode->PrintTree(); putchar('\n'); }
+	//(y*z)^x=y^x*z^x
+	//Put it in Rotate causes infinite loop
+	if (pNode->V == POW && pNode->V0() == MUL)
+	{
+		//(y*z)^x -> (y*z)*x
+		pNode->V.ID = '*';
+		auto Z = pNode->L()->R();
+		pNode->L()->R() = pNode->R()->Duplicate();//(y*z)*x -> (y*x)*x z
+		pNode->L()->V.ID = '^';
+		pNode->R() = Z Pwr pNode->R();
+	}
+	if (pNode->V == MUL)return false;
+	else if (pNode->IsConst())return false;
+	else if (pNode->V == POW)
+	{
+		if constexpr (EnableDebugSimplifyII) { printf("GetP: "); pNode->PrintTree(); putchar('\n'); }
+		auto H = pNode->L()->Hash();
+		if constexpr (EnableDebugSimplifyII) { printf("Hash %016llX Tree: ", H); pNode->L()->PrintTree(); putchar('\n'); }
+		auto it = Tg.Find(H);
+		if (!it)
+		{
+			// Register new factor
+			Tg[H] = &pNode;
+			return false;
+		}
+		else
+		{
+			// Merge duplicate factors
+			auto& T = (**it);
+			auto B = pNode->R();
+			pNode->R() = Const(0);
+			if (T->V == POW)T->R() = T->R() Add B;
+			else T = T Pwr(Const(1) Add B);
+			return true;
+		}
+	}
+	else
+	{
+		auto H = pNode->Hash();
+		if constexpr (EnableDebugSimplifyII) { printf("Hash %016llX GetM: ", H); pNode->PrintTree(); putchar('\n'); }
+		auto it = Tg.Find(H);
+		if (!it)
+		{
+			// Register new factor
+			Tg[H] = &pNode;
+			return false;
+		}
+		else
+		{
+			// Merge duplicate factors
+			auto& T = (**it);
+			ReleaseTree(pNode);
+			pNode = Const(1);
+			if (T->V == POW)T->R() = T->R() Add Const(1);
+			else T = T Pwr(Const(2));
+			return true;
+		}
+	}
 }
 
 /**
- * @brief Derivative rule for cosine: d(cos(f))/dx = -f'*sin(f)
- * @param Op1 Inner function expression (f)
- * @param Op2 (Unused) Placeholder for interface consistency
- * @param DX Target variable ID
- * @return ExprNode* Resulting derivative tree
+ * @brief Merges identical factors in power expressions
+ * @param pNode Root node of the expression to process
+ * @param Tg Map tracking factor hashes to detect duplicates
+ * @return bool True if any merges occurred
  */
-ExprNode* DX_cos(const ExprNode* Op1, const ExprNode* Op2, int DX)
+bool MergeSame(ExprNode*& pNode, FactorMap& Tg)
 {
-	//cos(f) -> 0-f'*sin(f)
-	return Const(0) Sub(DF Mul Sin(F));
+	bool Changed = false;
+	WalkStack<ExprNode**> S;
+	S.Push(&pNode);
+	while (!S.Empty())
+	{
+		auto pp = S.Pop();
+		Changed |= MergeSameFactor(*pp, Tg);
+		// Factors are visited left to right
+		if ((*pp)->V == MUL)
+		{
+			S.Push(&(*pp)->R());
+			S.Push(&(*pp)->L());
+		}
+	}
+	return Changed;
 }
 
 /**
- * @brief Computes the derivative of the sine function
- * @param Op1 The inner function expression (f in sin(f))
- * @param Op2 Unused parameter (maintained for interface consistency)
- * @param DX The variable ID to differentiate against
- * @return ExprNode* Derivative expression tree: cos(f) * f'
+ * @brief Populates factor map with multiplicative components
+ * @param pNode Root node of the expression to analyze
+ * @param F Factor map to populate
  */
-ExprNode* DX_sin(const ExprNode* Op1, const ExprNode* Op2, int DX)
+void FillFactorMap(ExprNode*& pNode, FactorMap& F)
 {
-	//sin(f) -> f'*cos(f)
-	return DF Mul Cos(F);
+	// Factors are visited left to right, a later identical factor wins
+	WalkStack<ExprNode**> S;
+	S.Push(&pNode);
+	while (!S.Empty())
+	{
+		auto pp = S.Pop();
+		if ((*pp)->V == MUL)
+		{
+			S.Push(&(*pp)->R());
+			S.Push(&(*pp)->L());
+		}
+		// Record non-multiplicative components
+		else F[(*pp)->Hash()] = pp;
+	}
 }
 
 /**
- * @brief Computes the derivative of the tangent function
- * @param Op1 The inner function expression (f in tan(f))
- * @param Op2 Unused parameter (interface consistency)
- * @param DX The variable ID to differentiate against
- * @return ExprNode* Derivative expression tree: f' / cos(f)^2
+ * @brief Rotates constant coefficients to front of multiplicative expressions
+ * @param pNode Root node of the expression to modify
+ * @return bool True if rotation occurred
  */
-ExprNode* DX_tan(const ExprNode* Op1, const ExprNode* Op2, int DX)
+bool RotateCoefficient(ExprNode*& pNode)
 {
-	//tan(f) -> f'/cos^2(f)
-	return DF Div(Cos(F) Pwr Const(2));
+	if (!pNode)return false;
+	InvalidateHashes();
+	if (Extracted.find(pNode->Hash()) != Extracted.end())return false;
+	if (pNode->V.Ty == Token::Int)return false;
+	auto F = ExtractCoefficient(pNode).second;
+	auto pC = F.ToNode();
+	InvalidateHashes();
+
+	// Prepend coefficient to expression
+	pNode = pC Mul pNode;
+	Extracted.insert(pNode->Hash());
+	return true;
 }
 
 /**
- * @brief Computes the derivative of the power function (f^g)
- * @param Op1 Base expression (f in f^g)
- * @param Op2 Exponent expression (g in f^g)
- * @param DX The variable ID to differentiate against
- * @return ExprNode* Derivative expression tree using logarithmic differentiation
+ * @brief Replaces an expression node with an integer constant node
+ * @param x The integer value to replace with
+ * @param pNode[in,out] Reference to the node pointer to be replaced
+ *
+ * - Releases existing node memory through ReleaseTree
+ * - Creates new constant node with specified value
+ * - Modifies the original pointer to point to new node
  */
-ExprNode* DX_pow(const ExprNode* Op1, const ExprNode* Op2, int DX)
+void ReplaceInt(int x, ExprNode*& pNode)
 {
-	//f^g=exp(g*lnf)
-	return DX_exp(Op2 Mul Ln(Op1), nullptr, DX);
+	ReleaseTree(pNode);
+	pNode = CreateNode(Token(x));
 }
 
 /**
- * @brief Computes the derivative of the exponential function (e^f)
- * @param Op1 The exponent expression (f in exp(f))
- * @param Op2 Unused parameter (interface consistency)
- * @param DX The variable ID to differentiate against
- * @return ExprNode* Derivative expression tree: exp(f) * f'
+ * @brief Replaces an expression node with the tree of a constant value
+ * @param F The value, integers outside the int range become Token::Big nodes
+ * @param pNode[in,out] Reference to the node pointer to be replaced
  */
-ExprNode* DX_exp(const ExprNode* Op1, const ExprNode* Op2, int DX)
+void ReplaceValue(const Fraction& F, ExprNode*& pNode)
 {
-	//exp(f) -> f'*exp(f)
-	return DF Mul Exp(F);
+	ReleaseTree(pNode);
+	pNode = F.ToNode();
 }
 
 /**
- * @brief Computes the derivative of the hyperbolic sine function
- * @param Op1 The inner function expression (f in sinh(f))
- * @param Op2 Unused parameter (interface consistency)
- * @param DX The variable ID to differentiate against
- * @return ExprNode* Derivative expression tree: cosh(f) * f'
+ * @brief Creates a multiplied factor tree from duplicate components
+ * @param Raw Vector of factor nodes to combine
+ * @param Begin Starting index in vector
+ * @param End Ending index in vector (exclusive)
+ * @return ExprNode* Balanced binary tree of multiplication operations
+ *
+ * - Uses divide-and-conquer to build balanced multiplication tree
+ * - Example: [a,b,c,d] -> ((a*b)*(c*d))
  */
-ExprNode* DX_sinh(const ExprNode* Op1, const ExprNode* Op2, int DX)
+ExprNode* DuplicateFactorImpl(ScratchList<ExprNode*>& Raw, int Begin, int End)
 {
-	//sinhf -> f'*coshf
-	return DF Mul Cosh(F);
+	if (End - Begin == 1)return Raw[Begin];
+	else
+	{
+		int Mid = (Begin + End) / 2;
+		return DuplicateFactorImpl(Raw, Begin, Mid) Mul DuplicateFactorImpl(Raw, Mid, End);
+	}
 }
 
 /**
- * @brief Computes the derivative of the hyperbolic cosine function
- * @param Op1 The inner function expression (f in cosh(f))
- * @param Op2 Unused parameter (interface consistency)
- * @param DX The variable ID to differentiate against
- * @return ExprNode* Derivative expression tree: sinh(f) * f'
+ * @brief A sum of monomials with rational coefficients over opaque atoms.
+ *
+ * The atoms are the factors of the terms other than integer powers, keyed by
+ * hash, so sums, function calls and symbolic powers act as variables. A monomial
+ * is a run of (atom, exponent) pairs sorted by atom, the constant term is the
+ * empty monomial. Like terms are merged by sorting the monomials, which takes
+ * O(n log n) instead of comparing every pair of terms.
  */
-ExprNode* DX_cosh(const ExprNode* Op1, const ExprNode* Op2, int DX)
+class SparsePolynomial
 {
-	//coshf -> f'*sinhf
-	return DF Mul Sinh(F);
-}
+public:
+	struct Term
+	{
+		///< The monomial is Powers[Begin, End)
+		size_t Begin, End;
+		Fraction Coef;
+		///< Index of the first input term with this monomial
+		size_t First;
+		///< Number of input terms merged into this one
+		size_t Count;
+	};
+	std::vector<Term> Terms;
+
+private:
+	std::vector<std::pair<int, int>> Powers;
+	///< The first node seen for every atom, owned by the input terms
+	std::vector<const ExprNode*> Atoms;
+	FlatHashMap<int> AtomIndex;
+
+	int Atom(const ExprNode* pNode)
+	{
+		//An atom whose hash collides with another one moves on to the next key
+		auto K = pNode->Hash();
+		for (int* it; (it = AtomIndex.Find(K)); K = TransformHash(K))
+			if (Equal(Atoms[*it], pNode))return *it;
+		AtomIndex[K] = (int)Atoms.size();
+		Atoms.push_back(pNode);
+		return (int)Atoms.size() - 1;
+	}
+	bool SameMonomial(const Term& A, const Term& B) const
+	{
+		return std::equal(Powers.begin() + A.Begin, Powers.begin() + A.End,
+			Powers.begin() + B.Begin, Powers.begin() + B.End);
+	}
+	bool MonomialLess(const Term& A, const Term& B) const
+	{
+		return std::lexicographical_compare(Powers.begin() + A.Begin, Powers.begin() + A.End,
+			Powers.begin() + B.Begin, Powers.begin() + B.End);
+	}
+
+public:
+	/**
+	 * @brief Adds a term, multiplying the factors of a product into its monomial
+	 * @param pMonomial The product, factors equal to 1 are skipped
+	 * @param Coef Coefficient of the term
+	 * @param First Index of the term in the input
+	 *
+	 * The atoms stay owned by pMonomial, which has to outlive the polynomial.
+	 */
+	void AddTerm(const ExprNode* pMonomial, const Fraction& Coef, size_t First)
+	{
+		size_t Begin = Powers.size();
+		TraverseType(pMonomial, MUL, p)
+		{
+			if (p->V.Ty == Token::Int && p->V.ID == 1)continue;
+			if (p->V == POW && p->R()->V.Ty == Token::Int)Powers.emplace_back(Atom(p->L()), p->R()->V.ID);
+			else Powers.emplace_back(Atom(p), 1);
+		}
+		// Add the exponents of the same atom, x*x^-1 leaves nothing
+		std::sort(Powers.begin() + Begin, Powers.end());
+		size_t End = Begin;
+		for (size_t K = Begin; K < Powers.size(); K++)
+		{
+			if (End > Begin && Powers[End - 1].first == Powers[K].first)Powers[End - 1].second += Powers[K].second;
+			else Powers[End++] = Powers[K];
+			if (!Powers[End - 1].second)End--;
+		}
+		Powers.resize(End);
+		Terms.push_back({ Begin, End, Coef, First, 1 });
+	}
+
+	/**
+	 * @brief Merges like terms and drops the terms that cancel out
+	 *
+	 * The merged terms are left in the order of their first input term.
+	 */
+	void Normalize()
+	{
+		std::sort(Terms.begin(), Terms.end(), [this](const Term& A, const Term& B)
+			{
+				if (MonomialLess(A, B))return true;
+				if (MonomialLess(B, A))return false;
+				return A.First < B.First;
+			});
+		size_t Out = 0;
+		for (size_t K = 0; K < Terms.size(); K++)
+		{
+			if (Out && SameMonomial(Terms[Out - 1], Terms[K]))
+			{
+				Terms[Out - 1].Coef += Terms[K].Coef;
+				Terms[Out - 1].Count++;
+			}
+			else Terms[Out++] = Terms[K];
+		}
+		Terms.resize(Out);
+		Terms.erase(std::remove_if(Terms.begin(), Terms.end(), [](const Term& T) {return T.Coef == 0; }), Terms.end());
+		std::sort(Terms.begin(), Terms.end(), [](const Term& A, const Term& B) {return A.First < B.First; });
+	}
+
+	/**
+	 * @brief Builds the monomial of a term as a tree, without the coefficient
+	 * @param T The term
+	 * @return ExprNode* The product of the atoms in the order they were first seen
+	 */
+	ExprNode* ToNode(const Term& T) const
+	{
+		ExprNode* pNode = nullptr;
+		for (size_t K = T.Begin; K < T.End; K++)
+		{
+			auto [A, E] = Powers[K];
+			auto pF = Atoms[A]->Duplicate();
+			if (E != 1)pF = pF Pwr Const(E);
+			pNode = pNode ? (pNode Mul pF) : pF;
+		}
+		return pNode ? pNode : Const(1);
+	}
+};
 
-// Macro cleanup to prevent namespace pollution
-#undef F  
-#undef DF 
-#undef G 
-#undef DG 
 
 //-----------------------------------------------------------------
 //-----------------------------------------------------------------
-//------------------------SIMPLIFY HELPERS-------------------------
+//------------------------SIMPLIFY FUNCTIONS-----------------------
 //-----------------------------------------------------------------
 //-----------------------------------------------------------------
 
+
 /**
- * @brief Checks if two expression nodes are structurally equivalent
- * @param L First node to compare
- * @param R Second node to compare
- * @return bool True if nodes have identical structure and values
+ * @brief Merges power terms with identical bases (x^a * x^b -> x^(a+b)
+ * @param pNode[in,out] Root node of the expression subtree to process
+ * @return bool True if any power merging occurred
  */
-bool Equal(const ExprNode* L, const ExprNode* R)
+bool Simplify_MergePower(ExprNode*& pNode)
+{
+	FactorMap Tg;
+	if constexpr (EnableDebugSimplifyII) { printf("\nMP: "); pNode->PrintTree(); putchar('\n'); }
+	InvalidateHashes();
+	
+	// Use hash map to detect duplicate bases
+	return MergeSame(pNode, Tg);
+}
+
+/**
+ * @brief Handles special cases with 0/1 exponents (x^0 -> 1, 0^x -> 0, etc)
+ * @param pNode[in,out] Power expression node to simplify
+ * @return bool True if simplification occurred
+ */
+bool Simplify_01Pwr(ExprNode*& pNode)
+{
+	if (pNode->HasOp1() && pNode->Ty1() == Token::Int && pNode->ID1() == 0)//x^0=1
+	{
+		ReplaceInt(1, pNode);
+		return true;
+	}
+	else if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 0)//0^x=0
+	{
+		ReplaceInt(0, pNode);
+		return true;
+	}
+	else if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 1)//1^x=1
+	{
+		ReplaceInt(1, pNode);
+		return true;
+	}
+	else if (pNode->HasOp1() && pNode->Ty1() == Token::Int && pNode->ID1() == 1)//x^1=x
+	{
+		ReleaseNode(pNode);
+		pNode = pNode->L();
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Simplifies expressions containing 0/1 constants
+ * @param pNode[in,out] Root node of the subtree to process
+ * @return bool True if any 0/1 simplification occurred
+ */
+bool Simplify_01_Node(ExprNode*& pNode)
 {
-	auto H1 = L ? L->Hash() : 0, H2 = R ? R->Hash() : 0;
-	// Compare hash values for quick equivalence check
-	return H1 == H2;
+	if (!pNode)return false;
+	bool Changed = false;
+	switch (pNode->V.Ty)
+	{
+	case Token::Int:break;
+	case Token::Variable:break;
+	case Token::Function:
+	{
+		switch (pNode->V.ID)
+		{
+		case FUNC_ln:
+			if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 1)
+			{
+				ReplaceInt(0, pNode);
+				Changed = true;
+			}
+			break;
+		case FUNC_log:break;//It won't happen in derived functions
+		case FUNC_exp:
+		case FUNC_cos:
+		case FUNC_cosh:
+			if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 0)//cos(0)=1 exp(0)=1
+			{
+				ReplaceInt(1, pNode);
+				Changed = true;
+			}
+			break;
+		case FUNC_sin:
+		case FUNC_tan:
+		case FUNC_sinh:
+			if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 0)
+			{
+				ReplaceInt(0, pNode);
+				Changed = true;
+			}
+			break;
+		case FUNC_pow:
+			Changed |= Simplify_01Pwr(pNode); break;
+		default:break;
+		}
+		break;
+	}
+	case Token::Operator:
+	{
+		switch (pNode->V.ID)
+		{
+			// Handle additive identities
+		case '+':
+			if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 0)
+			{
+				ReleaseNode(pNode);
+				pNode = pNode->R();
+				Changed = true;
+			}
+			else if (pNode->HasOp1() && pNode->Ty1() == Token::Int && pNode->ID1() == 0)
+			{
+				ReleaseNode(pNode);
+				pNode = pNode->L();
+				Changed = true;
+			}break;
+		case '-':
+			if (pNode->HasOp1() && pNode->Ty1() == Token::Int && pNode->ID1() == 0)
+			{
+				ReleaseNode(pNode);
+				pNode = pNode->L();
+				Changed = true;
+			}
+			else if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 0)
+			{
+				ReplaceInt(-1, pNode->L());
+				pNode->V.ID = '*';
+				Changed = true;
+			}
+			break;
+			// Handle multiplicative identities
+		case '*':
+			if ((pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 0)
+				|| (pNode->HasOp1() && pNode->Ty1() == Token::Int && pNode->ID1() == 0))
+			{
+				ReplaceInt(0, pNode);
+				Changed = true;
+			}
+			else if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 1)
+			{
+				ReleaseNode(pNode);
+				pNode = pNode->R();
+				Changed = true;
+			}
+			else if (pNode->HasOp1() && pNode->Ty1() == Token::Int && pNode->ID1() == 1)
+			{
+				ReleaseNode(pNode);
+				pNode = pNode->L();
+				Changed = true;
+			}
+			break;
+		case '/':
+			if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 0)
+			{
+				ReplaceInt(0, pNode);
+				Changed = true;
+			}
+			else if (pNode->HasOp1() && pNode->Ty1() == Token::Int && pNode->ID1() == 1)
+			{
+				ReleaseNode(pNode);
+				pNode = pNode->L();
+				Changed = true;
+			}break;
+		case '^':
+			Changed |= Simplify_01Pwr(pNode); break;
+		default:break;
+		}
+		break;
+	}
+	default:break;
+	};
+	return Changed;
 }
 
 /**
- * @brief Extracts constant value from constant expression subtree
- * @param pNode Root node of the subtree to evaluate
- * @return Fraction The numerical value as a reduced fraction
+ * @brief Runs Simplify_01_Node on every node of the subtree, operands first
  */
-Fraction ExtractConst(const ExprNode* pNode)
+bool Simplify_01(ExprNode*& pNode)
 {
-	if (pNode->V.Ty == Token::Operator)
-	{
-		switch (pNode->V.ID)
-		{
-		case '+':return ExtractConst(pNode->L()) + ExtractConst(pNode->R());
-		case '-':return ExtractConst(pNode->L()) - ExtractConst(pNode->R());
-		case '*':return ExtractConst(pNode->L()) * ExtractConst(pNode->R());
-		case '/':return ExtractConst(pNode->L()) / ExtractConst(pNode->R());
-		default:return Fraction(0);
-		}
-	}
-	// Return integer value for constant nodes
-	else return Fraction(pNode->V.ID);
+	return RewritePostOrder(pNode, Simplify_01_Node);
 }
 
 /**
- * @brief Extracts coefficients from multiplicative expressions
- * @param pNode Root node of the expression to analyze
- * @return pair<bool, Fraction> (modified status, extracted coefficient)
+ * @brief Restructures expression tree for canonical form
+ * @param pNode[in,out] Root node of the subtree to rotate
+ * @return bool True if any structural changes occurred
+ *
+ * - Converts subtraction to addition with negative coefficients
+ * - Flattens nested division/multiplication structures
  */
-std::pair<bool, Fraction> ExtractCoefficient(const ExprNode* pNode)
+bool Simplify_Rotate_Node(ExprNode*& pNode)
 {
-	bool Simplify_FoldConst(ExprNode * &pNode);
-	Fraction F(1);
+	if (!pNode)return false;
 	bool Changed = false;
-
-	// Traverse multiplicative terms
-	TraverseType(pNode, MUL, p)
+	if (pNode->V == ADD)
 	{
-		if (p->V.Ty == Token::Int && p->V.ID != 1)
+		//(a-b)+(c-d)=(a+c)-(b+d)
+		if (pNode->L()->V == SUB && pNode->R()->V == SUB)
 		{
-			F = F * Fraction(p->V.ID);
-			p->V = Token(int(1));
+			std::swap(pNode->L()->R(), pNode->R()->L());//(a-b)+(c-d)->(a-c)+(b-d)
+			pNode->V.ID = '-';
+			pNode->ID0() = '+';
+			pNode->ID1() = '+';
+		}
+		//x+(y-z)=(x+y)-z
+		else if (pNode->R()->V == SUB)
+		{
+			auto p = pNode->R();
+			pNode->R() = p->L();
+			p->L() = pNode;
+			pNode = p;
 			Changed = true;
 		}
-		else if (p->IsConstII())
+		//(x-y)+z=(x+z)-y
+		else if (pNode->L()->V == SUB)
 		{
-			// Handle complex constants
-			auto alt = CreateNode();
-			alt->Copy(p);
-			Simplify_FoldConst(alt);
-			F = F * ExtractConst(alt);
-			ReleaseTree(alt);
-			ClearNode(p);
-			p->V = Token(int(1));
+			auto p = pNode->L();
+			pNode->L() = p->L();
+			p->L() = pNode;
+			pNode = p;
 			Changed = true;
 		}
-	}
-	return { Changed, F };
-}
 
-/**
- * @brief Merges identical factors in power expressions
- * @param pNode Root node of the expression to process
- * @param Tg Map tracking factor hashes to detect duplicates
- * @return bool True if any merges occurred
- */
-bool MergeSame(ExprNode*& pNode, std::map<ExprHash, ExprNode**>& Tg)
-{
-	if constexpr (EnableDebugSimplifyII) { printf("GetMS: "); pNode->PrintTree(); putchar('\n'); }
-	//(y*z)^x=y^x*z^x
-	//Put it in Rotate causes infinite loop
-	if (pNode->V == POW && pNode->V0() == MUL)
-	{
-		//(y*z)^x -> (y*z)*x
-		pNode->V.ID = '*';
-		auto Z = pNode->L()->R();
-		pNode->L()->R() = pNode->R()->Duplicate();//(y*z)*x -> (y*x)*x z
-		pNode->L()->V.ID = '^';
-		pNode->R() = Z Pwr pNode->R();
-	}
-	if (pNode->V == MUL)
-	{
-		bool V = MergeSame(pNode->L(), Tg);
-		V |= MergeSame(pNode->R(), Tg);
-		return V;
 	}
-	else if (pNode->IsConst())return false;
-	else if (pNode->V == POW)
+	else if (pNode->V == SUB)
 	{
-		if constexpr (EnableDebugSimplifyII) { printf("GetP: "); pNode->PrintTree(); putchar('\n'); }
-		auto H = pNode->L()->Hash();
-		if constexpr (EnableDebugSimplifyII) { printf("Hash %016llX Tree: ", H); pNode->L()->PrintTree(); putchar('\n'); }
-		auto it = Tg.find(H);
-		if (it == Tg.end())
+		//(a-b)-(c-d)=(a+d)-(c+b)
+		if (pNode->L()->V == SUB && pNode->R()->V == SUB)
 		{
-			// Register new factor
-			Tg[H] = &pNode;
-			return false;
+			std::swap(pNode->L()->R(), pNode->R()->R());//(a-b)-(c-d)->(a-d)-(c-b)
+			pNode->ID0() = '+';
+			pNode->ID1() = '+';
 		}
-		else
+		//x-(y-z)=(x+z)-y
+		else if (pNode->R()->V == SUB)
 		{
-			// Merge duplicate factors
-			auto& T = (*(it->second));
-			auto B = pNode->R();
-			pNode->R() = Const(0);
-			if (T->V == POW)T->R() = T->R() Add B;
-			else T = T Pwr(Const(1) Add B);
-			return true;
+			pNode->V.ID = '+';//x-(y-z) -> x+(y-z)
+			auto p = pNode->R();//x+(y-z) -> x+(y-z) y-z
+			pNode->R() = p->R();//x+(y-z) y-z -> x+z y-z
+			p->R() = p->L();//x+z y-z -> x+z y-y
+			p->L() = pNode;//x+z y-y -> x+z (x+z)-y
+			pNode = p;
+			Changed = true;
+		}
+		//(x-y)-z=x-(y+z)
+		else if (pNode->L()->V == SUB)
+		{
+			pNode->V.ID = '+';//(x-y)-z -> (x-y)+z
+			auto p = pNode->L();//(x-y)+z -> (x-y)+z x-y
+			pNode->L() = p->R();//(x-y)+z x-y -> y+z x-y
+			p->R() = pNode;//y+z x-y -> y+z x-(y+z)
+			pNode = p;
+			Changed = true;
 		}
 	}
-	else
+	else if (pNode->V == MUL)
 	{
-		auto H = pNode->Hash();
-		if constexpr (EnableDebugSimplifyII) { printf("Hash %016llX GetM: ", H); pNode->PrintTree(); putchar('\n'); }
-		auto it = Tg.find(H);
-		if (it == Tg.end())
+		//(a/b)*(c/d)=(a*c)/(b*d)
+		if (pNode->L()->V == DIV && pNode->R()->V == DIV)
 		{
-			// Register new factor
-			Tg[H] = &pNode;
-			return false;
+			std::swap(pNode->L()->R(), pNode->R()->L());//(a-b)+(c-d)->(a-c)+(b-d)
+			pNode->V.ID = '/';
+			pNode->ID0() = '*';
+			pNode->ID1() = '*';
 		}
-		else
+		//x*(y/z)=(x*y)/z
+		else if (pNode->R()->V == DIV)
 		{
-			// Merge duplicate factors
-			auto& T = (*(it->second));
-			ReleaseTree(pNode);
-			pNode = Const(1);
-			if (T->V == POW)T->R() = T->R() Add Const(1);
-			else T = T Pwr(Const(2));
-			return true;
+			auto p = pNode->R();
+			pNode->R() = p->L();
+			p->L() = pNode;
+			pNode = p;
+			Changed = true;
+		}
+		//(x/y)*z=(x*z)/y
+		else if (pNode->L()->V == DIV)
+		{
+			auto p = pNode->L(); //(x/y)*z ->  (x/y)*z x/y
+			pNode->L() = p->L();//(x/y)*z ->  x*z x/y
+			p->L() = pNode;//x*z (x/y) ->  x*z (x*z)/y
+			pNode = p;
+			Changed = true;
 		}
 	}
-}
-
-/**
- * @brief Populates factor map with multiplicative components
- * @param pNode Root node of the expression to analyze
- * @param F Factor map to populate
- */
-void FillFactorMap(ExprNode*& pNode, std::map<ExprHash, ExprNode**>& F)
-{
-	if (pNode->V == MUL)
-	{
-		FillFactorMap(pNode->L(), F);
-		FillFactorMap(pNode->R(), F);
-	}
-	else
+	else if (pNode->V == DIV)
 	{
-		// Record non-multiplicative components
-		F[pNode->Hash()] = &pNode;
+		//(a/b)/(c/d)=(a*d)/(c*b)
+		if (pNode->L()->V == DIV && pNode->R()->V == DIV)
+		{
+			std::swap(pNode->L()->R(), pNode->R()->R());//(a-b)-(c-d)->(a-d)-(c-b)
+			pNode->ID0() = '*';
+			pNode->ID1() = '*';
+		}
+		//x/(y/z)=(x*z)/y
+		else if (pNode->R()->V == DIV)
+		{
+			pNode->V.ID = '*';
+			auto p = pNode->R();
+			pNode->R() = p->R();
+			p->R() = p->L();
+			p->L() = pNode;
+			pNode = p;
+			Changed = true;
+		}
+		//(x/y)/z=x/(y*z)
+		else if (pNode->L()->V == DIV)
+		{
+			pNode->V.ID = '*';
+			auto p = pNode->L();
+			pNode->L() = p->R();
+			p->R() = pNode;
+			pNode = p;
+			Changed = true;
+		}
 	}
-}
-
-/**
- * @brief Rotates constant coefficients to front of multiplicative expressions
- * @param pNode Root node of the expression to modify
- * @return bool True if rotation occurred
- */
-bool RotateCoefficient(ExprNode*& pNode)
-{
-	if (!pNode)return false;
-	if (Extracted.find(pNode->Hash()) != Extracted.end())return false;
-	if (pNode->V.Ty == Token::Int)return false;
-	auto F = ExtractCoefficient(pNode).second;
-	auto pC = F.ToNode();
-
-	// Prepend coefficient to expression
-	pNode = pC Mul pNode;
-	Extracted.insert(pNode->Hash());
-	return true;
-}
-
-/**
- * @brief Replaces an expression node with an integer constant node
- * @param x The integer value to replace with
- * @param pNode[in,out] Reference to the node pointer to be replaced
- *
- * - Releases existing node memory through ReleaseTree
- * - Creates new constant node with specified value
- * - Modifies the original pointer to point to new node
- */
-void ReplaceInt(int x, ExprNode*& pNode)
-{
-	ReleaseTree(pNode);
-	pNode = CreateNode(Token(x));
-}
-
-// -purpose: Tracks relationships between common factors during simplification  
-// -usage: Stores mapping of hash values to node pointers for factor merging
-struct CommonFactor
-{
-	ExprNode** ppi;
-	ExprNode** ppj;
-	ExprNode* pi;
-	ExprNode* pj;
-};
-
-void GetCommonFactor(std::map<ExprHash, ExprNode**>& I,
-	std::map<ExprHash, ExprNode**>& J, std::map<ExprHash, CommonFactor>& T)
-{
-	T.clear();
-	for (auto& [k, v] : I)
+	else if (pNode->V.IsPOW())
 	{
-		auto it = J.find(k);
-		if (it != J.end())
+		//(x^a)^b=x^(a*b)
+		if (pNode->V0().IsPOW())
 		{
-			T[k] = { v, it->second, *v, *it->second };
+			auto p = pNode->L();//(x^a)^b -> (x^a)^b x^a
+			pNode->L() = p->R();//(x^a)^b x^a -> a^b x^a
+			pNode->V.ID = '*';//a^b x^a  -> a*b x^a
+			p->R() = pNode;//a*b x^a -> a*b x^(a*b)
+			pNode = p;
+			Changed = true;
 		}
 	}
-}
-
-/**
- * @brief Creates a multiplied factor tree from duplicate components
- * @param Raw Vector of factor nodes to combine
- * @param Begin Starting index in vector
- * @param End Ending index in vector (exclusive)
- * @return ExprNode* Balanced binary tree of multiplication operations
- *
- * - Uses divide-and-conquer to build balanced multiplication tree
- * - Example: [a,b,c,d] -> ((a*b)*(c*d))
- */
-ExprNode* DuplicateFactorImpl(std::vector<ExprNode*>& Raw, int Begin, int End)
-{
-	if (End - Begin == 1)return Raw[Begin];
-	else
+	else if (pNode->V == Pow())
 	{
-		int Mid = (Begin + End) / 2;
-		return DuplicateFactorImpl(Raw, Begin, Mid) Mul DuplicateFactorImpl(Raw, Mid, End);
+		pNode->V = POW;
+		Changed = true;
 	}
+	else if (pNode->V == Log())
+	{
+		pNode = Ln(pNode->R()) Div Ln(pNode->L());
+		Changed = true;
+	}
+	return Changed;
 }
 
 /**
- * @brief Creates optimized multiplication tree from common factors
- * @param T Map of common factor relationships
- * @return ExprNode* Combined multiplication expression tree
- */
-ExprNode* DuplicateFactor(std::map<ExprHash, CommonFactor>& T)
-{
-	std::vector<ExprNode*> BuildRaw;
-	BuildRaw.reserve(T.size());
-	for (auto& [k, v] : T)BuildRaw.push_back(v.pi->Duplicate());
-	return DuplicateFactorImpl(BuildRaw, 0, (int)BuildRaw.size());
-}
-
-
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
-//------------------------SIMPLIFY FUNCTIONS-----------------------
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
-
-
-/**
- * @brief Merges power terms with identical bases (x^a * x^b -> x^(a+b)
- * @param pNode[in,out] Root node of the expression subtree to process
- * @return bool True if any power merging occurred
+ * @brief Runs Simplify_Rotate_Node on every node of the subtree, operands first
  */
-bool Simplify_MergePower(ExprNode*& pNode)
+bool Simplify_Rotate(ExprNode*& pNode)
 {
-	std::map<ExprHash, ExprNode**> Tg;
-	if constexpr (EnableDebugSimplifyII) { printf("\nMP: "); pNode->PrintTree(); putchar('\n'); }
-	
-	// Use hash map to detect duplicate bases
-	return MergeSame(pNode, Tg);
+	return RewritePostOrder(pNode, Simplify_Rotate_Node);
 }
 
 /**
- * @brief Handles special cases with 0/1 exponents (x^0 -> 1, 0^x -> 0, etc)
- * @param pNode[in,out] Power expression node to simplify
- * @return bool True if simplification occurred
+ * @brief Applies all 0/1 simplifications until no more changes
+ * @param pNode[in,out] Root node of the expression tree
  */
-bool Simplify_01Pwr(ExprNode*& pNode)
+bool Simplify_All01(ExprNode*& pNode)
 {
-	if (pNode->HasOp1() && pNode->Ty1() == Token::Int && pNode->ID1() == 0)//x^0=1
-	{
-		ReplaceInt(1, pNode);
-		return true;
-	}
-	else if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 0)//0^x=0
-	{
-		ReplaceInt(0, pNode);
-		return true;
-	}
-	else if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 1)//1^x=1
-	{
-		ReplaceInt(1, pNode);
-		return true;
-	}
-	else if (pNode->HasOp1() && pNode->Ty1() == Token::Int && pNode->ID1() == 1)//x^1=x
-	{
-		ReleaseNode(pNode);
-		pNode = pNode->L();
-		return true;
-	}
-	return false;
+	bool Changed = false;
+	Changed |= Simplify_Rotate(pNode);
+	Changed |= Simplify_01(pNode);
+	return Changed;
 }
 
 /**
- * @brief Simplifies expressions containing 0/1 constants
- * @param pNode[in,out] Root node of the subtree to process
- * @return bool True if any 0/1 simplification occurred
+ * @brief Simplifies trigonometric and hyperbolic identities
+ * @param pNode[in,out] Root node of the expression subtree
+ * @return bool True if any special function simplification occurred
+ *
+ * - Simplifies trigonometric conversions
+ * - Converts log/exp combinations to algebraic forms
  */
-bool Simplify_01(ExprNode*& pNode)
+bool Simplify_SpecialFuncs_Node(ExprNode*& pNode)
 {
 	if (!pNode)return false;
 	bool Changed = false;
-	Changed |= Simplify_01(pNode->L());
-	Changed |= Simplify_01(pNode->R());
 	switch (pNode->V.Ty)
 	{
-	case Token::Int:break;
-	case Token::Variable:break;
 	case Token::Function:
 	{
 		switch (pNode->V.ID)
 		{
-		case FUNC_ln:
-			if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 1)
-			{
-				ReplaceInt(0, pNode);
-				Changed = true;
-			}
-			break;
-		case FUNC_log:break;//It won't happen in derived functions
 		case FUNC_exp:
-		case FUNC_cos:
-		case FUNC_cosh:
-			if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 0)//cos(0)=1 exp(0)=1
+		{
+			//exp(ln(f))=f
+			TraverseType(pNode->L(), MUL, p)
 			{
-				ReplaceInt(1, pNode);
-				Changed = true;
+				if (p->V.Ty == Token::Function && p->V.ID == FUNC_ln)
+				{
+					auto Base = p->L();
+					p->L() = nullptr;
+					p->V = Token((int)1);
+					pNode->V = POW;
+					pNode->R() = pNode->L();
+					pNode->L() = Base;
+					Changed = true;
+					break;
+				}
+			}break;
+		}
+		case FUNC_ln:
+		{
+			//ln(exp(f))=f
+			//ln(a^b)=b*ln(a)
+			TraverseType(pNode->L(), MUL, p)
+			{
+				if (p->V == Exp())
+				{
+					auto Base = p->L();
+					p->L() = nullptr;
+					p->V = Token((int)1);
+					pNode->V = ADD;
+					pNode->L() = Ln(pNode->L());
+					pNode->R() = Base;
+					Changed = true;
+					break;
+				}
 			}
-			break;
-		case FUNC_sin:
-		case FUNC_tan:
-		case FUNC_sinh:
-			if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 0)
+			p = pNode->L();
+			if (p->V.IsPOW())
 			{
-				ReplaceInt(0, pNode);
+				auto U = p->R();
+				p->R() = Const(1);
+				pNode = U Mul pNode;
 				Changed = true;
-			}
-			break;
-		case FUNC_pow:
-			Changed |= Simplify_01Pwr(pNode); break;
-		default:break;
+			}break;
 		}
-		break;
+		default:break;
+		}break;
 	}
 	case Token::Operator:
 	{
 		switch (pNode->V.ID)
 		{
-			// Handle additive identities
-		case '+':
-			if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 0)
+		case '/':
+			//sin(x)/cos(x)=tan(x)
+			if (pNode->V0() == Sin() && pNode->V1() == Cos()
+				&& Equal(pNode->L()->L(), pNode->R()->L()))
 			{
-				ReleaseNode(pNode);
-				pNode = pNode->R();
+				pNode->V = Tan();
+				auto X = pNode->L()->L();
+				ReleaseNode(pNode->L());
+				ReleaseTree(pNode->R());
+				pNode->L() = X;
 				Changed = true;
+				break;
 			}
-			else if (pNode->HasOp1() && pNode->Ty1() == Token::Int && pNode->ID1() == 0)
+			//cos(x)/sin(x)=1/tan(x)
+			else if (pNode->V0() == Cos() && pNode->V1() == Sin()
+				&& Equal(pNode->L()->L(), pNode->R()->L()))
 			{
-				ReleaseNode(pNode);
-				pNode = pNode->L();
+				pNode->V1() = Tan();
+				ReleaseTree(pNode->L());
+				pNode->L() = Const(1);
 				Changed = true;
-			}break;
-		case '-':
-			if (pNode->HasOp1() && pNode->Ty1() == Token::Int && pNode->ID1() == 0)
+				break;
+			}
+			break;
+		case '+':
+			//sin(x)^2+cos(x)^2=1
+			//cos(x)^2+sin(x)^2=1
+			if (pNode->L()->IsSquare() && pNode->R()->IsSquare()
+				&& ((pNode->L()->V0() == Sin() && pNode->R()->V0() == Cos()) || (pNode->L()->V0() == Cos() && pNode->R()->V0() == Sin()))
+				&& Equal(pNode->L()->L()->L(), pNode->R()->L()->L()))
+			{
+				ReleaseTree(pNode);
+				pNode = Const(1);
+				Changed = true;
+				break;
+			}
+			//sinh^2+1=cosh^2
+			else if (pNode->V1() == Token(int(1))
+				&& pNode->L()->IsSquare()
+				&& pNode->L()->V0() == Sinh())
 			{
+				pNode->L()->L()->V = Cosh();
 				ReleaseNode(pNode);
+				ReleaseNode(pNode->R());
 				pNode = pNode->L();
 				Changed = true;
+				break;
 			}
-			else if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 0)
+			//1+sinh^2=cosh^2
+			else if (pNode->V0() == Token(int(1))
+				&& pNode->R()->IsSquare()
+				&& pNode->R()->V0() == Sinh())
 			{
-				ReplaceInt(-1, pNode->L());
-				pNode->V.ID = '*';
+				pNode->R()->L()->V = Cosh();
+				ReleaseNode(pNode);
+				ReleaseNode(pNode->L());
+				pNode = pNode->R();
 				Changed = true;
+				break;
 			}
 			break;
-			// Handle multiplicative identities
-		case '*':
-			if ((pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 0)
-				|| (pNode->HasOp1() && pNode->Ty1() == Token::Int && pNode->ID1() == 0))
+		case '-':
+			//cosh^2-sinh^2=1
+			if (pNode->L()->IsSquare() && pNode->R()->IsSquare()
+				&& pNode->L()->V0() == Cosh() && pNode->R()->V0() == Sinh()
+				&& Equal(pNode->L()->L()->L(), pNode->R()->L()->L()))
 			{
-				ReplaceInt(0, pNode);
+				ReleaseTree(pNode);
+				pNode = Const(1);
 				Changed = true;
+				break;
 			}
-			else if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 1)
+			//1-sin^2=cos^2
+			else if (pNode->V0() == Token(int(1))
+				&& pNode->R()->IsSquare()
+				&& pNode->R()->V0() == Sin())
 			{
+				pNode->R()->L()->V = Cos();
 				ReleaseNode(pNode);
+				ReleaseNode(pNode->L());
 				pNode = pNode->R();
 				Changed = true;
+				break;
 			}
-			else if (pNode->HasOp1() && pNode->Ty1() == Token::Int && pNode->ID1() == 1)
+			//1-cos^2=sin^2
+			else if (pNode->V0() == Token(int(1))
+				&& pNode->R()->IsSquare()
+				&& pNode->R()->V0() == Cos())
 			{
+				pNode->R()->L()->V = Sin();
 				ReleaseNode(pNode);
-				pNode = pNode->L();
-				Changed = true;
-			}
-			break;
-		case '/':
-			if (pNode->HasOp0() && pNode->Ty0() == Token::Int && pNode->ID0() == 0)
-			{
-				ReplaceInt(0, pNode);
+				ReleaseNode(pNode->L());
+				pNode = pNode->R();
 				Changed = true;
+				break;
 			}
-			else if (pNode->HasOp1() && pNode->Ty1() == Token::Int && pNode->ID1() == 1)
+			//cosh^2-1=sinh^2
+			else if (pNode->V1() == Token(int(1))
+				&& pNode->L()->IsSquare()
+				&& pNode->L()->V0() == Cosh())
 			{
+				pNode->L()->L()->V = Sinh();
 				ReleaseNode(pNode);
+				ReleaseNode(pNode->R());
 				pNode = pNode->L();
 				Changed = true;
-			}break;
-		case '^':
-			Changed |= Simplify_01Pwr(pNode); break;
+				break;
+			}
+			break;
 		default:break;
-		}
-		break;
+		}break;
 	}
 	default:break;
-	};
+	}
 	return Changed;
 }
 
 /**
- * @brief Restructures expression tree for canonical form
- * @param pNode[in,out] Root node of the subtree to rotate
- * @return bool True if any structural changes occurred
+ * @brief Runs Simplify_SpecialFuncs_Node on every node of the subtree, operands first
+ */
+bool Simplify_SpecialFuncs(ExprNode*& pNode)
+{
+	return RewritePostOrder(pNode, Simplify_SpecialFuncs_Node);
+}
+
+/**
+ * @brief Normalizes negative sign distribution
+ * @param pNode[in,out] Root node of the expression subtree
+ * @return bool True if any negation pattern was modified
  *
  * - Converts subtraction to addition with negative coefficients
- * - Flattens nested division/multiplication structures
+ * - Simplifies double negatives (-(-x) -> x)
+ * - Moves negative signs to canonical positions in products
  */
-bool Simplify_Rotate(ExprNode*& pNode)
+bool Simplify_Neg_Node(ExprNode*& pNode)
 {
 	if (!pNode)return false;
 	bool Changed = false;
-	Changed |= Simplify_Rotate(pNode->L());
-	Changed |= Simplify_Rotate(pNode->R());
-	if (pNode->V == ADD)
+	switch (pNode->V.Ty)
 	{
-		//(a-b)+(c-d)=(a+c)-(b+d)
-		if (pNode->L()->V == SUB && pNode->R()->V == SUB)
-		{
-			std::swap(pNode->L()->R(), pNode->R()->L());//(a-b)+(c-d)->(a-c)+(b-d)
-			pNode->V.ID = '-';
-			pNode->ID0() = '+';
-			pNode->ID1() = '+';
-		}
-		//x+(y-z)=(x+y)-z
-		else if (pNode->R()->V == SUB)
-		{
-			auto p = pNode->R();
-			pNode->R() = p->L();
-			p->L() = pNode;
-			pNode = p;
-			Changed = true;
-		}
-		//(x-y)+z=(x+z)-y
-		else if (pNode->L()->V == SUB)
-		{
-			auto p = pNode->L();
-			pNode->L() = p->L();
-			p->L() = pNode;
-			pNode = p;
-			Changed = true;
-		}
-
-	}
-	else if (pNode->V == SUB)
+	case Token::Operator:
 	{
-		//(a-b)-(c-d)=(a+d)-(c+b)
-		if (pNode->L()->V == SUB && pNode->R()->V == SUB)
-		{
-			std::swap(pNode->L()->R(), pNode->R()->R());//(a-b)-(c-d)->(a-d)-(c-b)
-			pNode->ID0() = '+';
-			pNode->ID1() = '+';
-		}
-		//x-(y-z)=(x+z)-y
-		else if (pNode->R()->V == SUB)
+		switch (pNode->V.ID)
 		{
-			pNode->V.ID = '+';//x-(y-z) -> x+(y-z)
-			auto p = pNode->R();//x+(y-z) -> x+(y-z) y-z
-			pNode->R() = p->R();//x+(y-z) y-z -> x+z y-z
-			p->R() = p->L();//x+z y-z -> x+z y-y
-			p->L() = pNode;//x+z y-y -> x+z (x+z)-y
-			pNode = p;
-			Changed = true;
-		}
-		//(x-y)-z=x-(y+z)
-		else if (pNode->L()->V == SUB)
+		case '-':
 		{
-			pNode->V.ID = '+';//(x-y)-z -> (x-y)+z
-			auto p = pNode->L();//(x-y)+z -> (x-y)+z x-y
-			pNode->L() = p->R();//(x-y)+z x-y -> y+z x-y
-			p->R() = pNode;//y+z x-y -> y+z x-(y+z)
-			pNode = p;
-			Changed = true;
+			//a-b=a+(-1)*b
+			//a-(-1)*b=a+b
+			bool NegR = false;
+			TraverseType(pNode->R(), MUL, p)
+			{
+				if (p->V.Ty == Token::Int && p->V.ID < 0)
+				{
+					NegR = !NegR;
+					p->V.ID = -p->V.ID;
+					Changed = true;
+				}
+			}
+			pNode->V.ID = '+';
+			if (!NegR)pNode->R() = Const(-1) Mul pNode->R();
+			break;
 		}
-	}
-	else if (pNode->V == MUL)
-	{
-		//(a/b)*(c/d)=(a*c)/(b*d)
-		if (pNode->L()->V == DIV && pNode->R()->V == DIV)
+		case '*':
 		{
-			std::swap(pNode->L()->R(), pNode->R()->L());//(a-b)+(c-d)->(a-c)+(b-d)
-			pNode->V.ID = '/';
-			pNode->ID0() = '*';
-			pNode->ID1() = '*';
+			//C*(a+b)=C*a+C*b
+			if (pNode->Ty0() == Token::Int && pNode->V1() == ADD)
+			{
+				auto p = pNode->R();
+				auto C = pNode->L();
+				p->L() = C Mul p->L();
+				p->R() = C->Duplicate() Mul p->R();
+				ReleaseNode(pNode);
+				pNode = p;
+			}
+			//(a+b)*C=C*a+C*b
+			else if (pNode->Ty1() == Token::Int && pNode->V0() == ADD)
+			{
+				auto p = pNode->L();
+				auto C = pNode->R();
+				p->L() = C Mul p->L();
+				p->R() = C->Duplicate() Mul p->R();
+				ReleaseNode(pNode);
+				pNode = p;
+			}
+			break;
 		}
-		//x*(y/z)=(x*y)/z
-		else if (pNode->R()->V == DIV)
+		case '/':
 		{
-			auto p = pNode->R();
-			pNode->R() = p->L();
-			p->L() = pNode;
-			pNode = p;
-			Changed = true;
+			pNode->V.ID = '*';
+			TraverseType(pNode->R(), MUL, p)
+			{
+				//C/x^y=C*x^((-1)*y)
+				if (p->V == POW)
+					p->R() = Const(-1) Mul p->R();
+				//C/exp(x)=C*exp(-1*x)
+				else if (p->V == Exp())
+					p->L() = Const(-1) Mul p->L();
+				//C/x=C*x^(-1)
+				else
+				{
+					auto M = CreateNode(); M->Copy(p);
+					auto Q = M Pwr Const(-1);
+					p->Copy(Q);
+				}
+			}
+			break;
 		}
-		//(x/y)*z=(x*z)/y
-		else if (pNode->L()->V == DIV)
-		{
-			auto p = pNode->L(); //(x/y)*z ->  (x/y)*z x/y
-			pNode->L() = p->L();//(x/y)*z ->  x*z x/y
-			p->L() = pNode;//x*z (x/y) ->  x*z (x*z)/y
-			pNode = p;
-			Changed = true;
+		default:break;
 		}
+		break;
 	}
-	else if (pNode->V == DIV)
+	case Token::Function:
 	{
-		//(a/b)/(c/d)=(a*d)/(c*b)
-		if (pNode->L()->V == DIV && pNode->R()->V == DIV)
+		switch (pNode->V.ID)
 		{
-			std::swap(pNode->L()->R(), pNode->R()->R());//(a-b)-(c-d)->(a-d)-(c-b)
-			pNode->ID0() = '*';
-			pNode->ID1() = '*';
-		}
-		//x/(y/z)=(x*z)/y
-		else if (pNode->R()->V == DIV)
+			/*
+			sin(-1*x)=-1*sin(x)
+			sinh(-1*x)=-1*sinh(x)
+			tan(-1*x)=-1*tan(x)
+			*/
+		case FUNC_sin:
+		case FUNC_tan:
+		case FUNC_sinh:
 		{
-			pNode->V.ID = '*';
-			auto p = pNode->R();
-			pNode->R() = p->R();
-			p->R() = p->L();
-			p->L() = pNode;
-			pNode = p;
-			Changed = true;
+			bool Neg = false;
+			TraverseType(pNode->L(), MUL, p)
+			{
+				if (p->V.Ty == Token::Int && p->V.ID < 0)
+				{
+					Neg = !Neg;
+					p->V.ID = -p->V.ID;
+					Changed = true;
+				}
+			}
+			if (Neg)pNode = Const(-1) Mul pNode;
+			break;
 		}
-		//(x/y)/z=x/(y*z)
-		else if (pNode->L()->V == DIV)
+		/*
+		cos(-1*x)=cos(x)
+		cosh(-1*x)=cosh(x)
+		*/
+		case FUNC_cos:
+		case FUNC_cosh:
 		{
-			pNode->V.ID = '*';
-			auto p = pNode->L();
-			pNode->L() = p->R();
-			p->R() = pNode;
-			pNode = p;
-			Changed = true;
+			TraverseType(pNode->L(), MUL, p)
+			{
+				if (p->V.Ty == Token::Int && p->V.ID < 0)
+				{
+					p->V.ID = -p->V.ID;
+					Changed = true;
+				}
+			}
+			break;
 		}
-	}
-	else if (pNode->V.IsPOW())
-	{
-		//(x^a)^b=x^(a*b)
-		if (pNode->V0().IsPOW())
-		{
-			auto p = pNode->L();//(x^a)^b -> (x^a)^b x^a
-			pNode->L() = p->R();//(x^a)^b x^a -> a^b x^a
-			pNode->V.ID = '*';//a^b x^a  -> a*b x^a
-			p->R() = pNode;//a*b x^a -> a*b x^(a*b)
-			pNode = p;
-			Changed = true;
+		/*
+		pow(x,-1*y)=1/x^y
+		exp(-1*x)=1/exp(x)
+		*/
+		default:break;
 		}
+		break;
 	}
-	else if (pNode->V == Pow())
-	{
-		pNode->V = POW;
-		Changed = true;
-	}
-	else if (pNode->V == Log())
-	{
-		pNode = Ln(pNode->R()) Div Ln(pNode->L());
-		Changed = true;
+	default:break;
 	}
 	return Changed;
 }
 
 /**
- * @brief Applies all 0/1 simplifications until no more changes
- * @param pNode[in,out] Root node of the expression tree
+ * @brief Runs Simplify_Neg_Node on every node of the subtree, operands first
  */
-bool Simplify_All01(ExprNode*& pNode)
+bool Simplify_Neg(ExprNode*& pNode)
+{
+	return RewritePostOrder(pNode, Simplify_Neg_Node);
+}
+
+/**
+ * @brief Handles top-level negation expressions
+ * @param pNode[in,out] Root node of the entire expression
+ * @return bool True if top-level negation was optimized
+ *
+ * - Converts -(a+b) -> -a-b style distributions
+ * - Eliminates unnecessary top-level negative signs
+ * - Ensures negation only applies to atomic terms
+ */
+bool Simplify_TopNeg(ExprNode*& pNode)
 {
 	bool Changed = false;
-	Changed |= Simplify_Rotate(pNode);
-	Changed |= Simplify_01(pNode);
+	if (pNode->V == MUL)
+	{
+		bool Neg = false;
+		ExprNode* FirstNeg = nullptr;
+		TraverseType(pNode, MUL, p)
+		{
+			if (p->V.Ty == Token::Int && p->V.ID == -1)
+			{
+				if (_I)
+				{
+					p->V.ID = 1;
+					Neg = !Neg;
+					Changed = true;
+				}
+				else FirstNeg = p;
+			}
+		}
+		if (Neg)
+		{
+			//-1*(-1)*a=a
+			if (FirstNeg)FirstNeg->V.ID = 1;
+			//a*(-b)=-1*a*b
+			else pNode = Const(-1) Mul pNode;
+		}
+	}
 	return Changed;
 }
 
 /**
- * @brief Simplifies trigonometric and hyperbolic identities
+ * @brief Evaluates constant subexpressions
  * @param pNode[in,out] Root node of the expression subtree
- * @return bool True if any special function simplification occurred
+ * @return bool True if any constant folding occurred
  *
- * - Simplifies trigonometric conversions
- * - Converts log/exp combinations to algebraic forms
+ * - Computes arithmetic results for constant operations
+ * - Reduces 2+3 -> 5 type evaluations
+ * - Handles power-of-constant computations
  */
-bool Simplify_SpecialFuncs(ExprNode*& pNode)
+bool Simplify_FoldConst_Node(ExprNode*& pNode)
 {
 	if (!pNode)return false;
+	//printf("\nFoldConst: "); pNode->PrintTree();
 	bool Changed = false;
-	Changed |= Simplify_SpecialFuncs(pNode->L());
-	Changed |= Simplify_SpecialFuncs(pNode->R());
-	switch (pNode->V.Ty)
-	{
-	case Token::Function:
+	if (pNode->V.Ty == Token::Operator)
 	{
-		switch (pNode->V.ID)
+		bool Int0 = pNode->Ty0() == Token::Int, Int1 = pNode->Ty1() == Token::Int;
+		//Two ints never overflow 64 bits, only large literals go through Fraction
+		if (Int0 && Int1)
 		{
-		case FUNC_exp:
-		{
-			//exp(ln(f))=f
-			TraverseType(pNode->L(), MUL, p)
+			switch (pNode->V.ID)
 			{
-				if (p->V.Ty == Token::Function && p->V.ID == FUNC_ln)
+			case '+':ReplaceValue(Fraction((long long)pNode->L()->V.ID + pNode->R()->V.ID), pNode); Changed = true; break;
+			case '-':ReplaceValue(Fraction((long long)pNode->L()->V.ID - pNode->R()->V.ID), pNode); Changed = true; break;
+			case '*':Changed |= RotateCoefficient(pNode); break;
+			case '/':
+				if (pNode->L()->V.ID && pNode->R()->V.ID)
 				{
-					auto Base = p->L();
-					p->L() = nullptr;
-					p->V = Token((int)1);
-					pNode->V = POW;
-					pNode->R() = pNode->L();
-					pNode->L() = Base;
+					auto G = std::gcd(pNode->L()->V.ID, pNode->R()->V.ID);
+					pNode->L()->V.ID /= G;
+					pNode->R()->V.ID /= G;
+				}
+				break;
+			case '^':
+			{
+				Fraction P;
+				if (Fraction(pNode->ID0()).Pow(pNode->ID1(), P))
+				{
+					ReplaceValue(P, pNode);
 					Changed = true;
-					break;
 				}
 			}break;
+			default:break;
+			}
 		}
-		case FUNC_ln:
+		else if ((Int0 || pNode->Ty0() == Token::Big) && (Int1 || pNode->Ty1() == Token::Big))
 		{
-			//ln(exp(f))=f
-			//ln(a^b)=b*ln(a)
-			TraverseType(pNode->L(), MUL, p)
+			auto A = ExtractConst(pNode->L()), B = ExtractConst(pNode->R());
+			switch (pNode->V.ID)
 			{
-				if (p->V == Exp())
+			case '+':ReplaceValue(A + B, pNode); Changed = true; break;
+			case '-':ReplaceValue(A - B, pNode); Changed = true; break;
+			case '*':Changed |= RotateCoefficient(pNode); break;
+			case '/':
+			{
+				//Only a fraction that reduces is replaced
+				auto Q = A / B;
+				if (!(Q.BigN() == A.BigN()))
 				{
-					auto Base = p->L();
-					p->L() = nullptr;
-					p->V = Token((int)1);
-					pNode->V = ADD;
-					pNode->L() = Ln(pNode->L());
-					pNode->R() = Base;
+					ReplaceValue(Q, pNode);
 					Changed = true;
-					break;
 				}
-			}
-			p = pNode->L();
-			if (p->V.IsPOW())
+			}break;
+			case '^':
 			{
-				auto U = p->R();
-				p->R() = Const(1);
-				pNode = U Mul pNode;
-				Changed = true;
+				//A large exponent is only folded by the 0 and 1 rules
+				Fraction P;
+				if (Int1 && A.Pow(pNode->ID1(), P))
+				{
+					ReplaceValue(P, pNode);
+					Changed = true;
+				}
 			}break;
+			default:break;
+			}
 		}
-		default:break;
-		}break;
+		//pow won't appear here so we don't need to consider it
 	}
-	case Token::Operator:
+	return Changed;
+}
+
+/**
+ * @brief Runs Simplify_FoldConst_Node on every node of the subtree, operands first
+ */
+bool Simplify_FoldConst(ExprNode*& pNode)
+{
+	return RewritePostOrder(pNode, Simplify_FoldConst_Node);
+}
+
+
+bool Simplify_MonomialImpl(ExprNode*& pNode)
+{
+	bool Changed = false;
+	Changed |= Simplify_MergePower(pNode);
+	Changed |= Simplify_All01(pNode);
+	Changed |= Simplify_Neg(pNode);
+	Changed |= Simplify_TopNeg(pNode);
+	return Changed;
+}
+
+/**
+ * @brief Phase I monomial simplification (structural)
+ * @param pNode[in,out] Monomial expression root node
+ * @return bool True if monomial structure was modified
+ *
+ * - Merges identical factors in products
+ * - Eliminates 1 coefficients
+ * - Orders factors in canonical sequence
+ */
+bool Simplify_Monomial_I(ExprNode*& pNode)
+{
+	bool Simplify_Polynomial(ExprNode * &pNode);
+	bool Changed = false;
+	//The caller may have rewritten nodes in place since they were hashed
+	InvalidateHashes();
+	WalkStack<ExprNode**> S;
+	if (pNode)S.Push(&pNode);
+	while (!S.Empty())
 	{
-		switch (pNode->V.ID)
+		auto pp = S.Pop();
+		if ((*pp)->V == ADD)
 		{
-		case '/':
-			//sin(x)/cos(x)=tan(x)
-			if (pNode->V0() == Sin() && pNode->V1() == Cos()
-				&& Equal(pNode->L()->L(), pNode->R()->L()))
-			{
-				pNode->V = Tan();
-				auto X = pNode->L()->L();
-				ReleaseNode(pNode->L());
-				ReleaseTree(pNode->R());
-				pNode->L() = X;
-				Changed = true;
-				break;
-			}
-			//cos(x)/sin(x)=1/tan(x)
-			else if (pNode->V0() == Cos() && pNode->V1() == Sin()
-				&& Equal(pNode->L()->L(), pNode->R()->L()))
+			Changed |= RewriteUnlessSettled(*pp, SettledPolynomial, Simplify_Polynomial);
+		}
+		else
+		{
+			auto p = *pp;
+			if (p->L())Changed |= RewriteUnlessSettled(p->L(), SettledMonomial, Simplify_MonomialImpl);
+			if (p->R())Changed |= RewriteUnlessSettled(p->R(), SettledMonomial, Simplify_MonomialImpl);
+			// The left operand is finished before the right one
+			if (p->R())S.Push(&p->R());
+			if (p->L())S.Push(&p->L());
+		}
+	}
+	//The nodes above the rewritten subtrees hold stale hashes
+	InvalidateHashes();
+	return Changed;
+}
+
+/**
+ * @brief Phase II monomial simplification (coefficient)
+ * @param pNode[in,out] Monomial expression root node
+ * @return pair<bool, Fraction> (modified, coefficient)
+ *
+ * - Extracts numerical coefficient from monomial
+ * - Normalizes coefficient position (always leftmost)
+ * - Returns extracted coefficient and modification status
+ */
+std::pair<bool, Fraction> Simplify_Monomial_II(ExprNode*& pNode)
+{
+	auto&& [Changed, F] = ExtractCoefficient(pNode);
+	InvalidateHashes();
+	Changed |= RewriteUnlessSettled(pNode, SettledMonomial, Simplify_MonomialImpl);
+	InvalidateHashes();
+	return { Changed,F };
+}
+
+/**
+ * @brief Phase III monomial simplification (final)
+ * @param pNode[in,out] Monomial expression root node
+ * @return bool True if final optimizations applied
+ *
+ * - Applies sign normalization
+ * - Removes redundant exponent of 1
+ * - Ensures consistent monomial representation
+ */
+bool Simplify_Monomial_III(ExprNode*& pNode)
+{
+	bool Changed = false;
+	Changed |= Simplify_All01(pNode);
+	Changed |= Simplify_Neg(pNode);
+	Changed |= Simplify_TopNeg(pNode);
+	return Changed;
+}
+
+/**
+ * @brief Simplifies polynomial expressions
+ * @param pNode[in,out] Root node of polynomial expression
+ * @return bool True if polynomial terms were combined
+ *
+ * - Combines like terms, constants included, in a SparsePolynomial
+ * - Factors common subexpressions across terms
+ * - Orders terms in canonical sequence
+ */
+bool Simplify_Polynomial(ExprNode*& pNode)
+{
+	if (!pNode)return false;
+	bool Changed = false;
+
+	//STAGE I
+	TraverseTypeLocal(C, pNode, ADD, p)
+	{
+		if (!p->IsConst()) Changed |= Simplify_Monomial_I(p);
+	}
+
+	//STAGE II
+	ScratchList<Fraction> Coefficients;
+	TraverseTypeLocal(D, pNode, ADD, q)
+	{
+		//Radicals stay atoms, other constants leave 1 behind like a coefficient
+		if (q->IsConst() && (D.size() == 1 || !q->IsConstII()))
+		{
+			Coefficients.emplace_back(1);
+			continue;
+		}
+		if (q->IsConstII())
+		{
+			Coefficients.push_back(ExtractCoefficient(q).second);
+			continue;
+		}
+		auto q1 = CreateNode(); q1->Copy(q);
+		auto&& [C, F] = Simplify_Monomial_II(q1);
+		Changed |= C;
+		q->Copy(q1); ReleaseNode(q1);
+		if constexpr (EnableDebugSimplifyII) { printf("PushCoeff: "); F.ToNode()->PrintTree(); putchar('\n'); }
+		Coefficients.push_back(F);
+	}
+
+	//STAGE III
+	//The terms were rewritten above. Stage IV hashes their factors right after
+	//this stage, before anything else changes, so it reuses these hashes
+	InvalidateHashes();
+	if (D.size() > 1)
+	{
+		//Like terms are merged in the sparse form, including the constant terms
+		SparsePolynomial P;
+		for (size_t I = 0; I < D.size(); I++)P.AddTerm(D[I], Coefficients[I], I);
+		P.Normalize();
+
+		//The first term with a monomial already spells it out, unless it was merged.
+		//All the new trees are built before any term is released, since the atoms
+		//are borrowed from the terms
+		ScratchList<ExprNode*> Rebuilt;
+		for (size_t I = 0; I < D.size(); I++)Rebuilt.push_back(nullptr);
+		ScratchList<char> Kept;
+		for (size_t I = 0; I < D.size(); I++)Kept.push_back(false);
+		for (auto& T : P.Terms)
+		{
+			Kept[T.First] = true;
+			Coefficients[T.First] = T.Coef;
+			if (T.Begin == T.End)
 			{
-				pNode->V1() = Tan();
-				ReleaseTree(pNode->L());
-				pNode->L() = Const(1);
-				Changed = true;
-				break;
+				Rebuilt[T.First] = T.Coef.ToNode();
+				Coefficients[T.First] = Fraction(1);
 			}
-			break;
-		case '+':
-			//sin(x)^2+cos(x)^2=1
-			//cos(x)^2+sin(x)^2=1
-			if (pNode->L()->IsSquare() && pNode->R()->IsSquare()
-				&& ((pNode->L()->V0() == Sin() && pNode->R()->V0() == Cos()) || (pNode->L()->V0() == Cos() && pNode->R()->V0() == Sin()))
-				&& Equal(pNode->L()->L()->L(), pNode->R()->L()->L()))
+			else if (T.Count > 1)
 			{
-				ReleaseTree(pNode);
-				pNode = Const(1);
-				Changed = true;
-				break;
+				//Stage V skips constant terms, merged radicals take their coefficient here
+				Rebuilt[T.First] = P.ToNode(T);
+				if (Rebuilt[T.First]->IsConst())
+				{
+					Rebuilt[T.First] = T.Coef.ToNode() Mul Rebuilt[T.First];
+					Coefficients[T.First] = Fraction(1);
+				}
 			}
-			//sinh^2+1=cosh^2
-			else if (pNode->V1() == Token(int(1))
-				&& pNode->L()->IsSquare()
-				&& pNode->L()->V0() == Sinh())
+			Changed |= T.Count > 1;
+		}
+		for (size_t I = 0; I < D.size(); I++)
+		{
+			if (Kept[I] && !Rebuilt[I])continue;
+			ReleaseTree(D[I]->L());
+			ReleaseTree(D[I]->R());
+			ClearNode(D[I]);
+			if (Rebuilt[I])
 			{
-				pNode->L()->L()->V = Cosh();
-				ReleaseNode(pNode);
-				ReleaseNode(pNode->R());
-				pNode = pNode->L();
-				Changed = true;
-				break;
+				D[I]->Copy(Rebuilt[I]);
+				ReleaseNode(Rebuilt[I]);
 			}
-			//1+sinh^2=cosh^2
-			else if (pNode->V0() == Token(int(1))
-				&& pNode->R()->IsSquare()
-				&& pNode->R()->V0() == Sinh())
+			else
 			{
-				pNode->R()->L()->V = Cosh();
-				ReleaseNode(pNode);
-				ReleaseNode(pNode->L());
-				pNode = pNode->R();
+				D[I]->V = Token(int(0));
+				Coefficients[I] = Fraction(0);
 				Changed = true;
-				break;
 			}
-			break;
-		case '-':
-			//cosh^2-sinh^2=1
-			if (pNode->L()->IsSquare() && pNode->R()->IsSquare()
-				&& pNode->L()->V0() == Cosh() && pNode->R()->V0() == Sinh()
-				&& Equal(pNode->L()->L()->L(), pNode->R()->L()->L()))
+		}
+	}
+
+	//STAGE IV
+	{
+		//x*y+x*z+x*w=x*(y+z+w)
+		//The terms holding a factor are found through its posting list, a run of
+		//(factor, term) pairs sorted by factor, instead of comparing every pair
+		ScratchList<FactorMap> Factors;
+		for (size_t I = 0; I < D.size(); I++)
+		{
+			Factors.emplace_back();
+			if (!D[I]->IsConst())FillFactorMap(D[I], Factors[I]);
+		}
+		ScratchList<HashedOperand> Postings;
+		for (size_t I = 0; I < D.size(); I++)
+			for (auto& [H, pp] : Factors[I])Postings.push_back({ H, I });
+		std::sort(Postings.begin(), Postings.end());
+		ScratchList<std::pair<size_t, size_t>> Lists;
+		for (size_t B = 0, E; B < Postings.size(); B = E)
+		{
+			for (E = B + 1; E < Postings.size() && Postings[E].Hash == Postings[B].Hash; E++);
+			if (E - B > 1)Lists.emplace_back(B, E);
+		}
+		//A factor shared by more terms is taken first, ties go to the earlier term
+		std::sort(Lists.begin(), Lists.end(), [&](const std::pair<size_t, size_t>& A, const std::pair<size_t, size_t>& B)
 			{
-				ReleaseTree(pNode);
-				pNode = Const(1);
-				Changed = true;
-				break;
+				if (A.second - A.first != B.second - B.first)return A.second - A.first > B.second - B.first;
+				auto& PA = Postings[A.first];
+				auto& PB = Postings[B.first];
+				return PA.Index != PB.Index ? PA.Index < PB.Index : PA.Hash < PB.Hash;
+			});
+
+		//Every term is factored at most once, together with all the other terms
+		//left in the list of the factor
+		ScratchList<char> Factored;
+		for (size_t I = 0; I < D.size(); I++)Factored.push_back(false);
+		for (auto& [B, E] : Lists)
+		{
+			ScratchList<size_t> Group;
+			for (size_t K = B; K < E; K++)
+				if (!Factored[Postings[K].Index])Group.push_back(Postings[K].Index);
+			if (Group.size() < 2)continue;
+
+			//The factors of the first term that every other term has as well
+			ScratchList<ExprHash> Common;
+			for (auto& [H, pp] : Factors[Group[0]])
+			{
+				bool Shared = true;
+				for (size_t K = 1; K < Group.size() && Shared; K++)Shared = Factors[Group[K]].Find(H) != nullptr;
+				if (Shared)Common.push_back(H);
 			}
-			//1-sin^2=cos^2
-			else if (pNode->V0() == Token(int(1))
-				&& pNode->R()->IsSquare()
-				&& pNode->R()->V0() == Sin())
+			//The map iterates in slot order, sort by hash to keep the output stable
+			std::sort(Common.begin(), Common.end());
+
+			//Each term without the common factors, they are set to 1 while it is copied
+			ExprNode* Sum = nullptr;
+			for (auto I : Group)
 			{
-				pNode->R()->L()->V = Cos();
-				ReleaseNode(pNode);
-				ReleaseNode(pNode->L());
-				pNode = pNode->R();
-				Changed = true;
-				break;
+				ScratchList<ExprNode*> Saved;
+				for (auto H : Common)
+				{
+					auto pp = *Factors[I].Find(H);
+					Saved.push_back(*pp);
+					*pp = Const(1);
+				}
+				auto Rest = Coefficients[I].ToNode() Mul D[I]->Duplicate();
+				for (size_t K = 0; K < Common.size(); K++)
+				{
+					auto pp = *Factors[I].Find(Common[K]);
+					ReleaseNode(*pp);
+					*pp = Saved[K];
+				}
+				Sum = Sum ? (Sum Add Rest) : Rest;
 			}
-			//1-cos^2=sin^2
-			else if (pNode->V0() == Token(int(1))
-				&& pNode->R()->IsSquare()
-				&& pNode->R()->V0() == Cos())
+			ExprNode* F;
 			{
-				pNode->R()->L()->V = Sin();
-				ReleaseNode(pNode);
-				ReleaseNode(pNode->L());
-				pNode = pNode->R();
-				Changed = true;
-				break;
+				ScratchList<ExprNode*> BuildRaw;
+				for (auto H : Common)BuildRaw.push_back((**Factors[Group[0]].Find(H))->Duplicate());
+				F = DuplicateFactorImpl(BuildRaw, 0, (int)BuildRaw.size());
 			}
-			//cosh^2-1=sinh^2
-			else if (pNode->V1() == Token(int(1))
-				&& pNode->L()->IsSquare()
-				&& pNode->L()->V0() == Cosh())
+
+			auto K = F Mul Sum;
+			if constexpr (EnableDebugSimplifyII) { printf("OrigK: "); K->PrintTree(); putchar('\n'); }
+			Simplify(K);
+			if constexpr (EnableDebugSimplifyII) { printf("SimpK: "); K->PrintTree(); putchar('\n'); }
+
+			//The group is replaced by its last term
+			for (auto I : Group)
 			{
-				pNode->L()->L()->V = Sinh();
-				ReleaseNode(pNode);
-				ReleaseNode(pNode->R());
-				pNode = pNode->L();
-				Changed = true;
-				break;
+				Factored[I] = true;
+				ReleaseTree(D[I]->L());
+				ReleaseTree(D[I]->R());
+				ClearNode(D[I]);
+				D[I]->V = Token(int(0));
+				Coefficients[I] = Fraction(0);
 			}
-			break;
-		default:break;
-		}break;
+			auto Last = Group[Group.size() - 1];
+			D[Last]->Copy(K);
+			ReleaseNode(K);
+			Coefficients[Last] = Fraction(1);
+			Changed = true;
+		}
 	}
-	default:break;
+
+	//STAGE V
+	for (size_t I = 0; I < D.size(); I++)
+	{
+		if (D[I]->IsConst())continue;
+		auto U = CreateNode(); U->Copy(D[I]);
+		if constexpr (EnableDebugSimplifyII) { printf("Before: "); U->PrintTree(); putchar('\n'); }
+		if constexpr (EnableDebugSimplifyII) { printf("Coeff: "); Coefficients[I].ToNode()->PrintTree(); putchar('\n'); }
+		auto V = Coefficients[I].ToNode() Mul U;
+		Simplify_Monomial_III(V);
+		if constexpr (EnableDebugSimplifyII) { printf("After: "); V->PrintTree(); putchar('\n'); }
+		D[I]->Copy(V);
 	}
 	return Changed;
 }
 
 /**
- * @brief Normalizes negative sign distribution
- * @param pNode[in,out] Root node of the expression subtree
- * @return bool True if any negation pattern was modified
+ * @brief Final normalization of negative signs in the expression
+ * @param pNode[in,out] Root node of the expression tree
  *
- * - Converts subtraction to addition with negative coefficients
- * - Simplifies double negatives (-(-x) -> x)
- * - Moves negative signs to canonical positions in products
+ * - Converts nested negations to positive terms (-(-x) -> x)
+ * - Moves negative coefficients to canonical positions
+ * - Simplifies multiplication/division with negative signs
  */
-bool Simplify_Neg(ExprNode*& pNode)
+bool FinalFold_Neg_Node(ExprNode*& pNode)
 {
 	if (!pNode)return false;
 	bool Changed = false;
-	Changed |= Simplify_Neg(pNode->L());
-	Changed |= Simplify_Neg(pNode->R());
 	switch (pNode->V.Ty)
 	{
 	case Token::Operator:
 	{
-		switch (pNode->V.ID)
+		//x^((-1)*y)=1/x^y
+		if (pNode->V.ID == '^')
 		{
-		case '-':
+			bool Neg = false;
+			TraverseType(pNode->R(), MUL, p)
+			{
+				if (p->V.Ty == Token::Int && p->V.ID < 0)
+				{
+					Neg = !Neg;
+					p->V.ID = -p->V.ID;
+					Changed = true;
+				}
+			}
+			if (Neg)pNode = Const(1) Div pNode;
+		}
+		else if (pNode->V.ID == '+')
 		{
-			//a-b=a+(-1)*b
-			//a-(-1)*b=a+b
 			bool NegR = false;
 			TraverseType(pNode->R(), MUL, p)
 			{
@@ -2963,56 +6308,73 @@ bool Simplify_Neg(ExprNode*& pNode)
 					Changed = true;
 				}
 			}
-			pNode->V.ID = '+';
-			if (!NegR)pNode->R() = Const(-1) Mul pNode->R();
-			break;
-		}
-		case '*':
-		{
-			//C*(a+b)=C*a+C*b
-			if (pNode->Ty0() == Token::Int && pNode->V1() == ADD)
+			bool NegL = false;
+			TraverseType(pNode->L(), MUL, q)
 			{
-				auto p = pNode->R();
-				auto C = pNode->L();
-				p->L() = C Mul p->L();
-				p->R() = C->Duplicate() Mul p->R();
-				ReleaseNode(pNode);
-				pNode = p;
+				if (q->V.Ty == Token::Int && q->V.ID < 0)
+				{
+					NegL = !NegL;
+					q->V.ID = -q->V.ID;
+					Changed = true;
+				}
 			}
-			//(a+b)*C=C*a+C*b
-			else if (pNode->Ty1() == Token::Int && pNode->V0() == ADD)
+			if (NegL)
 			{
-				auto p = pNode->L();
-				auto C = pNode->R();
-				p->L() = C Mul p->L();
-				p->R() = C->Duplicate() Mul p->R();
-				ReleaseNode(pNode);
-				pNode = p;
+				if (NegR)
+				{
+					//(-1)*a+(-1)*b=(-1)*(a+b)
+					pNode = Const(-1) Mul pNode;
+				}
+				else
+				{
+					//(-1)*a+b=b-a
+					pNode->V.ID = '-';
+					std::swap(pNode->L(), pNode->R());
+				}
+			}
+			else if (NegR)
+			{
+				//a+(-1)*b=a-b
+				pNode->V.ID = '-';
 			}
-			break;
 		}
-		case '/':
+		else if (pNode->V.ID == '-')
 		{
-			pNode->V.ID = '*';
+			bool NegR = false;
 			TraverseType(pNode->R(), MUL, p)
 			{
-				//C/x^y=C*x^((-1)*y)
-				if (p->V == POW)
-					p->R() = Const(-1) Mul p->R();
-				//C/exp(x)=C*exp(-1*x)
-				else if (p->V == Exp())
-					p->L() = Const(-1) Mul p->L();
-				//C/x=C*x^(-1)
+				if (p->V.Ty == Token::Int && p->V.ID < 0)
+				{
+					NegR = !NegR;
+					p->V.ID = -p->V.ID;
+					Changed = true;
+				}
+			}
+			bool NegL = false;
+			TraverseType(pNode->L(), MUL, q)
+			{
+				if (q->V.Ty == Token::Int && q->V.ID < 0)
+				{
+					NegL = !NegL;
+					q->V.ID = -q->V.ID;
+					Changed = true;
+				}
+			}
+			/*
+			 a-(-1)*b=a+b
+			(-1)*a-b=(-1)*(a+b)
+			(-1)*a-(-1)*b=b-a
+			*/
+			if (NegL)
+			{
+				if (NegR)std::swap(pNode->L(), pNode->R());
 				else
 				{
-					auto M = CreateNode(); M->Copy(p);
-					auto Q = M Pwr Const(-1);
-					p->Copy(Q);
+					pNode->V.ID = '+';
+					pNode = Const(-1) Mul pNode;
 				}
 			}
-			break;
-		}
-		default:break;
+			else if (NegR)pNode->V.ID = '+';
 		}
 		break;
 	}
@@ -3022,7 +6384,7 @@ bool Simplify_Neg(ExprNode*& pNode)
 		{
 			/*
 			sin(-1*x)=-1*sin(x)
-			sinh(-1*x)=-1*sinh(x)
+			cos(-1*x)=cos(x)
 			tan(-1*x)=-1*tan(x)
 			*/
 		case FUNC_sin:
@@ -3043,7 +6405,7 @@ bool Simplify_Neg(ExprNode*& pNode)
 			break;
 		}
 		/*
-		cos(-1*x)=cos(x)
+		sinh(-1*x)=-1*sinh(x)
 		cosh(-1*x)=cosh(x)
 		*/
 		case FUNC_cos:
@@ -3063,6 +6425,22 @@ bool Simplify_Neg(ExprNode*& pNode)
 		pow(x,-1*y)=1/x^y
 		exp(-1*x)=1/exp(x)
 		*/
+		case FUNC_exp:
+		case FUNC_pow:
+		{
+			bool Neg = false;
+			TraverseType(pNode->L(), MUL, p)
+			{
+				if (p->V.Ty == Token::Int && p->V.ID == -1)
+				{
+					Neg = !Neg;
+					p->V.ID = 1;
+					Changed = true;
+				}
+			}
+			if (Neg)pNode = Const(1) Div pNode;
+			break;
+		}
 		default:break;
 		}
 		break;
@@ -3073,672 +6451,1228 @@ bool Simplify_Neg(ExprNode*& pNode)
 }
 
 /**
- * @brief Handles top-level negation expressions
- * @param pNode[in,out] Root node of the entire expression
- * @return bool True if top-level negation was optimized
+ * @brief Runs FinalFold_Neg_Node on every node of the subtree, operands first
+ */
+bool FinalFold_Neg(ExprNode*& pNode)
+{
+	return RewritePostOrder(pNode, FinalFold_Neg_Node);
+}
+
+/**
+ * @brief Extracts greatest common divisor from monomial terms
+ * @param pNode[in,out] Root node of monomial expression
  *
- * - Converts -(a+b) -> -a-b style distributions
- * - Eliminates unnecessary top-level negative signs
- * - Ensures negation only applies to atomic terms
+ * - Operates on single-term expressions (e.g., 4x^2*y)
+ * - Factorizes numerical coefficients (4x^2*y -> 4*(x^2*y))
+ * - Preserves variable structure during GCD extraction
  */
-bool Simplify_TopNeg(ExprNode*& pNode)
+void FinalFold_GCDMono(ExprNode*& pNode)
 {
-	bool Changed = false;
-	if (pNode->V == MUL)
+	void FinalFold_GCDPoly(ExprNode * &pNode);
+	WalkStack<ExprNode**> S;
+	if (pNode)S.Push(&pNode);
+	while (!S.Empty())
 	{
-		bool Neg = false;
-		bool FirstNeg = false;
-		TraverseType(pNode, MUL, p)
+		auto pp = S.Pop();
+		if ((*pp)->V == ADD)
 		{
-			if (p->V.Ty == Token::Int && p->V.ID == -1)
-			{
-				if (_I)
-				{
-					p->V.ID = 1;
-					Neg = !Neg;
-					Changed = true;
-				}
-				else FirstNeg = true;
-			}
+			FinalFold_GCDPoly(*pp);
 		}
-		if (Neg)
+		else
 		{
-			//-1*(-1)*a=a
-			if (FirstNeg)TraverseSeries[0]->V.ID = 1;
-			//a*(-b)=-1*a*b
-			else pNode = Const(-1) Mul pNode;
+			if ((*pp)->R())S.Push(&(*pp)->R());
+			if ((*pp)->L())S.Push(&(*pp)->L());
 		}
 	}
-	return Changed;
 }
 
 /**
- * @brief Evaluates constant subexpressions
- * @param pNode[in,out] Root node of the expression subtree
- * @return bool True if any constant folding occurred
+ * @brief Merges identical factors in multiplication expressions
+ * @param pNode[in,out] Root node of multiplicative expression
+ * @param Tg[in,out] Hash map tracking factor occurrences 
  *
- * - Computes arithmetic results for constant operations
- * - Reduces 2+3 -> 5 type evaluations
- * - Handles power-of-constant computations
+ * - Combines identical base factors (x*x -> x^2)
+ * - Uses hash matching for rapid duplicate detection
+ * - Maintains expression structure integrity
  */
-bool Simplify_FoldConst(ExprNode*& pNode)
+void FinalFold_MergeSame(ExprNode*& pNode, FactorMap& Tg)
 {
-	if (!pNode)return false;
-	//printf("\nFoldConst: "); pNode->PrintTree();
-	bool Changed = false;
-	Changed |= Simplify_FoldConst(pNode->L());
-	Changed |= Simplify_FoldConst(pNode->R());
-	if (pNode->V.Ty == Token::Operator)
+	//y^x*z^x=(y*z)^x
+	WalkStack<ExprNode**> S;
+	S.Push(&pNode);
+	while (!S.Empty())
 	{
-		if (pNode->Ty0() == Token::Int && pNode->Ty1() == Token::Int)
+		auto pp = S.Pop();
+		auto p = *pp;
+		if (p->V == MUL)
 		{
-			switch (pNode->V.ID)
+			S.Push(&p->R());
+			S.Push(&p->L());
+		}
+		else if (p->V == POW)
+		{
+			auto H = p->R()->Hash();
+			auto it = Tg.Find(H);
+			if (!it)Tg[H] = pp;
+			else
 			{
-			case '+':ReplaceInt(pNode->L()->V.ID + pNode->R()->V.ID, pNode); Changed = true; break;
-			case '-':ReplaceInt(pNode->L()->V.ID - pNode->R()->V.ID, pNode); Changed = true; break;
-			case '*':Changed |= RotateCoefficient(pNode); break;
-			case '/':
-				if (pNode->L()->V.ID && pNode->R()->V.ID)
-				{
-					auto G = std::gcd(pNode->L()->V.ID, pNode->R()->V.ID);
-					pNode->L()->V.ID /= G;
-					pNode->R()->V.ID /= G;
-				}
-				break;
-			case '^':
-				if (pNode->ID1() > 0)ReplaceInt(int(pow(pNode->ID0(), pNode->ID1())), pNode);
-				else if (pNode->ID1() == 0)ReplaceInt(1, pNode);//Filter generated x^0 after Simplify_01
-				else
-				{
-					ReplaceInt(int(pow(pNode->ID0(), -pNode->ID1())), pNode);
-					pNode = Const(1) Div pNode;
-				}
-				Changed = true; break;
-			default:break;
+				auto T = **it;//y^x z^x
+				T->L() = T->L() Mul p->L();//y^x z^x -> //(y*z)^x z^x
+				p->L() = Const(1);//(y*z)^x 1^x
 			}
 		}
-		//pow won't appear here so we don't need to consider it
 	}
-	return Changed;
 }
 
+/**
+ * @brief Optimizes power expressions through exponent merging
+ * @param pNode[in,out] Root node containing power terms
+ *
+ * - Applies power rules (x^a * x^b -> x^(a+b))
+ * - Handles nested power structures ((x^a)^b -> x^(a*b))
+ * - Normalizes power distribution over multiplication
+ */
+void FinalFold_MergePower(ExprNode* pNode)
+{
+	FactorMap T;
+	auto K = CreateNode(); K->Copy(pNode);
+	InvalidateHashes();
+	FinalFold_MergeSame(K, T);
+	pNode->Copy(K);
+	ReleaseNode(K);
+}
 
-bool Simplify_MonomialImpl(ExprNode*& pNode)
+/**
+ * @brief Factors out GCD from polynomial expressions
+ * @param pNode[in,out] Root node of polynomial expression
+ *
+ * - Analyzes all terms in additive expressions
+ * - Extracts numerical and variable common factors
+ * - Restructures expression with factored-out GCD
+ */
+void FinalFold_GCDPoly(ExprNode*& pNode)
 {
-	bool Changed = false;
-	Changed |= Simplify_MergePower(pNode);
-	Changed |= Simplify_All01(pNode);
-	Changed |= Simplify_Neg(pNode);
-	Changed |= Simplify_TopNeg(pNode);
-	return Changed;
+	if (!pNode)return;
+	if (pNode->V == Token(int(0)))return;
+	TraverseTypeLocal(C, pNode, ADD, p)
+		FinalFold_GCDMono(p);
+	ScratchList<Fraction> Coefficients;
+	TraverseTypeLocal(D, pNode, ADD, q)
+	{
+		Coefficients.push_back(ExtractCoefficient(q).second);
+		FinalFold_MergePower(q);
+		if constexpr (EnableDebugSimplifyII) { printf("Coefficient %s\n", Coefficients.back().ToString().c_str()); }
+	}
+	auto Tg = ExtractGCD(Coefficients.begin(), Coefficients.end());
+	for (size_t I = 0; I < D.size(); I++)
+	{
+		auto U = CreateNode();
+		U->Copy(D[I]);
+		auto F = Tg == 0 ? Fraction(0) : Coefficients[I] / Tg;
+		if (Tg == 0)
+		{
+			if (!DividedbyZero)puts("Runtime Error: Divided by 0");
+			DividedbyZero = true;
+			return;
+		}
+		auto V = F.ToNode() Mul U;
+		D[I]->Copy(V);
+	}
+	pNode = Tg.ToNode() Mul pNode;
 }
 
 /**
- * @brief Phase I monomial simplification (structural)
- * @param pNode[in,out] Monomial expression root node
- * @return bool True if monomial structure was modified
+ * @brief Final simplification pass with GCD factoring and negation cleanup
+ * @param pNode[in,out] Root node of the fully processed expression
+ */
+void FinalFold(ExprNode*& pNode)
+{
+	if (!pNode)return;
+	FinalFold_GCDPoly(pNode);
+	FinalFold_Neg(pNode);
+	Simplify_TopNeg(pNode);
+	bool Changed;
+
+	// Repeat until no more constant folding possible
+	do
+	{
+		Changed = false;
+		Changed |= Simplify_FoldConst(pNode);//Combine generated Const above
+		Changed |= Simplify_All01(pNode);//Remove generated 01 above
+	} while (Changed);
+}
+
+/**
+ * @brief Simplifies the expression tree rooted at the given node.
+ *
+ * @param pNode The root node of the subtree to be simplified.
+ */
+void Simplify(ExprNode*& pNode)
+{
+	std::set<ExprHash> Occurred;
+	++SimplifyDepth;
+	// Nested calls come from the passes themselves and stay on the pipeline
+	if (Opt.EGraph && SimplifyDepth == 1)
+	{
+		Simplify_EGraph(pNode);
+		InvalidateHashes();
+		FinalFold(pNode);
+		UpdateTreeDeps(pNode);
+		--SimplifyDepth;
+		return;
+	}
+	if constexpr (EnableDebugSimplifyI) { printf("\nInitial: "); pNode->PrintTree(); }
+	do
+	{
+		Simplify_All01(pNode);         
+		if constexpr (EnableDebugSimplifyI) { printf("\nAll01: "); pNode->PrintTree(); putchar('\n'); }
+		Simplify_Neg(pNode);           
+		if constexpr (EnableDebugSimplifyI) { printf("\nNeg: "); pNode->PrintTree(); putchar('\n'); }
+		Simplify_TopNeg(pNode);        
+		if constexpr (EnableDebugSimplifyI) { printf("\nTNeg: "); pNode->PrintTree(); putchar('\n');}
+		InvalidateHashes();
+		Simplify_SpecialFuncs(pNode);  
+		if constexpr (EnableDebugSimplifyI) { printf("\nSpFn: "); pNode->PrintTree(); putchar('\n'); }
+		Simplify_Polynomial(pNode);    
+		if constexpr (EnableDebugSimplifyI) { printf("\nPoly: "); pNode->PrintTree(); putchar('\n'); }
+		Simplify_FoldConst(pNode);     
+		if constexpr (EnableDebugSimplifyI) { printf("\nFold: "); pNode->PrintTree(); putchar('\n'); }
+		// Nested calls hold pointers into the tree of their caller
+		if (SimplifyDepth == 1)CompactNodesIfSparse();
+		InvalidateHashes();
+	} // Loop until hash stabilizes
+	while (Occurred.insert(pNode->Hash()).second);
+
+	FinalFold(pNode);
+
+	if constexpr (EnableDebugSimplifyI) { printf("\nFinal: "); pNode->PrintTree(); putchar('\n'); }
+	// The passes rewrite nodes in place without maintaining DepMask
+	UpdateTreeDeps(pNode);
+	--SimplifyDepth;
+}
+
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+//---------------------E-GRAPH SIMPLIFICATION----------------------
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+
+/*
+- Purpose: The rewrite rules of the e-graph engine as "pattern=>replacement".
+- Usage: Parsed once by EGraphRuleSet. The letters a,b,x,y,z are pattern
+		 variables, numbers match any class with that constant value.
+		 The rules that only simplify come first, so they are applied
+		 before the budget runs out; the reordering rules come last.
+*/
+const char* const EGraphRules[] =
+{
+	// Simplify_01
+	"x+0=>x", "x-0=>x", "0-x=>(-1)*x", "x*0=>0", "x*1=>x", "0/x=>0", "x/1=>x",
+	"x^0=>1", "0^x=>0", "1^x=>1", "x^1=>x",
+	"ln(1)=>0", "exp(0)=>1", "cos(0)=>1", "cosh(0)=>1", "sin(0)=>0", "tan(0)=>0", "sinh(0)=>0",
+	// Simplify_SpecialFuncs
+	"exp(ln(x))=>x", "exp(a*ln(x))=>x^a", "ln(exp(x))=>x", "ln(x^a)=>a*ln(x)",
+	"sin(x)/cos(x)=>tan(x)", "cos(x)/sin(x)=>1/tan(x)",
+	"sin(x)^2+cos(x)^2=>1", "sinh(x)^2+1=>cosh(x)^2", "cosh(x)^2-sinh(x)^2=>1",
+	"1-sin(x)^2=>cos(x)^2", "1-cos(x)^2=>sin(x)^2", "cosh(x)^2-1=>sinh(x)^2",
+	// Simplify_Polynomial
+	"x-x=>0", "x/x=>1", "x+x=>2*x", "x*a+x=>x*(a+1)", "x*a+x*b=>x*(a+b)",
+	"x*x=>x^2", "x^a*x=>x^(a+1)", "x^a*x^b=>x^(a+b)", "x^a/x=>x^(a-1)",
+	// Simplify_Rotate and Simplify_Neg
+	"pow(x,y)=>x^y", "log(x,y)=>ln(y)/ln(x)", "(x^a)^b=>x^(a*b)",
+	"x+(y-z)=>(x+y)-z", "(x-y)+z=>(x+z)-y", "x-(y-z)=>(x+z)-y", "(x-y)-z=>x-(y+z)",
+	"x*(y/z)=>(x*y)/z", "(x/y)*z=>(x*z)/y", "(x*y)/z=>x*(y/z)", "x/(y/z)=>(x*z)/y", "(x/y)/z=>x/(y*z)",
+	"x-y=>x+(-1)*y", "x+(-1)*y=>x-y",
+	// Reordering
+	"x+y=>y+x", "x*y=>y*x", "(x+y)+z=>x+(y+z)", "x+(y+z)=>(x+y)+z",
+	"(x*y)*z=>x*(y*z)", "x*(y*z)=>(x*y)*z", "x*(y+z)=>x*y+x*z",
+};
+
+/**
+ * @brief The parsed rewrite rules of the e-graph engine.
+ *
+ * A pattern is a small tree stored in Nodes. A node is a pattern variable, a
+ * constant, or a token over its operand patterns.
+ */
+struct EGraphRuleSet
+{
+	///< The most pattern variables one rule may use.
+	static constexpr int MaxVars = 6;
+	struct PatternNode
+	{
+		Token V;
+		///< The index of the pattern variable, -1 if this is not one.
+		int Var;
+		///< The operand patterns, -1 if absent.
+		int L, R;
+	};
+	struct Rule
+	{
+		int LHS, RHS;
+	};
+	std::vector<PatternNode> Nodes;
+	std::vector<Rule> Rules;
+
+	EGraphRuleSet()
+	{
+		for (auto Text : EGraphRules)
+		{
+			std::string Vars;
+			const char* Arrow = strstr(Text, "=>");
+			const char* p = Text;
+			int LHS = ParseSum(p, Vars);
+			p = Arrow + 2;
+			int RHS = ParseSum(p, Vars);
+			Rules.push_back({ LHS, RHS });
+		}
+	}
+
+private:
+	int AddPattern(Token V, int Var, int L, int R)
+	{
+		Nodes.push_back({ V, Var, L, R });
+		return (int)Nodes.size() - 1;
+	}
+	int ParseSum(const char*& p, std::string& Vars)
+	{
+		int L = ParseProduct(p, Vars);
+		while (*p == '+' || *p == '-')
+		{
+			char Opr = *p++;
+			L = AddPattern(Token(Opr), -1, L, ParseProduct(p, Vars));
+		}
+		return L;
+	}
+	int ParseProduct(const char*& p, std::string& Vars)
+	{
+		int L = ParsePower(p, Vars);
+		while (*p == '*' || *p == '/')
+		{
+			char Opr = *p++;
+			L = AddPattern(Token(Opr), -1, L, ParsePower(p, Vars));
+		}
+		return L;
+	}
+	int ParsePower(const char*& p, std::string& Vars)
+	{
+		int L = ParsePrimary(p, Vars);
+		if (*p != '^')return L;
+		++p;
+		return AddPattern(Token('^'), -1, L, ParsePower(p, Vars));
+	}
+	int ParsePrimary(const char*& p, std::string& Vars)
+	{
+		if (*p == '(')
+		{
+			++p;
+			// A negative constant is written as (-k)
+			if (*p == '-')
+			{
+				int K = -(int)strtol(p + 1, (char**)&p, 10);
+				++p;
+				return AddPattern(Token(K), -1, -1, -1);
+			}
+			int E = ParseSum(p, Vars);
+			++p;
+			return E;
+		}
+		if (isdigit(*p))return AddPattern(Token((int)strtol(p, (char**)&p, 10)), -1, -1, -1);
+		auto Begin = p;
+		while (isalpha(*p))++p;
+		if (p - Begin == 1)
+		{
+			auto Pos = Vars.find(*Begin);
+			if (Pos == std::string::npos)
+			{
+				Pos = Vars.size();
+				Vars.push_back(*Begin);
+			}
+			return AddPattern(Token(0), (int)Pos, -1, -1);
+		}
+		int Func = GetFuncID(Begin, p - Begin);
+		++p;
+		int L = ParseSum(p, Vars), R = -1;
+		if (*p == ',')
+		{
+			++p;
+			R = ParseSum(p, Vars);
+		}
+		++p;
+		return AddPattern(Token(Func, AsFuncID{}), -1, L, R);
+	}
+};
+
+/**
+ * @brief An e-graph: classes of equal terms over a shared set of e-nodes.
  *
- * - Merges identical factors in products
- * - Eliminates 1 coefficients
- * - Orders factors in canonical sequence
+ * An e-node is a token over the classes of its operands, so one e-node stands
+ * for every combination of the terms in those classes. Rewriting only adds
+ * e-nodes and merges classes, no term is ever lost, which makes the result
+ * independent of the order the rules are applied in. Each class also keeps
+ * its value when it is a rational constant, so constants fold as soon as the
+ * operands are known.
  */
-bool Simplify_Monomial_I(ExprNode*& pNode)
+class EGraph
 {
-	bool Simplify_Polynomial(ExprNode * &pNode);
-	if (!pNode)return false;
-	bool Changed = false;
-	if (pNode->V == ADD)
+public:
+	///< How many e-nodes saturation may add on top of the loaded tree.
+	static constexpr size_t NodeBudget = 20000;
+	///< How many rounds of matching and rewriting saturation may run.
+	static constexpr int IterLimit = 10;
+
+	/**
+	 * @brief Adds a tree to the e-graph.
+	 * @param pRoot The root node of the tree
+	 * @return int The class of the tree
+	 */
+	int AddTree(const ExprNode* pRoot);
+
+	/**
+	 * @brief Applies the rules until nothing changes or a budget is spent.
+	 * @param Rules The rules
+	 */
+	void Saturate(const EGraphRuleSet& Rules);
+
+	/**
+	 * @brief Builds the cheapest term of a class, counting about one per node.
+	 * @param Class The class
+	 * @return ExprNode* A new tree
+	 */
+	ExprNode* Extract(int Class);
+
+private:
+	struct ENode
+	{
+		Token V;
+		///< The classes of the operands, -1 if absent.
+		int A, B;
+		bool operator==(const ENode& R) const { return V == R.V && A == R.A && B == R.B; }
+	};
+	struct ENodeHash
+	{
+		size_t operator()(const ENode& N) const
+		{
+			return (size_t)TransformHash(N.V.Hash() + TransformHash((ExprHash)N.A) + (ExprHash)N.B);
+		}
+	};
+	using Subst = std::array<int, EGraphRuleSet::MaxVars>;
+	struct Match
+	{
+		int RHS;
+		int Class;
+		Subst S;
+	};
+
+	///< All e-nodes ever added, with the class each was added to.
+	std::vector<ENode> ENodes;
+	std::vector<int> NodeClass;
+	///< Union-find over the classes.
+	std::vector<int> Parent;
+	///< The distinct e-nodes of each class, valid for canonical classes after Rebuild.
+	std::vector<std::vector<int>> Members;
+	///< The constant value of each canonical class, if it has one.
+	std::vector<char> HasValue;
+	std::vector<Fraction> Value;
+	std::unordered_map<ENode, int, ENodeHash> Memo;
+
+	int Find(int C)
 	{
-		Changed |= Simplify_Polynomial(pNode);
+		while (Parent[C] != C)C = Parent[C] = Parent[Parent[C]];
+		return C;
 	}
-	else
+	ENode Canonical(int N)
 	{
-		if (pNode->L())Changed |= Simplify_MonomialImpl(pNode->L());
-		if (pNode->R())Changed |= Simplify_MonomialImpl(pNode->R());
-		Changed |= Simplify_Monomial_I(pNode->L());
-		Changed |= Simplify_Monomial_I(pNode->R());
+		auto E = ENodes[N];
+		if (E.A >= 0)E.A = Find(E.A);
+		if (E.B >= 0)E.B = Find(E.B);
+		return E;
+	}
+	int AddNode(Token V, int A, int B);
+	int AddValue(const Fraction& F);
+	bool NodeValue(const ENode& E, Fraction& Out);
+	bool Union(int C1, int C2);
+	void Rebuild();
+	bool FoldValues();
+	void MatchClass(const EGraphRuleSet& Rules, int P, int Class, const Subst& S, std::vector<Subst>& Out);
+	int Instantiate(const EGraphRuleSet& Rules, int P, const Subst& S);
+};
+
+/**
+ * @brief Computes the value of an e-node whose operands are constants
+ * @param E The e-node over canonical classes
+ * @param Out[out] The value
+ * @return bool False if the e-node has no known rational value
+ */
+bool EGraph::NodeValue(const ENode& E, Fraction& Out)
+{
+	if (E.V.Ty == Token::Int) { Out = Fraction(E.V.ID); return true; }
+	if (E.V.Ty == Token::Big) { Out = Fraction::FromBig(BigLiterals.Values[E.V.ID], 1); return true; }
+	if (E.A < 0 || E.B < 0 || !HasValue[E.A] || !HasValue[E.B] || (!E.V.IsPOW() && E.V.Ty != Token::Operator))return false;
+	auto& X = Value[E.A];
+	auto& Y = Value[E.B];
+	switch (E.V.IsPOW() ? '^' : E.V.ID)
+	{
+	case '+':Out = X + Y; return true;
+	case '-':Out = X - Y; return true;
+	case '*':Out = X * Y; return true;
+	case '/':
+		// Division by zero is left to the pipeline, which reports it
+		if (Y == 0)return false;
+		Out = X / Y;
+		return true;
+	case '^':
+		if (Y.Big || Y.D != 1 || (X == 0 && Y.N < 0))return false;
+		return X.Pow(Y.N, Out);
+	default:return false;
 	}
-	return Changed;
 }
 
 /**
- * @brief Phase II monomial simplification (coefficient)
- * @param pNode[in,out] Monomial expression root node
- * @return pair<bool, Fraction> (modified, coefficient)
- *
- * - Extracts numerical coefficient from monomial
- * - Normalizes coefficient position (always leftmost)
- * - Returns extracted coefficient and modification status
+ * @brief Adds an e-node unless an equal one exists
+ * @param V The token
+ * @param A The class of the left operand, -1 if absent
+ * @param B The class of the right operand, -1 if absent
+ * @return int The class holding the e-node
  */
-std::pair<bool, Fraction> Simplify_Monomial_II(ExprNode*& pNode)
+int EGraph::AddNode(Token V, int A, int B)
 {
-	auto&& [Changed, F] = ExtractCoefficient(pNode);
-	Changed |= Simplify_MonomialImpl(pNode);
-	return { Changed,F };
+	ENode E{ V, A >= 0 ? Find(A) : -1, B >= 0 ? Find(B) : -1 };
+	auto It = Memo.find(E);
+	if (It != Memo.end())return Find(NodeClass[It->second]);
+	int N = (int)ENodes.size(), C = (int)Parent.size();
+	ENodes.push_back(E);
+	NodeClass.push_back(C);
+	Parent.push_back(C);
+	Members.push_back({ N });
+	Fraction F;
+	bool Known = NodeValue(E, F);
+	HasValue.push_back(Known);
+	Value.push_back(Known ? F : Fraction());
+	Memo.emplace(E, N);
+	return C;
 }
 
 /**
- * @brief Phase III monomial simplification (final)
- * @param pNode[in,out] Monomial expression root node
- * @return bool True if final optimizations applied
- *
- * - Applies sign normalization
- * - Removes redundant exponent of 1
- * - Ensures consistent monomial representation
+ * @brief Adds the literal of a constant: an integer leaf or n/d
+ * @param F The value
+ * @return int The class of the literal
  */
-bool Simplify_Monomial_III(ExprNode*& pNode)
+int EGraph::AddValue(const Fraction& F)
 {
-	bool Changed = false;
-	Changed |= Simplify_All01(pNode);
-	Changed |= Simplify_Neg(pNode);
-	Changed |= Simplify_TopNeg(pNode);
-	return Changed;
+	auto Leaf = [&](const BigInt& V)
+	{
+		long long S;
+		if (V.ToLL(S) && S >= -INT_MAX && S <= INT_MAX)return AddNode(Token((int)S), -1, -1);
+		return AddNode(Token(BigLiterals.Intern(V), AsBigID{}), -1, -1);
+	};
+	auto N = Leaf(F.BigN());
+	if (F.Big ? F.Big->second.IsOne() : F.D == 1)return N;
+	return AddNode(Token('/'), N, Leaf(F.BigD()));
 }
 
 /**
- * @brief Simplifies polynomial expressions
- * @param pNode[in,out] Root node of polynomial expression
- * @return bool True if polynomial terms were combined
+ * @brief Merges two classes
+ * @return bool True if they were different classes
  *
- * - Combines like terms in additive expressions
- * - Factors common subexpressions across terms
- * - Orders terms in canonical sequence
+ * Two classes with different constant values are not merged. Such a merge only
+ * comes from a rule that does not hold for every value, like x/x=1 at x=0.
  */
-bool Simplify_Polynomial(ExprNode*& pNode)
+bool EGraph::Union(int C1, int C2)
 {
-	if (!pNode)return false;
-	bool Changed = false;
-
-	//STAGE I
-	TraverseTypeLocal(C, pNode, ADD, p)
+	C1 = Find(C1);
+	C2 = Find(C2);
+	if (C1 == C2)return false;
+	if (HasValue[C1] && HasValue[C2] && !(Value[C1] == Value[C2]))return false;
+	if (Members[C1].size() < Members[C2].size())std::swap(C1, C2);
+	Parent[C2] = C1;
+	Members[C1].insert(Members[C1].end(), Members[C2].begin(), Members[C2].end());
+	std::vector<int>().swap(Members[C2]);
+	if (!HasValue[C1] && HasValue[C2])
 	{
-		if (!p->IsConst()) Changed |= Simplify_Monomial_I(p);
+		HasValue[C1] = true;
+		Value[C1] = Value[C2];
 	}
+	return true;
+}
 
-	//STAGE II
-	std::vector<Fraction> Coefficients;
-	TraverseTypeLocal(D, pNode, ADD, q)
+/**
+ * @brief Restores the invariants after merges
+ *
+ * E-nodes that became equal because their operands were merged have their
+ * classes merged too, until no more such e-nodes are found. Then every class
+ * lists each of its distinct e-nodes once.
+ */
+void EGraph::Rebuild()
+{
+	bool Merged = true;
+	while (Merged)
 	{
-		if (q->IsConst())
+		Merged = false;
+		Memo.clear();
+		for (int N = 0; N < (int)ENodes.size(); N++)
 		{
-			Coefficients.emplace_back(1);
-			continue;
+			auto [It, New] = Memo.emplace(Canonical(N), N);
+			if (!New)Merged |= Union(NodeClass[N], NodeClass[It->second]);
 		}
-		auto q1 = CreateNode(); q1->Copy(q);
-		auto&& [C, F] = Simplify_Monomial_II(q1);
-		Changed |= C;
-		q->Copy(q1); ReleaseNode(q1);
-		if constexpr (EnableDebugSimplifyII) { printf("PushCoeff: "); F.ToNode()->PrintTree(); putchar('\n'); }
-		Coefficients.push_back(F);
 	}
+	for (int C = 0; C < (int)Parent.size(); C++)Members[C].clear();
+	for (auto& [E, N] : Memo)Members[Find(NodeClass[N])].push_back(N);
+	for (auto& M : Members)std::sort(M.begin(), M.end());
+}
 
-	//STAGE III
+/**
+ * @brief Gives every class computable from constant operands its value and literal
+ * @return bool True if a class was merged with a literal
+ */
+bool EGraph::FoldValues()
+{
+	bool Found = true;
+	while (Found)
 	{
-		std::map<ExprHash, int>AMP;
-		for (size_t I = 0; I < D.size(); I++)
+		Found = false;
+		for (int N = 0; N < (int)ENodes.size(); N++)
 		{
-			if (D[I]->IsConst())continue;
-			auto H = D[I]->Hash();
-			//exp(-y)*cos(x)^2-exp(-y)*sin(x)^2
-			if constexpr (EnableDebugSimplifyII) { printf("Stage3 Hash %016llX Tree:", H); D[I]->PrintTree(); putchar('\n'); }
-			auto it = AMP.find(H);
-			if (it == AMP.end())AMP[H] = (int)I;
-			else
-			{
-				Coefficients[it->second] += Coefficients[I];
-				Coefficients[I] = Fraction(0);
-				ReleaseTree(D[I]->L());
-				ReleaseTree(D[I]->R());
-				ClearNode(D[I]);
-				D[I]->V = Token(int(0));
-				Changed = true;
-			}
+			int C = Find(NodeClass[N]);
+			Fraction F;
+			if (HasValue[C] || !NodeValue(Canonical(N), F))continue;
+			HasValue[C] = true;
+			Value[C] = F;
+			Found = true;
 		}
 	}
+	bool Merged = false;
+	for (int C = 0, End = (int)Parent.size(); C < End; C++)
+		if (Parent[C] == C && HasValue[C])Merged |= Union(C, AddValue(Fraction(Value[C])));
+	return Merged;
+}
 
-	//STAGE IV
+/**
+ * @brief Finds the substitutions under which a pattern matches a term of a class
+ * @param Rules The rules holding the pattern
+ * @param P The pattern
+ * @param Class The class
+ * @param S The substitution so far
+ * @param Out[out] Receives the extended substitutions
+ */
+void EGraph::MatchClass(const EGraphRuleSet& Rules, int P, int Class, const Subst& S, std::vector<Subst>& Out)
+{
+	auto& Pt = Rules.Nodes[P];
+	Class = Find(Class);
+	if (Pt.Var >= 0)
 	{
-		//x*y+x*z=x*(y+z)
-		std::set<ExprHash>TriedFactors;
-		std::vector<std::map<ExprHash, ExprNode**>> Factors;
-		std::map<ExprHash, CommonFactor> Common;
-		Factors.resize(D.size());
-		for (size_t I = 0; I < D.size(); I++)
-			FillFactorMap(D[I], Factors[I]);
-		for (size_t I = 0; I < D.size(); I++)
-		{
-			if (D[I]->IsConst())continue;
-			for (size_t J = 0; J < I; J++)
-			{
-				if (D[J]->IsConst())continue;
-				bool MergeIJ = false;
-				GetCommonFactor(Factors[I], Factors[J], Common);
-				if constexpr (EnableDebugSimplifyII) 
-				{ 
-					printf("Common Factors:\n"); 
-					for (auto& [k, v] : Common)
-					{
-						v.pi->PrintTree(); 
-						putchar('\n');
-					}
-				}
-				if (!Common.empty())
-				{
-					for (auto& [K, V] : Common)
-					{
-						*V.ppi = Const(1);
-						*V.ppj = Const(1);
-					}
-					auto E1 = D[I]->Duplicate();
-					auto E2 = D[J]->Duplicate();
-					for (auto& [K, V] : Common)
-					{
-						ReleaseNode(*V.ppi); *V.ppi = V.pi;
-						ReleaseNode(*V.ppj); *V.ppj = V.pj;
-					}
-					auto F = DuplicateFactor(Common);
-
-					auto K = F Mul((Coefficients[I].ToNode() Mul E1) Add(Coefficients[J].ToNode() Mul E2));
-					if constexpr (EnableDebugSimplifyII) { printf("OrigK: "); K->PrintTree(); putchar('\n'); }
-					Simplify(K);
-					if constexpr (EnableDebugSimplifyII) { printf("SimpK: "); K->PrintTree(); putchar('\n'); }
-					ReleaseTree(D[I]->L());
-					ReleaseTree(D[I]->R());
-					ReleaseTree(D[J]->L());
-					ReleaseTree(D[J]->R());
-					D[I]->L() = K->L();
-					D[I]->R() = K->R();
-					D[I]->V = K->V;
-					ReleaseNode(K);
-					ClearNode(D[J]);
-					D[J]->V = Token(int(0));
-					Coefficients[I] = Coefficients[J] = Fraction(1);
-				}
-			}
-		}
+		if (S[Pt.Var] >= 0 && Find(S[Pt.Var]) != Class)return;
+		Out.push_back(S);
+		Out.back()[Pt.Var] = Class;
+		return;
 	}
-
-	//STAGE V
-	for (size_t I = 0; I < D.size(); I++)
+	if (Pt.L < 0)
 	{
-		if (D[I]->IsConst())continue;
-		auto U = CreateNode(); U->Copy(D[I]);
-		if constexpr (EnableDebugSimplifyII) { printf("Before: "); U->PrintTree(); putchar('\n'); }
-		if constexpr (EnableDebugSimplifyII) { printf("Coeff: "); Coefficients[I].ToNode()->PrintTree(); putchar('\n'); }
-		auto V = Coefficients[I].ToNode() Mul U;
-		Simplify_Monomial_III(V);
-		if constexpr (EnableDebugSimplifyII) { printf("After: "); V->PrintTree(); putchar('\n'); }
-		D[I]->Copy(V);
+		if (HasValue[Class] && Value[Class] == Pt.V.ID)Out.push_back(S);
+		return;
+	}
+	std::vector<Subst> Left;
+	for (int N : Members[Class])
+	{
+		auto& E = ENodes[N];
+		if (!(E.V == Pt.V) || (E.B >= 0) != (Pt.R >= 0))continue;
+		Left.clear();
+		MatchClass(Rules, Pt.L, E.A, S, Left);
+		for (auto& L : Left)
+		{
+			if (Pt.R < 0)Out.push_back(L);
+			else MatchClass(Rules, Pt.R, E.B, L, Out);
+		}
 	}
-	return Changed;
 }
 
 /**
- * @brief Final normalization of negative signs in the expression
- * @param pNode[in,out] Root node of the expression tree
- *
- * - Converts nested negations to positive terms (-(-x) -> x)
- * - Moves negative coefficients to canonical positions
- * - Simplifies multiplication/division with negative signs
+ * @brief Adds the term of a pattern under a substitution
+ * @return int The class of the term
  */
-bool FinalFold_Neg(ExprNode*& pNode)
+int EGraph::Instantiate(const EGraphRuleSet& Rules, int P, const Subst& S)
 {
-	if (!pNode)return false;
-	bool Changed = false;
-	Changed |= FinalFold_Neg(pNode->L());
-	Changed |= FinalFold_Neg(pNode->R());
-	switch (pNode->V.Ty)
-	{
-	case Token::Operator:
+	auto& Pt = Rules.Nodes[P];
+	if (Pt.Var >= 0)return S[Pt.Var];
+	if (Pt.L < 0)return AddNode(Pt.V, -1, -1);
+	int A = Instantiate(Rules, Pt.L, S);
+	int B = Pt.R >= 0 ? Instantiate(Rules, Pt.R, S) : -1;
+	return AddNode(Pt.V, A, B);
+}
+
+int EGraph::AddTree(const ExprNode* pRoot)
+{
+	//Post-order, the classes of the operands are on the class stack
+	WalkStack<std::pair<const ExprNode*, bool>> S;
+	WalkStack<int> Classes;
+	S.Push({ pRoot, false });
+	while (!S.Empty())
 	{
-		//x^((-1)*y)=1/x^y
-		if (pNode->V.ID == '^')
+		auto& [p, Expanded] = S.Top();
+		auto pNode = p;
+		if (!Expanded)
 		{
-			bool Neg = false;
-			TraverseType(pNode->R(), MUL, p)
-			{
-				if (p->V.Ty == Token::Int && p->V.ID < 0)
-				{
-					Neg = !Neg;
-					p->V.ID = -p->V.ID;
-					Changed = true;
-				}
-			}
-			if (Neg)pNode = Const(1) Div pNode;
+			Expanded = true;
+			if (pNode->R())S.Push({ pNode->R(), false });
+			if (pNode->L())S.Push({ pNode->L(), false });
+			continue;
 		}
-		else if (pNode->V.ID == '+')
+		S.Pop();
+		int B = pNode->R() ? Classes.Pop() : -1;
+		int A = pNode->L() ? Classes.Pop() : -1;
+		Classes.Push(AddNode(pNode->V, A, B));
+	}
+	int Root = Classes.Pop();
+	FoldValues();
+	Rebuild();
+	return Root;
+}
+
+void EGraph::Saturate(const EGraphRuleSet& Rules)
+{
+	size_t Limit = ENodes.size() + NodeBudget;
+	std::vector<Match> Matches;
+	std::vector<Subst> Found;
+	Subst Empty;
+	Empty.fill(-1);
+	for (int Iter = 0; Iter < IterLimit && ENodes.size() < Limit; Iter++)
+	{
+		// All matches are found before any rewrite, so a round sees one state
+		Matches.clear();
+		for (auto& R : Rules.Rules)
 		{
-			bool NegR = false;
-			TraverseType(pNode->R(), MUL, p)
-			{
-				if (p->V.Ty == Token::Int && p->V.ID < 0)
-				{
-					NegR = !NegR;
-					p->V.ID = -p->V.ID;
-					Changed = true;
-				}
-			}
-			bool NegL = false;
-			TraverseType(pNode->L(), MUL, q)
-			{
-				if (q->V.Ty == Token::Int && q->V.ID < 0)
-				{
-					NegL = !NegL;
-					q->V.ID = -q->V.ID;
-					Changed = true;
-				}
-			}
-			if (NegL)
-			{
-				if (NegR)
-				{
-					//(-1)*a+(-1)*b=(-1)*(a+b)
-					pNode = Const(-1) Mul pNode;
-				}
-				else
-				{
-					//(-1)*a+b=b-a
-					pNode->V.ID = '-';
-					std::swap(pNode->L(), pNode->R());
-				}
-			}
-			else if (NegR)
+			auto& Root = Rules.Nodes[R.LHS];
+			for (int C = 0; C < (int)Parent.size() && Matches.size() < NodeBudget; C++)
 			{
-				//a+(-1)*b=a-b
-				pNode->V.ID = '-';
+				if (Parent[C] != C)continue;
+				bool Has = false;
+				for (int N : Members[C])Has |= ENodes[N].V == Root.V;
+				if (!Has)continue;
+				Found.clear();
+				MatchClass(Rules, R.LHS, C, Empty, Found);
+				for (auto& S : Found)Matches.push_back({ R.RHS, C, S });
 			}
 		}
-		else if (pNode->V.ID == '-')
+		size_t Before = ENodes.size();
+		bool Merged = false;
+		for (auto& M : Matches)
 		{
-			bool NegR = false;
-			TraverseType(pNode->R(), MUL, p)
-			{
-				if (p->V.Ty == Token::Int && p->V.ID < 0)
-				{
-					NegR = !NegR;
-					p->V.ID = -p->V.ID;
-					Changed = true;
-				}
-			}
-			bool NegL = false;
-			TraverseType(pNode->L(), MUL, q)
-			{
-				if (q->V.Ty == Token::Int && q->V.ID < 0)
-				{
-					NegL = !NegL;
-					q->V.ID = -q->V.ID;
-					Changed = true;
-				}
-			}
-			/*
-			 a-(-1)*b=a+b
-			(-1)*a-b=(-1)*(a+b)
-			(-1)*a-(-1)*b=b-a
-			*/
-			if (NegL)
-			{
-				if (NegR)std::swap(pNode->L(), pNode->R());
-				else
-				{
-					pNode->V.ID = '+';
-					pNode = Const(-1) Mul pNode;
-				}
-			}
-			else if (NegR)pNode->V.ID = '+';
+			if (ENodes.size() >= Limit)break;
+			Merged |= Union(M.Class, Instantiate(Rules, M.RHS, M.S));
 		}
-		break;
-	}
-	case Token::Function:
-	{
-		switch (pNode->V.ID)
+		Rebuild();
+		if (FoldValues())
 		{
-			/*
-			sin(-1*x)=-1*sin(x)
-			cos(-1*x)=cos(x)
-			tan(-1*x)=-1*tan(x)
-			*/
-		case FUNC_sin:
-		case FUNC_tan:
-		case FUNC_sinh:
+			Merged = true;
+			Rebuild();
+		}
+		if (!Merged && ENodes.size() == Before)break;// Saturated
+	}
+}
+
+ExprNode* EGraph::Extract(int Class)
+{
+	// The cheapest cost of each class, found by relaxing until nothing improves.
+	// Constants cost half a node, so 2*x wins over x+x and x^2 over x*x
+	std::vector<double> Cost(Parent.size(), HUGE_VAL);
+	std::vector<int> Best(Parent.size(), -1);
+	bool Improved = true;
+	while (Improved)
+	{
+		Improved = false;
+		for (int C = 0; C < (int)Parent.size(); C++)
 		{
-			bool Neg = false;
-			TraverseType(pNode->L(), MUL, p)
+			for (int N : Members[C])
 			{
-				if (p->V.Ty == Token::Int && p->V.ID < 0)
+				auto E = Canonical(N);
+				double K = (E.V.Ty == Token::Int || E.V.Ty == Token::Big ? 0.5 : 1) + (E.A >= 0 ? Cost[E.A] : 0) + (E.B >= 0 ? Cost[E.B] : 0);
+				if (K < Cost[C])
 				{
-					Neg = !Neg;
-					p->V.ID = -p->V.ID;
-					Changed = true;
+					Cost[C] = K;
+					Best[C] = N;
+					Improved = true;
 				}
 			}
-			if (Neg)pNode = Const(-1) Mul pNode;
-			break;
 		}
-		/*
-		sinh(-1*x)=-1*sinh(x)
-		cosh(-1*x)=cosh(x)
-		*/
-		case FUNC_cos:
-		case FUNC_cosh:
+	}
+
+	//Post-order, the built operands are on the node stack
+	WalkStack<std::pair<int, bool>> S;
+	WalkStack<ExprNode*> Built;
+	S.Push({ Find(Class), false });
+	while (!S.Empty())
+	{
+		auto& [C, Expanded] = S.Top();
+		auto E = Canonical(Best[C]);
+		if (!Expanded)
 		{
-			TraverseType(pNode->L(), MUL, p)
+			Expanded = true;
+			if (E.B >= 0)S.Push({ E.B, false });
+			if (E.A >= 0)S.Push({ E.A, false });
+			continue;
+		}
+		S.Pop();
+		ExprNode* B = E.B >= 0 ? Built.Pop() : nullptr;
+		ExprNode* A = E.A >= 0 ? Built.Pop() : nullptr;
+		Built.Push(A ? CreateNode(E.V, A, B) : CreateNode(E.V));
+	}
+	return Built.Pop();
+}
+
+/**
+ * @brief Rotates the constant factors of every product to its front
+ * @param pNode[in,out] Root node of an extracted tree
+ *
+ * The cheapest term of a class may keep its coefficient anywhere in a product,
+ * like cosh(z)*(-5)*cos(z)/x. The coefficients of the factors of a product,
+ * including the factors of the numerators that are products, are moved in
+ * front of its outermost node, as the pipeline prints them. The 1 left in
+ * place of each factor is removed by FinalFold.
+ */
+void FrontCoefficients(ExprNode*& pNode)
+{
+	// The second member tells if the slot is a factor of an outer product
+	WalkStack<std::pair<ExprNode**, bool>> S;
+	WalkStack<ExprNode*> Factors;
+	S.Push({ &pNode, false });
+	while (!S.Empty())
+	{
+		auto [pp, InProduct] = S.Pop();
+		auto p = *pp;
+		bool IsProduct = p->V == MUL || (p->V == DIV && p->V0() == MUL);
+		if (IsProduct && !InProduct)
+		{
+			Fraction F(1);
+			bool Found = false;
+			Factors.Push(p);
+			while (!Factors.Empty())
 			{
-				if (p->V.Ty == Token::Int && p->V.ID < 0)
+				auto q = Factors.Pop();
+				if (q->V == MUL)Factors.Push(q->R());
+				if (q->V == MUL || (q->V == DIV && q->V0() == MUL))Factors.Push(q->L());
+				else
 				{
-					p->V.ID = -p->V.ID;
-					Changed = true;
+					auto [Changed, C] = ExtractCoefficient(q);
+					F = F * C;
+					Found |= Changed;
 				}
 			}
-			break;
+			if (Found)*pp = F.ToNode() Mul p;
 		}
-		/*
-		pow(x,-1*y)=1/x^y
-		exp(-1*x)=1/exp(x)
-		*/
-		case FUNC_exp:
-		case FUNC_pow:
+		if (p->R())S.Push({ &p->R(), p->V == MUL });
+		if (p->L())S.Push({ &p->L(), IsProduct });
+	}
+}
+
+void Simplify_EGraph(ExprNode*& pNode)
+{
+	static const EGraphRuleSet Rules;
+	EGraph G;
+	int Root = G.AddTree(pNode);
+	G.Saturate(Rules);
+	auto pNew = G.Extract(Root);
+	ReleaseTree(pNode);
+	pNode = pNew;
+	FrontCoefficients(pNode);
+}
+
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+//--------------------------MAIN FUNCTION--------------------------
+//-----------------------------------------------------------------
+//-----------------------------------------------------------------
+
+/**
+ * @brief Reads the command line options into Opt.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @return bool False if an option is unknown.
+ */
+bool ParseOptions(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--reverse"))Opt.Reverse = true;
+		else if (!strcmp(argv[i], "--order") && i + 1 < argc && atoi(argv[i + 1]) >= 1)Opt.Order = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--taylor") && i + 1 < argc && atoi(argv[i + 1]) >= 1)Opt.Taylor = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--wrt") && i + 1 < argc)
 		{
-			bool Neg = false;
-			TraverseType(pNode->L(), MUL, p)
+			std::string List = argv[++i];
+			for (size_t Begin = 0, End; Begin <= List.size(); Begin = End + 1)
 			{
-				if (p->V.Ty == Token::Int && p->V.ID == -1)
-				{
-					Neg = !Neg;
-					p->V.ID = 1;
-					Changed = true;
-				}
+				End = std::min(List.find(',', Begin), List.size());
+				if (End > Begin)Opt.Wrt.push_back(List.substr(Begin, End - Begin));
 			}
-			if (Neg)pNode = Const(1) Div pNode;
-			break;
 		}
-		default:break;
+		else if (!strcmp(argv[i], "--sparsity"))Opt.Sparsity = true;
+		else if (!strcmp(argv[i], "--egraph"))Opt.EGraph = true;
+		else
+		{
+			printf("Unknown option: %s\n", argv[i]);
+			puts("Usage: AutoGrad [--reverse] [--order k] [--taylor k] [--wrt x,y] [--sparsity] [--egraph]");
+			return false;
 		}
-		break;
-	}
-	default:break;
 	}
-	return Changed;
+	return true;
 }
 
 /**
- * @brief Extracts greatest common divisor from monomial terms
- * @param pNode[in,out] Root node of monomial expression
+ * @brief Reads the simplifier a line asks for and removes its prefix.
  *
- * - Operates on single-term expressions (e.g., 4x^2*y)
- * - Factorizes numerical coefficients (4x^2*y -> 4*(x^2*y))
- * - Preserves variable structure during GCD extraction
+ * A line starting with "egraph:" is simplified by the e-graph, one starting
+ * with "pipeline:" by the passes, whatever --egraph says.
+ *
+ * @param Line[in,out] The input line.
+ * @param EGraph[in,out] Set to the chosen simplifier, unchanged without a prefix.
  */
-void FinalFold_GCDMono(ExprNode*& pNode)
+void SelectSimplifier(std::string& Line, bool& EGraph)
 {
-	void FinalFold_GCDPoly(ExprNode * &pNode);
-	if (!pNode)return;
-	std::vector<ExprNode*> Cont;
-	if (pNode->V == ADD)
-	{
-		FinalFold_GCDPoly(pNode);
-	}
-	else
+	static const std::pair<const char*, bool> Prefixes[] = { { "egraph:", true }, { "pipeline:", false } };
+	auto Begin = Line.find_first_not_of(" \t");
+	if (Begin == std::string::npos)return;
+	for (auto& [Text, Value] : Prefixes)
 	{
-		FinalFold_GCDMono(pNode->L());
-		FinalFold_GCDMono(pNode->R());
+		if (Line.compare(Begin, strlen(Text), Text))continue;
+		EGraph = Value;
+		Line.erase(0, Begin + strlen(Text));
+		return;
 	}
 }
 
 /**
- * @brief Merges identical factors in multiplication expressions
- * @param pNode[in,out] Root node of multiplicative expression
- * @param Tg[in,out] Hash map tracking factor occurrences 
+ * @brief Returns the IDs of the variables to differentiate against.
  *
- * - Combines identical base factors (x*x -> x^2)
- * - Uses hash matching for rapid duplicate detection
- * - Maintains expression structure integrity
+ * Without --wrt these are all variables ordered by name, otherwise the listed
+ * ones in the given order. Listed names that do not occur are skipped.
  */
-void FinalFold_MergeSame(ExprNode*& pNode, std::map<ExprHash, ExprNode**>& Tg)
+std::vector<int> SelectedIDs()
 {
-	//y^x*z^x=(y*z)^x
-	if (pNode->V == MUL)
+	if (Opt.Wrt.empty())return Symbols.SortedIDs();
+	std::vector<int> IDs;
+	for (auto& Name : Opt.Wrt)
 	{
-		FinalFold_MergeSame(pNode->L(), Tg);
-		FinalFold_MergeSame(pNode->R(), Tg);
+		int ID = Symbols.Find(Name.c_str(), Name.size());
+		if (ID != -1 && std::find(IDs.begin(), IDs.end(), ID) == IDs.end())IDs.push_back(ID);
 	}
-	else if (pNode->V == POW)
+	return IDs;
+}
+
+/**
+ * @brief A derivative whose derivatives of the next order are still to be printed.
+ */
+struct LowerPartial
+{
+	///< The derivative.
+	const Expr* D;
+	///< The variables it was taken by, e.g. "x,y".
+	std::string Name;
+	///< Position in the selected variable IDs of the last of them.
+	size_t Last;
+};
+
+/**
+ * @brief Prints the mixed partials of an expression up to order Opt.Order.
+ *
+ * The partials of order m are taken from the simplified ones of order m-1.
+ * A variable list is only extended by variables not before its last one,
+ * so every unordered multi-index (x,y but not y,x) is built exactly once.
+ *
+ * @param F The expression.
+ * @param Prefix Printed before the variables of every partial.
+ */
+void PrintPartials(const Expr& F, const std::string& Prefix = "")
+{
+	auto IDs = SelectedIDs();
+	std::vector<LowerPartial> Lower{ { &F, "", 0 } }, Next;
+	// -purpose: Holds the partials of the last two orders
+	// -usage: The partials of order m are kept while those of order m+1 are built
+	std::deque<Expr> Keep[2];
+	for (int Order = 1; Order <= Opt.Order; Order++)
 	{
-		auto H = pNode->R()->Hash();
-		auto it = Tg.find(H);
-		if (it == Tg.end())Tg[H] = &pNode;
-		else
+		auto& Cur = Keep[Order & 1];
+		Cur.clear();
+		bool Last = Order == Opt.Order;
+		for (auto& [pF, Name, First] : Lower)
 		{
-			auto T = *(it->second);//y^x z^x
-			T->L() = T->L() Mul pNode->L();//y^x z^x -> //(y*z)^x z^x
-			pNode->L() = Const(1);//(y*z)^x 1^x
+			size_t Begin = Cur.size();
+			if (Opt.Reverse)
+			{
+				// Built in one backward sweep, each one is simplified right before it is printed
+				Expr::Gradient(*pF, std::vector<int>(IDs.begin() + First, IDs.end()), Cur);
+			}
+			for (size_t q = First; q < IDs.size(); q++)
+			{
+				auto Full = (Name.empty() ? Prefix : Name + ",") + Symbols.Name(IDs[q]);
+				if (Opt.Reverse)
+				{
+					Cur[Begin + q - First].Simplify();
+					if (DividedbyZero)continue;
+				}
+				else if (Last)
+				{
+					// The partials of the highest order are not kept
+					Expr Partial(*pF, IDs[q]);
+					if (DividedbyZero)continue;
+					CompactNodesIfSparse();
+					printf("%s: ", Full.c_str());
+					Partial.Print();
+					continue;
+				}
+				else
+				{
+					Cur.emplace_back(*pF, IDs[q]);
+					if (DividedbyZero) { Cur.pop_back(); continue; }
+				}
+				auto& D = Opt.Reverse ? Cur[Begin + q - First] : Cur.back();
+				CompactNodesIfSparse();
+				printf("%s: ", Full.c_str());
+				D.Print();
+				if (!Last)Next.push_back({ &D, Full, q });
+			}
 		}
+		Lower.swap(Next);
+		Next.clear();
 	}
 }
 
 /**
- * @brief Optimizes power expressions through exponent merging
- * @param pNode[in,out] Root node containing power terms
+ * @brief Prints the Jacobian of several expressions separated by ';', row by row.
  *
- * - Applies power rules (x^a * x^b -> x^(a+b))
- * - Handles nested power structures ((x^a)^b -> x^(a*b))
- * - Normalizes power distribution over multiplication
+ * The rows share one variable table and node pool. The first derivatives are
+ * built column by column in one ConsTable session per variable, so a subtree
+ * that occurs in several rows is differentiated once, and equal derivatives
+ * are simplified once. Higher orders and --reverse go row by row instead.
+ * The partial of row i by x is printed as "dfi/dx: ...".
+ *
+ * @param Str The input line.
  */
-void FinalFold_MergePower(ExprNode* pNode)
+void PrintJacobian(const std::string& Str)
 {
-	std::map<ExprHash, ExprNode**> T;
-	auto K = CreateNode(); K->Copy(pNode);
-	FinalFold_MergeSame(K, T);
-	pNode->Copy(K);
-	ReleaseNode(K);
+	// -purpose: Holds the rows of the function
+	// -usage: Parsed from the ';'-separated parts of the line, empty parts are skipped
+	std::deque<Expr> Rows;
+	for (size_t Begin = 0, End; Begin <= Str.size(); Begin = End + 1)
+	{
+		End = std::min(Str.find(';', Begin), Str.size());
+		std::vector<Token> Toks;
+		GenerateTokens(Str.substr(Begin, End - Begin), Toks);
+		if (Toks.empty())continue;
+		Rows.emplace_back(Toks);
+		if (FailedToParse || DividedbyZero)return;
+	}
+	auto Label = [](size_t Row) { return "df" + std::to_string(Row + 1) + "/d"; };
+	if (Opt.Order > 1 || Opt.Reverse)
+	{
+		for (size_t r = 0; r < Rows.size(); r++)PrintPartials(Rows[r], Label(r));
+		return;
+	}
+	auto IDs = SelectedIDs();
+	// -purpose: Holds the Jacobian column by column, entry c*Rows.size()+r
+	// -usage: Printed row by row once all columns are built, Valid marks the
+	//         entries that did not divide by zero
+	std::deque<Expr> J;
+	std::vector<bool> Valid;
+	for (int ID : IDs)
+	{
+		size_t Begin = J.size();
+		std::vector<ExprNode*> Column;
+		ConsTable.Begin();
+		for (auto& F : Rows)Column.push_back(F.Root->Partial(ID));
+		ConsTable.Active = false;
+		for (auto pD : Column)J.emplace_back(pD->Duplicate());
+		ConsTable.End();
+		std::vector<ExprHash> Hashes;
+		for (size_t i = Begin; i < J.size(); i++)Hashes.push_back(J[i].Root->Hash());
+		FlatHashMap<size_t> Simplified;
+		for (size_t i = Begin; i < J.size(); i++)
+		{
+			if (auto p = Simplified.Find(Hashes[i - Begin]))
+			{
+				ReleaseTree(J[i].Root);
+				J[i].Root = J[*p].Root->Duplicate();
+				Valid.push_back(Valid[*p]);
+				continue;
+			}
+			Simplified[Hashes[i - Begin]] = i;
+			J[i].Simplify();
+			Valid.push_back(!DividedbyZero);
+			CompactNodesIfSparse();
+		}
+	}
+	DividedbyZero = false;
+	for (size_t r = 0; r < Rows.size(); r++)
+	{
+		for (size_t c = 0; c < IDs.size(); c++)
+		{
+			if (!Valid[c * Rows.size() + r])continue;
+			printf("%s%s: ", Label(r).c_str(), Symbols.Name(IDs[c]));
+			J[c * Rows.size() + r].Print();
+		}
+	}
 }
 
 /**
- * @brief Factors out GCD from polynomial expressions
- * @param pNode[in,out] Root node of polynomial expression
+ * @brief Prints which first partials may be nonzero for "f1;f2;...".
  *
- * - Analyzes all terms in additive expressions
- * - Extracts numerical and variable common factors
- * - Restructures expression with factored-out GCD
+ * Row i is labelled "dfi:" like the rows of PrintJacobian, also when there
+ * is only one function.
+ *
+ * A partial is structurally zero if its variable does not occur in the parsed
+ * function. This takes one walk per function and no derivative is built.
+ *
+ * @param Str The input line.
  */
-void FinalFold_GCDPoly(ExprNode*& pNode)
+void PrintSparsity(const std::string& Str)
 {
-	if (!pNode)return;
-	if (pNode->V == Token(int(0)))return;
-	TraverseTypeLocal(C, pNode, ADD, p)
-		FinalFold_GCDMono(p);
-	std::vector<Fraction> Coefficients;
-	TraverseTypeLocal(D, pNode, ADD, q)
+	// -purpose: Holds the rows of the function, not simplified
+	std::deque<Expr> Rows;
+	for (size_t Begin = 0, End; Begin <= Str.size(); Begin = End + 1)
 	{
-		Coefficients.push_back(ExtractCoefficient(q).second);
-		FinalFold_MergePower(q);
-		if constexpr (EnableDebugSimplifyII) { printf("Coefficient %d/%d\n", Coefficients.back().N, Coefficients.back().D); }
+		End = std::min(Str.find(';', Begin), Str.size());
+		std::vector<Token> Toks;
+		GenerateTokens(Str.substr(Begin, End - Begin), Toks);
+		if (Toks.empty())continue;
+		Rows.emplace_back(Toks, false);
+		if (FailedToParse)return;
 	}
-	auto Tg = ExtractGCD(Coefficients.begin(), Coefficients.end());
-	for (size_t I = 0; I < D.size(); I++)
+	if (Rows.empty())return;
+	auto IDs = SelectedIDs();
+	printf("columns:");
+	for (int ID : IDs)printf(" %s", Symbols.Name(ID));
+	putchar('\n');
+	std::vector<bool> Occurs(Symbols.Size());
+	for (size_t r = 0; r < Rows.size(); r++)
 	{
-		auto U = CreateNode();
-		U->Copy(D[I]);
-		auto F = Tg == 0 ? Fraction(0) : Coefficients[I] / Tg;
-		if (Tg == 0)
+		std::fill(Occurs.begin(), Occurs.end(), false);
+		WalkStack<const ExprNode*> S;
+		S.Push(Rows[r].Root);
+		while (!S.Empty())
 		{
-			if (!DividedbyZero)puts("Runtime Error: Divided by 0");
-			DividedbyZero = true;
-			return;
+			auto p = S.Pop();
+			if (p->V.Ty == Token::Variable)Occurs[p->V.ID] = true;
+			if (p->L())S.Push(p->L());
+			if (p->R())S.Push(p->R());
 		}
-		auto V = F.ToNode() Mul U;
-		D[I]->Copy(V);
+		printf("df%zu:", r + 1);
+		for (int ID : IDs)printf(" %c", Occurs[ID] ? '*' : '.');
+		putchar('\n');
 	}
-	pNode = Tg.ToNode() Mul pNode;
 }
 
 /**
- * @brief Final simplification pass with GCD factoring and negation cleanup
- * @param pNode[in,out] Root node of the fully processed expression
+ * @brief Reads the bindings of one point, "x=1, y=2:0.5", in Str[Begin,End).
+ *
+ * @param Str The input line.
+ * @param Begin The first character of the point.
+ * @param End One past the last character of the point.
+ * @param Values Indexed by variable ID, receives the values and directions.
+ * @param Directed Set to true if any binding gives a direction.
+ * @return bool False if an error was printed.
  */
-void FinalFold(ExprNode*& pNode)
+bool ParsePoint(const std::string& Str, size_t Begin, size_t End, std::vector<Dual>& Values, bool& Directed)
 {
-	if (!pNode)return;
-	FinalFold_GCDPoly(pNode);
-	FinalFold_Neg(pNode);
-	Simplify_TopNeg(pNode);
-	bool Changed;
-
-	// Repeat until no more constant folding possible
-	do
+	Values.assign(Values.size(), Dual{ NAN, 0 });
+	Directed = false;
+	for (size_t Next; Begin <= End; Begin = Next + 1)
 	{
-		Changed = false;
-		Changed |= Simplify_FoldConst(pNode);//Combine generated Const above
-		Changed |= Simplify_All01(pNode);//Remove generated 01 above
-	} while (Changed);
+		Next = std::min(Str.find(',', Begin), End);
+		auto Eq = Str.find('=', Begin);
+		size_t NameBegin = Str.find_first_not_of(" \t", Begin), NameEnd = Eq;
+		while (NameEnd > NameBegin && isspace((unsigned char)Str[NameEnd - 1]))--NameEnd;
+		if (Eq >= Next || NameBegin >= Eq) { puts("Syntax Error: expected \"name=value\" after \"@\"."); return false; }
+		int ID = Symbols.Intern(Str.c_str() + NameBegin, NameEnd - NameBegin);
+		if (ID >= (int)Values.size()) { printf("Syntax Error: %s is not a variable of the expression.\n", Symbols.Name(ID)); return false; }
+		if (!std::isnan(Values[ID].V)) { printf("Syntax Error: %s is bound twice.\n", Symbols.Name(ID)); return false; }
+		//strtod leaves pEnd at its argument if no number is there
+		char* pEnd;
+		const char* pNum = Str.c_str() + Eq + 1;
+		Values[ID].V = strtod(pNum, &pEnd);
+		bool Parsed = pEnd != pNum;
+		while (isspace((unsigned char)*pEnd))++pEnd;
+		if (*pEnd == ':')
+		{
+			pNum = pEnd + 1;
+			Values[ID].D = strtod(pNum, &pEnd);
+			Parsed &= pEnd != pNum;
+			Directed = true;
+		}
+		while (isspace((unsigned char)*pEnd))++pEnd;
+		if (!Parsed || pEnd != Str.c_str() + Next) { puts("Syntax Error: expected \"name=value\" after \"@\"."); return false; }
+	}
+	for (int ID = 0; ID < (int)Values.size(); ID++)
+		if (std::isnan(Values[ID].V)) { printf("Runtime Error: no value for %s.\n", Symbols.Name(ID)); return false; }
+	return true;
 }
 
 /**
- * @brief Simplifies the expression tree rooted at the given node.
+ * @brief Evaluates an expression and its derivatives at points, "expr @ x=1, y=2; x=3, y=4".
  *
- * @param pNode The root node of the subtree to be simplified.
+ * The parsed tree is compiled into a Tape once and not simplified. For every
+ * point the gradient comes from one forward and one reverse sweep of the tape.
+ * A binding may give a direction as well, "x=1:0.5". Then the derivative
+ * along the given direction is printed, evaluated on dual numbers, or with
+ * --taylor k the first k of them, evaluated on truncated power series.
+ *
+ * @param Str The input line.
  */
-void Simplify(ExprNode*& pNode)
+void PrintValues(const std::string& Str)
 {
-	std::set<ExprHash> Occurred;
-	if constexpr (EnableDebugSimplifyI) { printf("\nInitial: "); pNode->PrintTree(); }
-	do
+	auto At = Str.find('@');
+	GenerateTokens(Str.substr(0, At), Tokens);
+	Expr F(Tokens, false);
+	if (FailedToParse)return;
+	int NVars = Symbols.Size();
+	// -purpose: Holds the value and direction of every variable, NaN if not bound
+	std::vector<Dual> Values(NVars);
+	std::vector<double> X(NVars), Grad(NVars), Coef;
+	Tape T;
+	T.Compile(F.Root);
+	auto IDs = SelectedIDs();
+	bool Many = Str.find(';', At) != std::string::npos;
+	int Point = 0;
+	for (size_t Begin = At + 1, End; Begin <= Str.size(); Begin = End + 1)
 	{
-		Simplify_All01(pNode);         
-		if constexpr (EnableDebugSimplifyI) { printf("\nAll01: "); pNode->PrintTree(); putchar('\n'); }
-		Simplify_Neg(pNode);           
-		if constexpr (EnableDebugSimplifyI) { printf("\nNeg: "); pNode->PrintTree(); putchar('\n'); }
-		Simplify_TopNeg(pNode);        
-		if constexpr (EnableDebugSimplifyI) { printf("\nTNeg: "); pNode->PrintTree(); putchar('\n');}
-		Simplify_SpecialFuncs(pNode);  
-		if constexpr (EnableDebugSimplifyI) { printf("\nSpFn: "); pNode->PrintTree(); putchar('\n'); }
-		Simplify_Polynomial(pNode);    
-		if constexpr (EnableDebugSimplifyI) { printf("\nPoly: "); pNode->PrintTree(); putchar('\n'); }
-		Simplify_FoldConst(pNode);     
-		if constexpr (EnableDebugSimplifyI) { printf("\nFold: "); pNode->PrintTree(); putchar('\n'); }
-	} // Loop until hash stabilizes
-	while (Occurred.insert(pNode->Hash()).second);
-
-	FinalFold(pNode);
-
-	if constexpr (EnableDebugSimplifyI) { printf("\nFinal: "); pNode->PrintTree(); putchar('\n'); }
+		End = std::min(Str.find(';', Begin), Str.size());
+		bool Directed;
+		if (!ParsePoint(Str, Begin, End, Values, Directed))return;
+		if (Many)printf("point %d:\n", ++Point);
+		if (Directed && Opt.Taylor)
+		{
+			F.Root->TaylorSeries(Values, Opt.Taylor, Coef);
+			printf("value: %.15g\n", Coef[0]);
+			//the j-th derivative is j! times the j-th coefficient
+			double Factorial = 1;
+			for (int j = 1; j <= Opt.Taylor; j++)
+				printf("order %d: %.15g\n", j, Coef[j] * (Factorial *= j));
+			continue;
+		}
+		if (Directed)
+		{
+			auto R = F.Root->Evaluate(Values);
+			printf("value: %.15g\ndirection: %.15g\n", R.V, R.D);
+			continue;
+		}
+		for (int ID = 0; ID < NVars; ID++)X[ID] = Values[ID].V;
+		printf("value: %.15g\n", T.Forward(X));
+		T.Reverse(Grad);
+		for (int ID : IDs)printf("%s: %.15g\n", Symbols.Name(ID), Grad[ID]);
+	}
 }
 
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
-//--------------------------MAIN FUNCTION--------------------------
-//-----------------------------------------------------------------
-//-----------------------------------------------------------------
-
 /**
  * @brief Main entry point for expression processing and differentiation
  *
  * - Continuously processes mathematical expressions from standard input
  * - Performs tokenization, parsing, and partial derivative calculations
  * - Outputs derivatives for all variables in the expression
- * @return int Always returns 0 for standard program termination
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments, see ParseOptions.
+ * @return int 0 for standard program termination, 1 for invalid options
  */
-int main()
+int main(int argc, char* argv[])
 {
+	if (!ParseOptions(argc, argv))return 1;
+	const bool DefaultEGraph = Opt.EGraph;
 	while (1)
 	{
 		// -purpose: Manages resource cleanup between parsing rounds
@@ -3748,6 +7682,31 @@ int main()
 		// Read mathematical expression from standard input
 		std::getline(std::cin, Expression);
 
+		// A line may choose its own simplifier, e.g. "egraph: x*1+y"
+		Opt.EGraph = DefaultEGraph;
+		SelectSimplifier(Expression, Opt.EGraph);
+
+		// A point after '@' asks for values instead of formulas
+		if (Expression.find('@') != std::string::npos)
+		{
+			PrintValues(Expression);
+			continue;
+		}
+
+		// Only the zero pattern of the first partials is asked for
+		if (Opt.Sparsity)
+		{
+			PrintSparsity(Expression);
+			continue;
+		}
+
+		// Several expressions separated by ';' form one vector-valued function
+		if (Expression.find(';') != std::string::npos)
+		{
+			PrintJacobian(Expression);
+			continue;
+		}
+
 		// -purpose: Stores tokenized components of the input expression
 	    // -usage: Feed to parser for expression tree construction
 		GenerateTokens(Expression, Tokens);
@@ -3761,15 +7720,7 @@ int main()
 			if constexpr (EnableDebugSimplifyI) { Original.Print(); }
 
 			// Calculate and print partial derivatives for each variable
-			for (auto [Name, ID] : VarMap)
-			{
-				// -purpose: Stores derivative expression for current variable
-				// -usage: Automatically simplifies during construction
-				Expr Partial(Original, ID);
-				if (DividedbyZero)continue;
-				printf("%s: ", Name.c_str());
-				Partial.Print();
-			}
+			PrintPartials(Original);
 		}
 	}
 	return 0;